@@ -0,0 +1,300 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+    /// stream names used in the summaries and the report
+    const char* const names[] = { "processed", "prescan", "rf", "imu" };
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(BenchStream::Count), "a name is needed per stream");
+
+    /// @return the host time in nanoseconds
+    long long now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// @return seconds between two time points
+    double seconds(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+    {
+        return std::chrono::duration<double>(b - a).count();
+    }
+}
+
+/// default constructor
+/// @param[in] interval seconds between the summaries, 0 to disable them
+Benchmark::Benchmark(double interval) : interval_(interval), running_(false), quit_(false)
+{
+    for (auto& c : counters_)
+    {
+        for (auto& h : c.histogram)
+            h.store(0, std::memory_order_relaxed);
+    }
+    started_ = reported_ = stopped_ = std::chrono::steady_clock::now();
+}
+
+/// destructor
+Benchmark::~Benchmark()
+{
+    stop();
+}
+
+/// starts measuring and the reporter thread
+void Benchmark::start()
+{
+    if (running_)
+        return;
+
+    running_ = true;
+    started_ = reported_ = std::chrono::steady_clock::now();
+    quit_ = false;
+    if (interval_ > 0)
+        thread_ = std::thread(&Benchmark::loop, this);
+}
+
+/// stops measuring and the reporter thread, and prints the summary of the last partial interval, or of the whole
+/// run when the periodic summaries are disabled
+void Benchmark::stop()
+{
+    if (!running_)
+        return;
+
+    running_ = false;
+    if (thread_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            quit_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+    stopped_ = std::chrono::steady_clock::now();
+    report(seconds(reported_, stopped_));
+}
+
+/// forgets the latest timestamps, called when imaging stops or restarts so the pause isn't counted as drops or in the rates
+void Benchmark::resync()
+{
+    for (auto& c : counters_)
+    {
+        c.lastTm.store(0, std::memory_order_relaxed);
+        c.interval.store(0, std::memory_order_relaxed);
+        const auto first = c.firstHost.exchange(0, std::memory_order_relaxed);
+        if (first)
+        {
+            c.active.fetch_add(c.lastHost.load(std::memory_order_relaxed) - first, std::memory_order_relaxed);
+            c.runs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+/// records a frame or sample, called from the sdk threads
+/// @param[in] stream the stream the frame belongs to
+/// @param[in] tm the probe timestamp of the frame in nanoseconds
+/// @param[in] bytes size of the frame
+/// @param[in] fps frame rate reported with the frame, 0 to learn the interval from the timestamps
+void Benchmark::sample(BenchStream stream, long long tm, uint64_t bytes, double fps)
+{
+    auto& c = counters_[static_cast<int>(stream)];
+    c.frames.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    const auto host = now();
+    long long unset = 0;
+    c.firstHost.compare_exchange_strong(unset, host, std::memory_order_relaxed);
+    c.lastHost.store(host, std::memory_order_relaxed);
+
+    // the offset between the clocks is taken from the fastest delivery, the latency is whatever comes on top of it
+    const auto offset = host - tm;
+    auto best = c.offset.load(std::memory_order_relaxed);
+    if (!c.offsetSet.load(std::memory_order_acquire))
+    {
+        c.offset.store(offset, std::memory_order_relaxed);
+        c.offsetSet.store(true, std::memory_order_release);
+        best = offset;
+    }
+    while (offset < best && !c.offset.compare_exchange_weak(best, offset, std::memory_order_relaxed))
+        ;
+    const auto latency = static_cast<uint64_t>(std::max(offset - std::min(best, offset), 0LL) / 1000);
+    c.latencySum.fetch_add(latency, std::memory_order_relaxed);
+    auto mx = c.latencyMax.load(std::memory_order_relaxed);
+    while (latency > mx && !c.latencyMax.compare_exchange_weak(mx, latency, std::memory_order_relaxed))
+        ;
+    const auto bucket = std::min(static_cast<uint64_t>(BENCH_BUCKETS), latency / BENCH_BUCKET_US);
+    c.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    // gaps in the timestamps larger than the frame interval are frames that never arrived
+    const auto last = c.lastTm.exchange(tm, std::memory_order_relaxed);
+    const auto gap = tm - last;
+    if (!last || gap <= 0)
+        return;
+
+    auto expected = (fps > 0) ? static_cast<long long>(1e9 / fps) : c.interval.load(std::memory_order_relaxed);
+    if (fps <= 0)
+    {
+        // learn the interval from the gaps that don't look like drops
+        if (!expected || c.frames.load(std::memory_order_relaxed) < BENCH_WARMUP)
+            expected = expected ? std::min(expected, gap) : gap;
+        else if (gap < expected * BENCH_DROP_GAP)
+            expected += (gap - expected) / 16;
+        c.interval.store(expected, std::memory_order_relaxed);
+    }
+
+    if (expected > 0 && c.frames.load(std::memory_order_relaxed) > BENCH_WARMUP && gap > expected * BENCH_DROP_GAP)
+        c.dropped.fetch_add(static_cast<uint64_t>(std::llround(static_cast<double>(gap) / expected)) - 1, std::memory_order_relaxed);
+}
+
+/// copies the counters of a stream
+/// @param[in] stream the stream to copy
+/// @param[out] s the copy
+void Benchmark::snapshot(BenchStream stream, Snapshot& s) const
+{
+    const auto& c = counters_[static_cast<int>(stream)];
+    s.frames = c.frames.load(std::memory_order_relaxed);
+    s.bytes = c.bytes.load(std::memory_order_relaxed);
+    s.dropped = c.dropped.load(std::memory_order_relaxed);
+    s.latencySum = c.latencySum.load(std::memory_order_relaxed);
+    for (auto i = 0; i <= BENCH_BUCKETS; i++)
+        s.histogram[i] = c.histogram[i].load(std::memory_order_relaxed);
+}
+
+/// finds a percentile of a latency histogram
+/// @param[in] histogram the counts per bucket
+/// @param[in] count total of the counts
+/// @param[in] p the percentile, between 0 and 1
+/// @return the upper bound of the bucket holding the percentile in milliseconds
+double Benchmark::percentile(const uint64_t* histogram, uint64_t count, double p)
+{
+    if (!count)
+        return 0;
+
+    const auto target = static_cast<uint64_t>(std::ceil(p * static_cast<double>(count)));
+    uint64_t sum = 0;
+    for (auto i = 0; i <= BENCH_BUCKETS; i++)
+    {
+        sum += histogram[i];
+        if (sum >= target)
+            return (i + 1) * BENCH_BUCKET_US / 1000.0;
+    }
+    return (BENCH_BUCKETS + 1) * BENCH_BUCKET_US / 1000.0;
+}
+
+/// reporter thread, prints a summary every interval
+void Benchmark::loop()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    auto next = std::chrono::steady_clock::now();
+    const auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval_));
+    for (;;)
+    {
+        next += step;
+        if (wake_.wait_until(lock, next, [this]() { return quit_; }))
+            break;
+
+        lock.unlock();
+        const auto tp = std::chrono::steady_clock::now();
+        report(seconds(reported_, tp));
+        reported_ = tp;
+        lock.lock();
+    }
+}
+
+/// prints the counters gathered since the previous summary, one line per active stream, in a single write
+/// @param[in] secs length of the interval in seconds
+void Benchmark::report(double secs)
+{
+    char out[1024];
+    auto n = std::snprintf(out, sizeof(out), "[%8.1fs]", seconds(started_, std::chrono::steady_clock::now()));
+    bool active = false;
+    Snapshot s;
+    for (auto i = 0; i < static_cast<int>(BenchStream::Count); i++)
+    {
+        snapshot(static_cast<BenchStream>(i), s);
+        auto& prev = previous_[i];
+        const auto frames = s.frames - prev.frames;
+        if (!frames || secs <= 0)
+        {
+            prev = s;
+            continue;
+        }
+
+        uint64_t histogram[BENCH_BUCKETS + 1];
+        for (auto j = 0; j <= BENCH_BUCKETS; j++)
+            histogram[j] = s.histogram[j] - prev.histogram[j];
+
+        n += std::snprintf(out + n, sizeof(out) - n, "%s %s %.1f fps %.2f MB/s drops %llu latency p50 %.1f p99 %.1f ms",
+            active ? " |" : "", names[i], frames / secs, (s.bytes - prev.bytes) / secs / 1e6,
+            static_cast<unsigned long long>(s.dropped - prev.dropped), percentile(histogram, frames, 0.5), percentile(histogram, frames, 0.99));
+        n = std::min(n, static_cast<int>(sizeof(out)) - 2);
+        active = true;
+        prev = s;
+    }
+
+    if (!active)
+        n += std::snprintf(out + n, sizeof(out) - n, " no data");
+    out[n++] = '\n';
+    std::fwrite(out, 1, static_cast<size_t>(n), stdout);
+    std::fflush(stdout);
+}
+
+/// writes the totals since the start as a json report
+/// @param[in] path the destination file
+/// @return success of the call
+bool Benchmark::save(const std::string& path) const
+{
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+
+    const auto end = running_ ? std::chrono::steady_clock::now() : stopped_;
+    const auto secs = seconds(started_, end);
+    std::fprintf(f, "{\n  \"seconds\": %.3f,\n  \"bucketMs\": %.3f,\n  \"streams\": {", secs, BENCH_BUCKET_US / 1000.0);
+
+    Snapshot s;
+    bool first = true;
+    for (auto i = 0; i < static_cast<int>(BenchStream::Count); i++)
+    {
+        snapshot(static_cast<BenchStream>(i), s);
+        if (!s.frames)
+            continue;
+
+        // the rates cover the time the stream was delivering, each run's first sample only starts its first interval
+        const auto& c = counters_[i];
+        const auto mx = c.latencyMax.load(std::memory_order_relaxed);
+        const auto firstHost = c.firstHost.load(std::memory_order_relaxed);
+        const auto span = (c.active.load(std::memory_order_relaxed) + (firstHost ? c.lastHost.load(std::memory_order_relaxed) - firstHost : 0)) / 1e9;
+        const auto runs = c.runs.load(std::memory_order_relaxed) + (firstHost ? 1 : 0);
+        const auto intervals = (s.frames > runs) ? static_cast<double>(s.frames - runs) : 0.0;
+        const auto fps = (span > 0) ? intervals / span : 0.0;
+        std::fprintf(f, "%s\n    \"%s\": {\n", first ? "" : ",", names[i]);
+        std::fprintf(f, "      \"frames\": %llu,\n      \"bytes\": %llu,\n      \"dropped\": %llu,\n      \"seconds\": %.3f,\n",
+            static_cast<unsigned long long>(s.frames), static_cast<unsigned long long>(s.bytes), static_cast<unsigned long long>(s.dropped), span);
+        std::fprintf(f, "      \"fps\": %.3f,\n      \"bytesPerSecond\": %.1f,\n      \"dropRate\": %.6f,\n",
+            fps, fps * static_cast<double>(s.bytes) / static_cast<double>(s.frames),
+            static_cast<double>(s.dropped) / static_cast<double>(s.frames + s.dropped));
+        std::fprintf(f, "      \"latencyMs\": { \"mean\": %.3f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.3f },\n",
+            s.latencySum / 1000.0 / s.frames, percentile(s.histogram, s.frames, 0.5), percentile(s.histogram, s.frames, 0.9),
+            percentile(s.histogram, s.frames, 0.99), percentile(s.histogram, s.frames, 0.999), mx / 1000.0);
+
+        // sparse histogram as [upper bound in ms, count] pairs, the overflow bucket has no upper bound
+        std::fprintf(f, "      \"histogram\": [");
+        bool firstBucket = true;
+        for (auto j = 0; j <= BENCH_BUCKETS; j++)
+        {
+            if (!s.histogram[j])
+                continue;
+            if (j < BENCH_BUCKETS)
+                std::fprintf(f, "%s[%.1f, %llu]", firstBucket ? "" : ", ", (j + 1) * BENCH_BUCKET_US / 1000.0, static_cast<unsigned long long>(s.histogram[j]));
+            else
+                std::fprintf(f, "%s[null, %llu]", firstBucket ? "" : ", ", static_cast<unsigned long long>(s.histogram[j]));
+            firstBucket = false;
+        }
+        std::fprintf(f, "]\n    }");
+        first = false;
+    }
+
+    std::fprintf(f, "\n  }\n}\n");
+    return std::fclose(f) == 0;
+}
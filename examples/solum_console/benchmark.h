@@ -0,0 +1,101 @@
+#pragma once
+
+#include <solum/solum_def.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define BENCH_BUCKET_US     100     // latency histogram bucket width in microseconds
+#define BENCH_BUCKETS       1000    // latency histogram buckets, later latencies land in an overflow bucket
+#define BENCH_INTERVAL      1.0     // default seconds between summaries
+#define BENCH_DROP_GAP      1.5     // # of expected intervals between timestamps past which frames are counted as dropped
+#define BENCH_WARMUP        16      // samples used to learn the interval of streams that don't report a frame rate
+
+/// streams measured by the benchmark
+enum class BenchStream
+{
+    Processed,  ///< processed images
+    Prescan,    ///< prescan (raw) envelope images
+    Rf,         ///< rf data
+    Imu,        ///< streamed imu samples
+    Count
+};
+
+/// throughput benchmark of the sdk callbacks
+///
+/// the callbacks only update lock free counters of their stream: frames, bytes, dropped frames detected from gaps in
+/// the timestamps, and a histogram of the delivery latency; a reporter thread prints a summary per interval from
+/// deltas of the counters, so nothing is printed or locked on the sdk threads
+///
+/// the probe timestamps don't share the host clock, so the latency is measured relative to the fastest delivery
+/// seen on the stream, which keeps the network and host jitter while cancelling the clock offset
+///
+/// the rates in the report are measured per stream from its first to its last sample, leaving out the time spent
+/// connecting and the pauses between imaging runs
+class Benchmark
+{
+public:
+    explicit Benchmark(double interval = BENCH_INTERVAL);
+    ~Benchmark();
+
+    Benchmark(const Benchmark&) = delete;
+    Benchmark& operator=(const Benchmark&) = delete;
+
+    void start();
+    void stop();
+    void resync();
+    void sample(BenchStream stream, long long tm, uint64_t bytes, double fps = 0);
+    bool save(const std::string& path) const;
+
+private:
+    /// counters of a stream, written from the sdk threads and read by the reporter
+    struct Counters
+    {
+        std::atomic<uint64_t> frames{ 0 };          ///< # of frames received
+        std::atomic<uint64_t> bytes{ 0 };           ///< # of bytes received
+        std::atomic<uint64_t> dropped{ 0 };         ///< # of frames missing from the timestamps
+        std::atomic<uint64_t> latencySum{ 0 };      ///< sum of the latencies in microseconds
+        std::atomic<uint64_t> latencyMax{ 0 };      ///< largest latency in microseconds
+        std::atomic<uint64_t> histogram[BENCH_BUCKETS + 1];   ///< latency counts per bucket, the last one is the overflow
+        std::atomic<long long> lastTm{ 0 };         ///< latest timestamp, 0 before the first frame
+        std::atomic<long long> interval{ 0 };       ///< expected ns between frames, learned when no frame rate is given
+        std::atomic<long long> offset{ 0 };         ///< smallest host minus probe time seen
+        std::atomic<bool> offsetSet{ false };       ///< set once the offset holds a measurement
+        std::atomic<long long> firstHost{ 0 };      ///< host time of the first sample since the last resync, 0 before it
+        std::atomic<long long> lastHost{ 0 };       ///< host time of the latest sample
+        std::atomic<long long> active{ 0 };         ///< ns between the first and last samples of the earlier runs of the stream
+        std::atomic<uint64_t> runs{ 0 };            ///< # of earlier runs, each of which starts with a sample that closes no interval
+    };
+
+    /// copy of the counters taken by the reporter
+    struct Snapshot
+    {
+        uint64_t frames = 0;                        ///< # of frames received
+        uint64_t bytes = 0;                         ///< # of bytes received
+        uint64_t dropped = 0;                       ///< # of frames missing
+        uint64_t latencySum = 0;                    ///< sum of the latencies in microseconds
+        uint64_t histogram[BENCH_BUCKETS + 1] = {}; ///< latency counts per bucket
+    };
+
+    void loop();
+    void snapshot(BenchStream stream, Snapshot& s) const;
+    void report(double seconds);
+    static double percentile(const uint64_t* histogram, uint64_t count, double p);
+
+private:
+    Counters counters_[static_cast<int>(BenchStream::Count)];   ///< live counters per stream
+    Snapshot previous_[static_cast<int>(BenchStream::Count)];   ///< counters at the previous summary
+    double interval_;                                           ///< seconds between summaries
+    std::chrono::steady_clock::time_point started_;             ///< start of the measurement
+    std::chrono::steady_clock::time_point reported_;            ///< time of the previous summary
+    std::chrono::steady_clock::time_point stopped_;             ///< end of the measurement
+    std::mutex lock_;                                           ///< protects the shutdown flag
+    std::condition_variable wake_;                              ///< signals shutdown
+    std::thread thread_;                                        ///< reporter thread
+    bool running_;                                              ///< set between start and stop
+    bool quit_;                                                 ///< reporter shutdown flag
+};
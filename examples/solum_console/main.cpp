@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include <cstring>
@@ -15,6 +16,8 @@
 #endif
 
 #include <solum/solum.h>
+#include "benchmark.h"
+#include <memory>
 
 #define PRINT           std::cout << std::endl
 #define PRINTSL         std::cout << "\r"
@@ -27,6 +30,11 @@ static std::string ip_;
 static unsigned int port_ = 0;
 static char buffer_[2048];
 static int counter_ = 0;
+// benchmark mode
+static std::unique_ptr<Benchmark> bench_;
+static std::string benchJson_;
+static double benchInterval_ = BENCH_INTERVAL;
+static double benchDuration_ = 0;
 
 /// callback for error messages
 /// @param[in] code the error code
@@ -49,6 +57,10 @@ void connectFn(CusConnection res, int port, const char* status)
 
     if (res == ProbeConnected)
         PRINT << "streaming port: " << port;
+
+    // a timed benchmark runs without the command prompt, so imaging is started as soon as the probe connects
+    if (res == ProbeConnected && bench_ && benchDuration_ > 0 && solumRun(1) < 0)
+        ERROR << "run request failed";
 }
 
 /// callback for certification status
@@ -88,6 +100,10 @@ void swUpdateFn(CusSwUpdate res)
 /// @param[in] imaging 1 = running, 0 = stopped
 void imagingFn(CusImagingState state, int imaging)
 {
+    // a stop or restart leaves a gap in the timestamps that isn't a drop
+    if (bench_)
+        bench_->resync();
+
     if (state == ImagingReady)
         PRINT << "ready to image: " << ((imaging) ? "imaging running" : "imaging stopped");
     else if (state == CertExpired)
@@ -143,6 +159,13 @@ void newImuPort(int port)
 /// @param pos the positional information data streamed
 void newImuData(const CusPosInfo* pos)
 {
+    if (bench_)
+    {
+        if (pos)
+            bench_->sample(BenchStream::Imu, pos->tm, sizeof(CusPosInfo));
+        return;
+    }
+
     PRINT << "imu data streamed:";
     printImuData(1, pos);
 }
@@ -174,6 +197,13 @@ bool printCsv(const char* buf, int sz)
 /// @param[in] pos the buffer of positional data
 void newRawImageFn(const void* newImage, const CusRawImageInfo* nfo, int npos, const CusPosInfo* pos)
 {
+    if (bench_)
+    {
+        const auto sz = nfo->jpeg ? nfo->jpeg : nfo->lines * nfo->samples * (nfo->bitsPerSample / 8);
+        bench_->sample(nfo->rf ? BenchStream::Rf : BenchStream::Prescan, nfo->tm, static_cast<uint64_t>(sz), nfo->fps);
+        return;
+    }
+
 #ifdef PRINTRAW
     if (nfo->rf)
         PRINT << "new rf data (" << newImage << "): " << nfo->lines << " x " << nfo->samples << " @ " << nfo->bitsPerSample
@@ -200,6 +230,12 @@ void newRawImageFn(const void* newImage, const CusRawImageInfo* nfo, int npos, c
 void newProcessedImageFn(const void* newImage, const CusProcessedImageInfo* nfo, int npos, const CusPosInfo* pos)
 {
     (void)newImage;
+    if (bench_)
+    {
+        bench_->sample(BenchStream::Processed, nfo->tm, static_cast<uint64_t>(nfo->imageSize), nfo->fps);
+        return;
+    }
+
     PRINTSL << "new image (" << counter_++ << "): " << nfo->width << " x " << nfo->height << " @ " << nfo->bitsPerPixel << " bpp. @ "
             << nfo->imageSize << "bytes. @ " << nfo->micronsPerPixel << " microns per pixel. imu points: " << npos << std::flush;
 
@@ -427,8 +463,7 @@ int init(int& argc, char** argv)
     auto connectParams = solumDefaultConnectionParams();
     const int width  = 640;
     const int height = 480;
-    // ensure console buffers are flushed automatically
-    setvbuf(stdout, nullptr, _IONBF, 0) != 0 || setvbuf(stderr, nullptr, _IONBF, 0);
+    bool bench = false;
 
     // msvc doesn't have 'getopt' so use boost program_options instead
 #ifdef _MSC_VER
@@ -443,6 +478,10 @@ int init(int& argc, char** argv)
             ("address", po::value<std::string>(&ip_), "set the IP address of the host scanner")
             ("port", po::value<unsigned int>(&port_), "set the port of the host scanner")
             ("keydir", po::value<std::string>(&keydir)->default_value("/tmp/"), "set the path containing the security keys")
+            ("bench", "run the throughput benchmark instead of printing every frame")
+            ("json", po::value<std::string>(&benchJson_), "write a json benchmark report to this path when quitting, implies --bench")
+            ("interval", po::value<double>(&benchInterval_), "seconds between benchmark summaries")
+            ("duration", po::value<double>(&benchDuration_), "run the benchmark for this many seconds without the command prompt")
         ;
 
         po::variables_map vm;
@@ -455,6 +494,7 @@ int init(int& argc, char** argv)
         }
 
         po::notify(vm);
+        bench = vm.count("bench") || vm.count("json") || vm.count("duration");
     }
     catch (std::exception& e)
     {
@@ -471,7 +511,7 @@ int init(int& argc, char** argv)
     std::string keydir = "/tmp/";
 
     // check command line options
-    while ((o = getopt(argc, argv, "lk:a:p:")) != -1)
+    while ((o = getopt(argc, argv, "lk:a:p:bj:i:t:")) != -1)
     {
         switch (o)
         {
@@ -487,13 +527,35 @@ int init(int& argc, char** argv)
             try { port_ = std::stoi(optarg); }
             catch (std::exception&) { PRINT << port_; }
             break;
+        // benchmark mode, optionally with a json report, summary interval and duration
+        case 'b': bench = true; break;
+        case 'j': bench = true; benchJson_ = optarg; break;
+        case 'i': benchInterval_ = std::atof(optarg); break;
+        case 't': bench = true; benchDuration_ = std::atof(optarg); break;
         // invalid argument
-        case '?': PRINT << "invalid argument, valid options: -a [addr], -p [port], -k [keydir]"; break;
+        case '?': PRINT << "invalid argument, valid options: -a [addr], -p [port], -k [keydir], -b, -j [json], -i [interval], -t [seconds]"; break;
         default: break;
         }
     }
 #endif
 
+    // a timed benchmark has no command prompt to connect from, so it needs the probe address up front
+    if (benchDuration_ > 0 && (!ip_.size() || !port_))
+    {
+        ERROR << "a timed benchmark needs the probe address. run with '-a [addr] -p [port] -t [seconds]'" << std::endl;
+        return ERRCODE;
+    }
+
+    // the benchmark prints its summaries in single buffered writes, otherwise ensure console buffers are flushed automatically
+    if (bench)
+    {
+        setvbuf(stdout, nullptr, _IOFBF, 1 << 16);
+        bench_ = std::make_unique<Benchmark>(benchInterval_);
+        bench_->start();
+    }
+    else
+        setvbuf(stdout, nullptr, _IONBF, 0) != 0 || setvbuf(stderr, nullptr, _IONBF, 0);
+
     // ensure an ip address is specified with the port
     if (port_ && !ip_.size())
     {
@@ -550,9 +612,25 @@ int main(int argc, char* argv[])
     if (rcode != SUCCESS)
         return rcode;
 
-    std::atomic_bool quitFlag(false);
-    std::thread eventLoop(processEventLoop, std::ref(quitFlag));
-    eventLoop.join();
+    if (bench_ && benchDuration_ > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(benchDuration_));
+    else
+    {
+        std::atomic_bool quitFlag(false);
+        std::thread eventLoop(processEventLoop, std::ref(quitFlag));
+        eventLoop.join();
+    }
     solumDestroy();
+
+    if (bench_)
+    {
+        bench_->stop();
+        if (benchJson_.size() && !bench_->save(benchJson_))
+        {
+            ERROR << "could not write benchmark report: " << benchJson_;
+            rcode = ERRCODE;
+        }
+        std::cout << std::flush;
+    }
     return rcode;
 }
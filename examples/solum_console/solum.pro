@@ -7,4 +7,5 @@ LIBPATH = $$PWD/../../lib
 INCLUDEPATH += $$PWD/../../include
 LIBS += -L$$LIBPATH/ -lsolum
 
-SOURCES += main.cpp
+SOURCES += main.cpp benchmark.cpp
+HEADERS += benchmark.h
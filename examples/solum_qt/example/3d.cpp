@@ -3,11 +3,13 @@
 using namespace Qt3DCore;
 using namespace Qt3DRender;
 using namespace Qt3DExtras;
+using namespace Qt3DLogic;
 
 #define DEFAULT_VIEW    0.5, 0.5, -0.5, 0.5
 
 /// default constructor
-ProbeRender::ProbeRender(QScreen* sc) : Qt3DWindow(sc), orientation_(QQuaternion(DEFAULT_VIEW))
+ProbeRender::ProbeRender(QScreen* sc) : Qt3DWindow(sc), orientation_(QQuaternion(DEFAULT_VIEW)), dirty_(true), transform_(nullptr), probeEntity_(nullptr),
+    probe_(nullptr), frame_(nullptr)
 {
 }
 
@@ -35,28 +37,47 @@ QEntity* ProbeRender::createScene(const QString& model)
     probe_ = new QSceneLoader(probeEntity_);
     probe_->setSource(QUrl::fromLocalFile(model));
     probeEntity_->addComponent(probe_);
-    addTransform();
+
+    // the transform is added once, later poses only change its rotation
+    transform_ = new Qt3DCore::QTransform(probeEntity_);
+    transform_->setScale3D(QVector3D(100, 100, 100));
+    probeEntity_->addComponent(transform_);
+    applyOrientation();
+
+    frame_ = new QFrameAction(root);
+    connect(frame_, &QFrameAction::triggered, this, [this](float) { applyOrientation(); });
+    root->addComponent(frame_);
     return root;
 }
 
-/// adds a new transform based on the latest orientation
-void ProbeRender::addTransform()
+/// applies the latest orientation to the transform if it changed since the last frame
+void ProbeRender::applyOrientation()
 {
-    transform_.setScale3D(QVector3D(100, 100, 100));
-    QQuaternion axisCorrection(QQuaternion::fromEulerAngles(0, 180, 90));
-    QQuaternion modelCorrection(QQuaternion::fromEulerAngles(-90, 0, 90));
-    auto modelRotation = orientation_ * axisCorrection;
+    if (!transform_ || !dirty_.exchange(false))
+        return;
+
+    QQuaternion orientation;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        orientation = orientation_;
+    }
+
+    static const QQuaternion axisCorrection(QQuaternion::fromEulerAngles(0, 180, 90));
+    static const QQuaternion modelCorrection(QQuaternion::fromEulerAngles(-90, 0, 90));
+    auto modelRotation = orientation * axisCorrection;
     auto correctedOrientation = modelCorrection * modelRotation;
-    transform_.setRotation(correctedOrientation);
-    probeEntity_->addComponent(&transform_);
+    transform_->setRotation(correctedOrientation);
 }
 
-/// updates the latest orientation
+/// updates the latest orientation, applied with the next rendered frame
 /// @param[in] imu the latest imu data
 void ProbeRender::update(const QQuaternion& imu)
 {
-    orientation_ = imu;
-    addTransform();
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        orientation_ = imu;
+    }
+    dirty_ = true;
 }
 
 /// resets the view
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+
 /// probe rendering output
+///
+/// orientation updates only replace the pending pose, which is applied to the transform once per rendered frame
+/// from a frame action, so a fast imu stream costs a single scene update per display refresh
 class ProbeRender : public Qt3DExtras::Qt3DWindow
 {
     Q_OBJECT
@@ -12,11 +18,14 @@ public:
 
 private:
     Qt3DCore::QEntity* createScene(const QString& model);
-    void addTransform();
+    void applyOrientation();
 
 private:
-    QQuaternion orientation_;           ///< current orientation
-    Qt3DCore::QTransform transform_;    ///< transform matrix
+    QQuaternion orientation_;           ///< latest orientation, guarded by lock_
+    std::mutex lock_;                   ///< protects the latest orientation
+    std::atomic_bool dirty_;            ///< set when the orientation changed since the last frame
+    Qt3DCore::QTransform* transform_;   ///< transform matrix
     Qt3DCore::QEntity* probeEntity_;    ///< probe model node
     Qt3DRender::QSceneLoader* probe_;   ///< probe model scene
+    Qt3DLogic::QFrameAction* frame_;    ///< applies the latest orientation once per frame
 };
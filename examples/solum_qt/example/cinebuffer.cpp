@@ -0,0 +1,335 @@
+#include "cinebuffer.h"
+#include "recorder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define SLOT_ALIGN      64
+#define GUESS_STEPS     4   // interpolation steps before a lookup falls back to bisection
+
+/// allocates the slots, the only place the ring allocates, called on a ring that isn't shared yet
+/// @param[in] count # of slots, 0 to release the ring
+/// @param[in] infoSize size of the info struct stored with each slot
+/// @param[in] capacity maximum payload size
+void CineBuffer::Ring::allocate(int count, uint32_t infoSize, uint32_t capacity)
+{
+    infoSize_ = infoSize;
+    capacity_ = capacity;
+    count_ = std::max(0, count);
+    head_ = 0;
+    stride_ = sizeof(Slot) + infoSize + (MaxPositions * sizeof(CusPosInfo)) + capacity;
+    stride_ = (stride_ + SLOT_ALIGN - 1) & ~static_cast<size_t>(SLOT_ALIGN - 1);
+    // filling the memory faults every page in now rather than on the streaming thread
+    memory_.assign(static_cast<size_t>(count_) * stride_, 0);
+    memory_.shrink_to_fit();
+}
+
+/// copies a new entry into the oldest slot
+/// @param[in] tm the stream timestamp
+/// @param[in] host the host receive time
+/// @param[in] info the info struct
+/// @param[in] pos the positions
+/// @param[in] npos # of positions
+/// @param[in] data the payload
+/// @param[in] size size of the payload
+/// @return success of the call, false if the payload doesn't fit
+bool CineBuffer::Ring::push(int64_t tm, int64_t host, const void* info, const CusPosInfo* pos, int npos, const void* data, uint32_t size)
+{
+    if (!count_ || size > capacity_)
+        return false;
+
+    uint8_t* p = slot(head_);
+    Slot hdr;
+    hdr.tm = tm;
+    hdr.host = host;
+    hdr.size = data ? size : 0;
+    hdr.npos = pos ? static_cast<uint32_t>(std::clamp(npos, 0, MaxPositions)) : 0;
+    std::memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(Slot);
+    if (infoSize_)
+        std::memcpy(p, info, infoSize_);
+    p += infoSize_;
+    if (hdr.npos)
+        std::memcpy(p, pos, hdr.npos * sizeof(CusPosInfo));
+    p += MaxPositions * sizeof(CusPosInfo);
+    if (hdr.size)
+        std::memcpy(p, data, hdr.size);
+
+    head_++;
+    return true;
+}
+
+/// finds the entry closest to a timestamp
+/// @param[in] tm the timestamp to search for
+/// @param[in] host flag to search by host receive time rather than the stream timestamp
+/// @return the serial of the closest entry, or the head if the ring is empty
+/// @note the first guesses interpolate between the ends of the search range, so a steady frame rate resolves in a step or two
+uint64_t CineBuffer::Ring::find(int64_t tm, bool host) const
+{
+    if (!head_)
+        return head_;
+
+    auto key = [this, host](uint64_t s) { return host ? header(s)->host : header(s)->tm; };
+    uint64_t lo = first(), hi = head_ - 1;
+    int64_t klo = key(lo), khi = key(hi);
+    if (tm <= klo)
+        return lo;
+    if (tm >= khi)
+        return hi;
+
+    for (auto i = 0; (hi - lo) > 1; i++)
+    {
+        uint64_t mid = lo + ((hi - lo) / 2);
+        if (i < GUESS_STEPS && khi > klo)
+        {
+            const double f = static_cast<double>(tm - klo) / static_cast<double>(khi - klo);
+            mid = std::clamp(lo + static_cast<uint64_t>(f * static_cast<double>(hi - lo)), lo + 1, hi - 1);
+        }
+
+        const int64_t k = key(mid);
+        if (k == tm)
+            return mid;
+        if (k < tm)
+        {
+            lo = mid;
+            klo = k;
+        }
+        else
+        {
+            hi = mid;
+            khi = k;
+        }
+    }
+
+    return ((tm - klo) <= (khi - tm)) ? lo : hi;
+}
+
+/// finds the first entry received at or after a host time
+/// @param[in] host the host time
+/// @return the serial of the entry, or the head if there is none
+uint64_t CineBuffer::Ring::after(int64_t host) const
+{
+    auto s = find(host, true);
+    if (s < head_ && header(s)->host < host)
+        s++;
+    return s;
+}
+
+/// default constructor
+CineBuffer::CineBuffer() : fps_(0), dropped_(0)
+{
+}
+
+/// allocates the rings for the current stream configuration, discarding any buffered data
+/// @param[in] seconds the duration to hold
+/// @param[in] fps the frame rate of the processed stream
+/// @param[in] frameBytes the maximum processed frame size
+/// @param[in] rawBytes the maximum raw frame size, 0 to not buffer raw frames
+/// @param[in] imuRate the imu sample rate, 0 to not buffer imu samples
+/// @param[in] overlays flag to buffer separated color overlays, which arrive as a second processed stream
+/// @return success of the call
+bool CineBuffer::configure(double seconds, double fps, uint32_t frameBytes, uint32_t rawBytes, double imuRate, bool overlays)
+{
+    if (seconds <= 0 || fps <= 0 || !frameBytes)
+        return false;
+
+    // the rings are allocated and filled outside the lock, which can take a while for long cines, then swapped in,
+    // the previous rings are released once the lock is dropped
+    const auto frames = static_cast<int>(std::ceil(seconds * fps)) + 1;
+    Ring processed, overlay, raw, imu;
+    processed.allocate(frames, sizeof(CusProcessedImageInfo), frameBytes);
+    overlay.allocate(overlays ? frames : 0, sizeof(CusProcessedImageInfo), frameBytes);
+    raw.allocate(rawBytes ? frames : 0, sizeof(CusRawImageInfo), rawBytes);
+    imu.allocate((imuRate > 0) ? static_cast<int>(std::ceil(seconds * imuRate)) + 1 : 0, 0, 0);
+
+    std::lock_guard<std::mutex> lock(lock_);
+    std::swap(processed_, processed);
+    std::swap(overlay_, overlay);
+    std::swap(raw_, raw);
+    std::swap(imu_, imu);
+    dropped_ = 0;
+    return true;
+}
+
+/// discards all buffered data, keeping the allocation
+void CineBuffer::clear()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    processed_.head_ = 0;
+    overlay_.head_ = 0;
+    raw_.head_ = 0;
+    imu_.head_ = 0;
+}
+
+/// buffers a processed frame or a separated overlay, overlays are skipped unless configured
+/// @param[in] img the image data
+/// @param[in] nfo the image information
+/// @param[in] npos # of positions tagged with the image
+/// @param[in] pos the positions
+void CineBuffer::processed(const void* img, const CusProcessedImageInfo* nfo, int npos, const CusPosInfo* pos)
+{
+    if (!nfo)
+        return;
+
+    if (nfo->fps > 0 && !nfo->overlay)
+        fps_ = nfo->fps;
+    const auto host = CineRecorder::now();
+    std::lock_guard<std::mutex> lock(lock_);
+    auto& ring = nfo->overlay ? overlay_ : processed_;
+    if (ring.count_ && !ring.push(nfo->tm, host, nfo, pos, npos, img, static_cast<uint32_t>(std::max(0, nfo->imageSize))))
+        dropped_++;
+}
+
+/// buffers a raw frame
+/// @param[in] img the raw data
+/// @param[in] nfo the raw image information
+/// @param[in] npos # of positions tagged with the image
+/// @param[in] pos the positions
+void CineBuffer::raw(const void* img, const CusRawImageInfo* nfo, int npos, const CusPosInfo* pos)
+{
+    if (!nfo)
+        return;
+
+    const auto sz = nfo->jpeg ? nfo->jpeg : (nfo->lines * nfo->samples * (nfo->bitsPerSample / 8));
+    const auto host = CineRecorder::now();
+    std::lock_guard<std::mutex> lock(lock_);
+    if (raw_.count_ && !raw_.push(nfo->tm, host, nfo, pos, npos, img, static_cast<uint32_t>(std::max(0, sz))))
+        dropped_++;
+}
+
+/// buffers an imu sample
+/// @param[in] pos the sample
+void CineBuffer::imu(const CusPosInfo* pos)
+{
+    if (!pos)
+        return;
+
+    const auto host = CineRecorder::now();
+    std::lock_guard<std::mutex> lock(lock_);
+    imu_.push(pos->tm, host, nullptr, pos, 1, nullptr, 0);
+}
+
+/// retrieves the processed frame closest to a timestamp
+/// @param[in] tm the stream timestamp
+/// @param[out] img the image data
+/// @param[out] nfo the image information
+/// @return success of the call
+bool CineBuffer::frame(int64_t tm, std::vector<uint8_t>& img, CusProcessedImageInfo& nfo)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto s = processed_.find(tm, false);
+    if (s >= processed_.head_)
+        return false;
+
+    const uint8_t* p = processed_.slot(s);
+    const auto* hdr = reinterpret_cast<const Slot*>(p);
+    std::memcpy(&nfo, p + sizeof(Slot), sizeof(nfo));
+    img.resize(hdr->size);
+    std::memcpy(img.data(), p + sizeof(Slot) + processed_.infoSize_ + (MaxPositions * sizeof(CusPosInfo)), hdr->size);
+    return true;
+}
+
+/// writes the latest buffered data into a recorder in receive order
+/// @param[in] recorder an open recorder
+/// @param[in] seconds how far back to save, measured from the newest entry
+/// @return the # of entries written
+/// @note each entry is copied out under the lock and written after releasing it, so streaming continues while a
+///       clip is saved, even when the recorder waits for a chunk, and entries overwritten meanwhile are skipped
+uint64_t CineBuffer::save(CineRecorder& recorder, double seconds)
+{
+    if (!recorder.isOpen())
+        return 0;
+
+    Ring* rings[4] = { &processed_, &overlay_, &raw_, &imu_ };
+    uint64_t next[4], end[4];
+    std::vector<uint8_t> entry;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        int64_t newest = INT64_MIN;
+        for (auto r : rings)
+            if (r->head_)
+                newest = std::max(newest, r->header(r->head_ - 1)->host);
+        if (newest == INT64_MIN)
+            return 0;
+
+        const int64_t from = newest - static_cast<int64_t>(seconds * 1e9);
+        size_t stride = 0;
+        for (auto i = 0; i < 4; i++)
+        {
+            next[i] = rings[i]->after(from);
+            end[i] = rings[i]->head_;
+            stride = std::max(stride, rings[i]->stride_);
+        }
+        entry.resize(stride);
+    }
+
+    // a clip is written far faster than real time, so wait for chunks instead of dropping
+    recorder.setBlocking(true);
+
+    uint64_t written = 0;
+    for (;;)
+    {
+        int best = -1;
+        uint32_t infoSize = 0;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            // merge the rings by receive time, a ring reconfigured meanwhile restarts its serials and ends its part of the clip
+            int64_t host = 0;
+            for (auto i = 0; i < 4; i++)
+            {
+                next[i] = std::max(next[i], rings[i]->first());
+                if (next[i] < std::min(end[i], rings[i]->head_) && (best < 0 || rings[i]->header(next[i])->host < host))
+                {
+                    best = i;
+                    host = rings[i]->header(next[i])->host;
+                }
+            }
+            if (best < 0)
+                break;
+
+            const Ring* r = rings[best];
+            const uint8_t* p = r->slot(next[best]++);
+            const auto used = sizeof(Slot) + r->infoSize_ + (MaxPositions * sizeof(CusPosInfo)) + reinterpret_cast<const Slot*>(p)->size;
+            if (entry.size() < used)
+                entry.resize(r->stride_);
+            std::memcpy(entry.data(), p, used);
+            infoSize = r->infoSize_;
+        }
+
+        const uint8_t* p = entry.data();
+        const auto* hdr = reinterpret_cast<const Slot*>(p);
+        const uint8_t* info = p + sizeof(Slot);
+        const auto* pos = reinterpret_cast<const CusPosInfo*>(info + infoSize);
+        const uint8_t* data = info + infoSize + (MaxPositions * sizeof(CusPosInfo));
+        const int npos = static_cast<int>(hdr->npos);
+        if (best <= 1)
+            recorder.processed(data, reinterpret_cast<const CusProcessedImageInfo*>(info), npos, npos ? pos : nullptr, hdr->host);
+        else if (best == 2)
+            recorder.raw(data, reinterpret_cast<const CusRawImageInfo*>(info), npos, npos ? pos : nullptr, hdr->host);
+        else
+            recorder.imu(pos, hdr->host);
+        written++;
+    }
+
+    recorder.setBlocking(false);
+    return written;
+}
+
+/// retrieves the # of buffered processed frames
+/// @return the frame count
+int CineBuffer::frames() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return static_cast<int>(processed_.head_ - processed_.first());
+}
+
+/// retrieves the span of the buffered processed frames
+/// @return the duration in seconds
+double CineBuffer::duration() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (processed_.head_ < 2)
+        return 0;
+
+    return static_cast<double>(processed_.header(processed_.head_ - 1)->host - processed_.header(processed_.first())->host) / 1e9;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <solum/solum_def.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class CineRecorder;
+
+/// retrospective cine kept on the host, holding the last n seconds of the streams in preallocated rings
+///
+/// inserts are a single copy into the next slot and never allocate, timestamp lookups start from an interpolated
+/// guess so they typically touch one or two slots, and saving a clip is a straight copy into a CineRecorder
+/// without any transfer from the probe
+class CineBuffer
+{
+public:
+    static constexpr int MaxPositions = 8;  ///< imu samples kept per frame
+
+    CineBuffer();
+
+    bool configure(double seconds, double fps, uint32_t frameBytes, uint32_t rawBytes = 0, double imuRate = 0, bool overlays = false);
+    void clear();
+    bool isConfigured() const { return processed_.count_ > 0; }
+    uint32_t frameCapacity() const { return processed_.capacity_; }
+
+    void processed(const void* img, const CusProcessedImageInfo* nfo, int npos, const CusPosInfo* pos);
+    void raw(const void* img, const CusRawImageInfo* nfo, int npos, const CusPosInfo* pos);
+    void imu(const CusPosInfo* pos);
+
+    bool frame(int64_t tm, std::vector<uint8_t>& img, CusProcessedImageInfo& nfo);
+    uint64_t save(CineRecorder& recorder, double seconds);
+
+    int frames() const;
+    double duration() const;
+    double fps() const { return fps_; }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    /// slot header, followed by the info struct, positions and payload
+    struct Slot
+    {
+        int64_t tm;         ///< stream timestamp
+        int64_t host;       ///< host receive time
+        uint32_t size;      ///< payload size
+        uint32_t npos;      ///< # of positions
+    };
+
+    /// ring of fixed size slots in a single allocation
+    struct Ring
+    {
+        void allocate(int count, uint32_t infoSize, uint32_t capacity);
+        bool push(int64_t tm, int64_t host, const void* info, const CusPosInfo* pos, int npos, const void* data, uint32_t size);
+        uint8_t* slot(uint64_t serial) { return memory_.data() + ((serial % static_cast<uint64_t>(count_)) * stride_); }
+        const uint8_t* slot(uint64_t serial) const { return memory_.data() + ((serial % static_cast<uint64_t>(count_)) * stride_); }
+        const Slot* header(uint64_t serial) const { return reinterpret_cast<const Slot*>(slot(serial)); }
+        uint64_t first() const { return (head_ > static_cast<uint64_t>(count_)) ? (head_ - count_) : 0; }
+        uint64_t find(int64_t tm, bool host) const;
+        uint64_t after(int64_t host) const;
+
+        std::vector<uint8_t> memory_;   ///< all slots
+        size_t stride_ = 0;             ///< slot size
+        int count_ = 0;                 ///< # of slots
+        uint32_t infoSize_ = 0;         ///< size of the info struct
+        uint32_t capacity_ = 0;         ///< maximum payload size
+        uint64_t head_ = 0;             ///< serial of the next insert, the ring holds [head - count, head)
+    };
+
+private:
+    mutable std::mutex lock_;       ///< protects the rings
+    Ring processed_;                ///< processed frames
+    Ring overlay_;                  ///< separated color overlays, kept apart so they don't halve the processed history
+    Ring raw_;                      ///< raw (pre-scan) frames
+    Ring imu_;                      ///< imu samples
+    std::atomic<double> fps_;       ///< latest reported frame rate
+    std::atomic<uint64_t> dropped_; ///< # of frames too large for their slot
+};
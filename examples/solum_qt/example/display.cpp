@@ -1,53 +1,79 @@
 #include "display.h"
 #include <solum/solum.h>
 
+#define OUTPUT_QUANTUM  16      // output sizes are snapped down to multiples of this many pixels
+#define OUTPUT_MIN      64      // smallest output size requested along either axis
+#define OUTPUT_SETTLE   150     // ms the view size has to stay put before a new output size is requested
+#define OUTPUT_ROI      250     // ms after an output size request before the regions are retrieved again
+
+/// finds the minimum and maximum of a block of 16 bit samples
+/// @param[in] buf the samples
+/// @param[in] n # of samples, must be at least 1
+/// @param[out] mn the minimum value
+/// @param[out] mx the maximum value
+/// @note a column typically spans only a handful of samples, so a plain loop is as fast as vector code here
+static void minMax(const int16_t* buf, int n, int16_t& mn, int16_t& mx)
+{
+    mn = buf[0];
+    mx = buf[0];
+    for (auto i = 1; i < n; i++)
+    {
+        mn = std::min(mn, buf[i]);
+        mx = std::max(mx, buf[i]);
+    }
+}
+
 /// default constructor
 /// @param[in] parent the parent object
-UltrasoundImage::UltrasoundImage(bool overlay, QWidget* parent) : QGraphicsView(parent), depth_(0), overlay_(overlay)
+UltrasoundImage::UltrasoundImage(bool overlay, QWidget* parent) : QGraphicsView(parent), depth_(0), overlay_(overlay), image_(nullptr), annotated_(false)
 {
     QGraphicsScene* sc = new QGraphicsScene(this);
     setScene(sc);
+    // the background is plain black, so it's rendered once and blitted under the repainted areas
+    setCacheMode(QGraphicsView::CacheBackground);
+
+    // initialize to some arbitrary size
+    setSceneRect(0, 0, 320, 240);
 
-    // initialize image to some arbitrary size
-    image_ = QImage(320, 240, QImage::Format_ARGB32);
-    image_.fill(Qt::black);
-    setSceneRect(0, 0, image_.width(), image_.height());
+    settle_.setSingleShot(true);
+    settle_.setInterval(OUTPUT_SETTLE);
+    connect(&settle_, &QTimer::timeout, this, &UltrasoundImage::commitOutputSize);
 
     QSizePolicy p(QSizePolicy::Preferred, QSizePolicy::Preferred);
     p.setHeightForWidth(true);
     setSizePolicy(p);
 }
 
-/// loads a new image from raw data
-/// @param[in] img the new image data
-/// @param[in] w the image width
-/// @param[in] h the image height
-/// @param[in] bpp bits per pixel
-/// @param[in] format the image format
-/// @param[in] sz size of image in bytes
-void UltrasoundImage::loadImage(const void* img, int w, int h, int bpp, CusImageFormat format, int sz)
-{
-    // check for size match
-    if (image_.width() != w || image_.height() != h)
+/// sets a new decoded image to draw, images of any size are accepted and scaled to the view
+/// @param[in] img the image, has to stay valid until replaced, typically the front image of the image pipeline
+void UltrasoundImage::setImage(const QImage* img)
+{
+    if (!img)
         return;
 
-    // ensure the qimage format matches
-    if (format == Uncompressed8Bit && image_.format() != QImage::Format_Grayscale8)
-        image_.convertTo(QImage::Format_Grayscale8);
-    else if (format != Uncompressed8Bit && image_.format() != QImage::Format_ARGB32)
-        image_.convertTo(QImage::Format_ARGB32);
-
-    // set the image data
-    // check that the size matches the dimensions (uncompressed)
-    if (sz >= (w * h * (bpp / 8)))
-        std::memcpy(image_.bits(), img, w * h * (bpp / 8));
-    // try to load jpeg
-    else if (format == Jpeg)
-        image_.loadFromData(static_cast<const uchar*>(img), sz, "JPG");
-    else if (format == Png)
-        image_.loadFromData(static_cast<const uchar*>(img), sz, "PNG");
+    image_ = img;
 
-    // redraw
+    // only repaint the area of the image, along with the area of the previous one in case it was larger
+    auto rc = fit(img->size()).mapRect(QRectF(QPointF(0, 0), QSizeF(img->size())));
+    scene()->invalidate(rc.united(imageRect_), QGraphicsScene::ForegroundLayer);
+    imageRect_ = rc;
+}
+
+/// sets the depth shown in the corner of the view
+/// @param[in] d the depth in cm, 0 to hide it
+void UltrasoundImage::setDepth(double d)
+{
+    if (d == depth_)
+        return;
+
+    depth_ = d;
+    invalidateAnnotations();
+}
+
+/// flags the annotation layer for rendering and repaints the whole view
+void UltrasoundImage::invalidateAnnotations()
+{
+    annotated_ = false;
     scene()->invalidate();
 }
 
@@ -64,6 +90,8 @@ void UltrasoundImage::checkActiveRegion()
         for (auto i = 0u; i < 4; i++)
             roi.push_back(QPointF(buf[i * 2], buf[(i * 2) + 1]));
         activeRoi_ = roi;
+        overlaySize_ = output_;
+        invalidateAnnotations();
     }
 }
 
@@ -78,9 +106,11 @@ void UltrasoundImage::checkRoi()
         for (auto i = 0u; i < 32; i++)
             roi.push_back(QPointF(buf[i * 2], buf[(i * 2) + 1]));
         modeRoi_ = roi;
+        overlaySize_ = output_;
     }
     else
         modeRoi_.clear();
+    invalidateAnnotations();
 }
 
 /// checks if there's a valid gate that should be drawn
@@ -99,9 +129,11 @@ void UltrasoundImage::checkGate()
         gate_.push_back(convertLine(lines.normalTop));
         gate_.push_back(convertLine(lines.normalBottom));
         gate_.push_back(convertLine(lines.bottom));
+        overlaySize_ = output_;
     }
     else
         gate_.clear();
+    invalidateAnnotations();
 }
 
 /// handles resizing of the image view
@@ -111,26 +143,68 @@ void UltrasoundImage::resizeEvent(QResizeEvent* e)
     auto w = e->size().width(), h = e->size().height();
 
     setSceneRect(0, 0, w, h);
-    if (!overlay_)
-        solumSetOutputSize(w, h);
+    annotated_ = false;
+    imageRect_ = QRectF();
 
-    image_ = QImage(w, h, QImage::Format_ARGB32);
-    image_.fill(Qt::black);
-
-    // update the roi in the case of a resize
+    // the current stream keeps being shown scaled, the probe is only reconfigured once the size settles, or right
+    // away for the very first size so imaging can start
     if (!overlay_)
     {
-        QTimer::singleShot(250, [this]()
-        {
-            checkActiveRegion();
-            checkRoi();
-            checkGate();
-        });
+        if (output_.isEmpty())
+            commitOutputSize();
+        else
+            settle_.start();
     }
 
     QGraphicsView::resizeEvent(e);
 }
 
+/// requests the quantized view size as the new output size if it changed, and retrieves the regions once applied
+void UltrasoundImage::commitOutputSize()
+{
+    auto r = sceneRect();
+    auto quantize = [](qreal v)
+    {
+        const auto px = (static_cast<int>(v) / OUTPUT_QUANTUM) * OUTPUT_QUANTUM;
+        return std::max(px, OUTPUT_MIN);
+    };
+
+    const QSize sz(quantize(r.width()), quantize(r.height()));
+    if (sz == output_)
+        return;
+
+    output_ = sz;
+    solumSetOutputSize(sz.width(), sz.height());
+    invalidateAnnotations();
+
+    // update the roi in the case of a resize
+    QTimer::singleShot(OUTPUT_ROI, this, [this]()
+    {
+        checkActiveRegion();
+        checkRoi();
+        checkGate();
+    });
+}
+
+/// maps content produced for an output size onto the view, frames of other sizes keep being shown scaled while a new
+/// output size settles and propagates through the probe
+/// @param[in] sz the output size the content was produced for
+/// @return the transform, uniformly scaled to fit unless the content has the requested output size, centered
+///         horizontally and anchored at the top like the image
+QTransform UltrasoundImage::fit(const QSize& sz) const
+{
+    auto r = sceneRect();
+    if (sz.isEmpty() || (sz.width() == static_cast<int>(r.width()) && sz.height() == static_cast<int>(r.height())))
+        return QTransform();
+
+    // the requested size is quantized below the view size, so it's drawn 1:1
+    if (sz == output_)
+        return QTransform::fromTranslate((r.width() - sz.width()) / 2.0, 0);
+
+    const auto scale = std::min(r.width() / sz.width(), r.height() / sz.height());
+    return QTransform::fromTranslate((r.width() - (sz.width() * scale)) / 2.0, 0).scale(scale, scale);
+}
+
 /// calculates the ratio of the test image to determine the proper height ratio for width
 /// @param[in] w the width of the widget
 /// @return the appropriate height
@@ -158,47 +232,77 @@ void UltrasoundImage::drawBackground(QPainter* painter, const QRectF& r)
     QGraphicsView::drawBackground(painter, r);
 }
 
-/// draws the target image
-/// @param[in] painter the drawing context
-void UltrasoundImage::drawForeground(QPainter* painter, const QRectF& r)
+/// renders the depth, roi and gate annotations into a transparent layer the size of the view
+void UltrasoundImage::renderAnnotations()
 {
-    if (!image_.isNull())
+    const auto dpr = devicePixelRatioF();
+    const auto sz = sceneRect().size().toSize();
+    if (annotations_.size() != sz * dpr)
     {
-        painter->drawImage(r, image_);
-        if (depth_)
-        {
-            painter->setPen(Qt::yellow);
-            painter->drawText(rect(), Qt::AlignRight | Qt::AlignBottom,
-                QStringLiteral("%1 cm").arg(QString::number(depth_, 'f', 1)));
-        }
-        if (activeRoi_.size())
-        {
-            painter->setPen(Qt::darkBlue);
-            painter->drawPolygon(activeRoi_);
-        }
-        if (modeRoi_.size())
-        {
-            painter->setPen(Qt::yellow);
-            painter->drawPolygon(modeRoi_);
-        }
-        if (gate_.size())
+        annotations_ = QPixmap(sz * dpr);
+        annotations_.setDevicePixelRatio(dpr);
+    }
+    annotations_.fill(Qt::transparent);
+    annotated_ = true;
+
+    QPainter painter(&annotations_);
+    if (depth_)
+    {
+        painter.setPen(Qt::yellow);
+        painter.drawText(QRect(QPoint(0, 0), sz), Qt::AlignRight | Qt::AlignBottom,
+            QStringLiteral("%1 cm").arg(QString::number(depth_, 'f', 1)));
+    }
+
+    // the regions are in the coordinates of the output size they were retrieved for
+    painter.setTransform(fit(overlaySize_));
+    if (activeRoi_.size())
+    {
+        painter.setPen(Qt::darkBlue);
+        painter.drawPolygon(activeRoi_);
+    }
+    if (modeRoi_.size())
+    {
+        painter.setPen(Qt::yellow);
+        painter.drawPolygon(modeRoi_);
+    }
+    if (gate_.size())
+    {
+        bool active = true;
+        for (const auto& l : gate_)
         {
-            bool active = true;
-            for (const auto& l : gate_)
+            if (active)
             {
-                if (active)
-                {
-                    painter->setPen(QPen(Qt::yellow, 1, Qt::DotLine));
-                    active = false;
-                }
-                else
-                    painter->setPen(QPen(Qt::yellow, 1, Qt::DashLine));
-                painter->drawLine(l);
+                painter.setPen(QPen(Qt::yellow, 1, Qt::DotLine));
+                active = false;
             }
+            else
+                painter.setPen(QPen(Qt::yellow, 1, Qt::DashLine));
+            painter.drawLine(l);
         }
     }
 }
 
+/// draws the target image and the annotation layer over the exposed area
+/// @param[in] painter the drawing context
+/// @param[in] r the exposed area
+void UltrasoundImage::drawForeground(QPainter* painter, const QRectF& r)
+{
+    if (image_)
+    {
+        auto t = fit(image_->size());
+        painter->save();
+        painter->setRenderHint(QPainter::SmoothPixmapTransform, !t.isIdentity());
+        painter->setTransform(t, true);
+        painter->drawImage(QPointF(0, 0), *image_);
+        painter->restore();
+    }
+
+    if (!annotated_)
+        renderAnnotations();
+    const auto dpr = annotations_.devicePixelRatio();
+    painter->drawPixmap(r, annotations_, QRectF(r.topLeft() * dpr, r.size() * dpr));
+}
+
 /// called on a mouse button release event
 /// @param[in] e the mouse event
 void UltrasoundImage::mouseReleaseEvent(QMouseEvent* e)
@@ -207,7 +311,8 @@ void UltrasoundImage::mouseReleaseEvent(QMouseEvent* e)
         return;
 
     // if the call to move succeeds, it means an imaging mode supporting an roi is running
-    auto pos = e->position();
+    // the probe takes positions in the coordinates of the output size
+    auto pos = fit(output_).inverted().map(e->position());
     auto m = solumGetMode();
     if (m == ColorMode || m == PowerMode || m == Strain || m == RfMode)
     {
@@ -225,7 +330,7 @@ void UltrasoundImage::mouseReleaseEvent(QMouseEvent* e)
 
 /// default constructor
 /// @param[in] parent the parent object
-Spectrum::Spectrum(QWidget* parent) : QGraphicsView(parent)
+Spectrum::Spectrum(QWidget* parent) : QGraphicsView(parent), cursor_(0)
 {
     QGraphicsScene* sc = new QGraphicsScene(this);
     setScene(sc);
@@ -243,7 +348,7 @@ Spectrum::Spectrum(QWidget* parent) : QGraphicsView(parent)
 void Spectrum::reset()
 {
     spectrum_.fill(Qt::black);
-    offset_ = 0;
+    cursor_ = 0;
     scene()->invalidate();
 }
 
@@ -252,24 +357,34 @@ void Spectrum::reset()
 /// @param[in] l # of spectrum lines
 /// @param[in] s # of spectrum samples
 /// @param[in] bps bits per sample
+/// @note the buffer is a ring of columns already in display orientation, each line is written at the cursor
 void Spectrum::loadImage(const void* img, int l, int s, int bps)
 {
     auto w = width();
-    // recreate the image if the dimensions change
-    if (s != spectrum_.width() || w != spectrum_.height())
+    if (!img || l <= 0 || s <= 0 || bps != 8 || w <= 0)
+        return;
+
+    // recreate the ring if the dimensions change
+    if (s != spectrum_.height() || w != spectrum_.width())
     {
-        spectrum_ = QImage(s, w, QImage::Format_Grayscale8);
+        spectrum_ = QImage(w, s, QImage::Format_Grayscale8);
         spectrum_.fill(Qt::black);
-        offset_ = 0;
+        cursor_ = 0;
     }
 
-    int sz = std::min(w * s, (l * s * (bps / 8)));
-    // ensure we don't go beyond the buffer space
-    if (offset_ + sz > w * s)
-        offset_ = 0;
-
-    std::memcpy(spectrum_.bits() + offset_, img, sz);
-    offset_ += sz;
+    const auto stride = spectrum_.bytesPerLine();
+    const uchar* src = static_cast<const uchar*>(img);
+    uchar* dst = spectrum_.bits();
+    // a block wider than the view only needs its most recent lines
+    auto skip = std::max(0, l - w);
+    src += skip * s;
+    for (auto i = skip; i < l; i++)
+    {
+        uchar* col = dst + cursor_;
+        for (auto j = 0; j < s; j++)
+            col[j * stride] = *src++;
+        cursor_ = (cursor_ + 1) % w;
+    }
 
     // redraw
     scene()->invalidate();
@@ -320,15 +435,19 @@ void Spectrum::drawForeground(QPainter* painter, const QRectF& r)
 {
     if (!spectrum_.isNull())
     {
-        auto mirrored = spectrum_.mirrored(true, false);
-        auto rotated = mirrored.transformed(QTransform().rotate(-90));
-        painter->drawImage(r, rotated);
+        // oldest columns (right of the cursor) go on the left so the sweep scrolls without copying
+        const int w = spectrum_.width(), h = spectrum_.height();
+        const qreal sx = r.width() / w;
+        const qreal split = (w - cursor_) * sx;
+        painter->drawImage(QRectF(r.x(), r.y(), split, r.height()), spectrum_, QRectF(cursor_, 0, w - cursor_, h));
+        if (cursor_)
+            painter->drawImage(QRectF(r.x() + split, r.y(), r.width() - split, r.height()), spectrum_, QRectF(0, 0, cursor_, h));
     }
 }
 
 /// default constructor
 /// @param[in] parent the parent object
-RfSignal::RfSignal(QWidget* parent) : QGraphicsView(parent), zoom_(0.1)
+RfSignal::RfSignal(QWidget* parent) : QGraphicsView(parent), columns_(0), traces_(0), first_(-1), count_(1), zoom_(0.1)
 {
     QGraphicsScene* sc = new QGraphicsScene(this);
     setScene(sc);
@@ -341,7 +460,7 @@ RfSignal::RfSignal(QWidget* parent) : QGraphicsView(parent), zoom_(0.1)
     setSizePolicy(p);
 }
 
-/// loads new rf signal
+/// loads new rf signal, decimating each displayed line to a min/max pair per pixel column
 /// @param[in] rf the new rf data
 /// @param[in] l # of rf lines
 /// @param[in] s # of samples per line
@@ -351,11 +470,29 @@ void RfSignal::loadSignal(const void* rf, int l, int s, int ss)
     if (!rf || !l || !s || ss != 2)
         return;
 
-    // pick the center line to display
-    signal_.clear();
-    const int16_t* buf = static_cast<const int16_t*>(rf) + ((l / 2) * s);
-    for (auto i = 0; i < s; i++)
-        signal_.push_back(*buf++);
+    // pick the lines to display, centered by default
+    auto count = std::clamp(count_, 1, l);
+    auto first = (first_ < 0) ? ((l - count) / 2) : std::min(first_, l - count);
+    auto cols = std::max(1, width());
+
+    // the buffer only grows when the view or the line selection does
+    envelope_.resize(static_cast<size_t>(count) * static_cast<size_t>(cols) * 2);
+    columns_ = cols;
+    traces_ = count;
+
+    const int16_t* buf = static_cast<const int16_t*>(rf);
+    int16_t* out = envelope_.data();
+    for (auto t = 0; t < count; t++)
+    {
+        const int16_t* line = buf + (static_cast<size_t>(first + t) * static_cast<size_t>(s));
+        for (auto c = 0; c < cols; c++)
+        {
+            auto begin = static_cast<int>((static_cast<int64_t>(c) * s) / cols);
+            auto end = std::max(begin + 1, static_cast<int>((static_cast<int64_t>(c + 1) * s) / cols));
+            minMax(line + begin, std::min(end, s) - begin, out[0], out[1]);
+            out += 2;
+        }
+    }
 
     // redraw
     scene()->invalidate();
@@ -368,6 +505,15 @@ void RfSignal::setZoom(int zoom)
     zoom_ = (static_cast<qreal>(zoom) / 100.0);
 }
 
+/// sets the range of lines overlaid on the display
+/// @param[in] first the first line to display, -1 to center the range within the frame
+/// @param[in] count the # of lines to overlay
+void RfSignal::setLines(int first, int count)
+{
+    first_ = first;
+    count_ = std::max(1, count);
+}
+
 /// handles resizing of the image view
 /// @param[in] e the event to parse
 void RfSignal::resizeEvent(QResizeEvent* e)
@@ -409,26 +555,35 @@ void RfSignal::drawBackground(QPainter* painter, const QRectF& r)
 /// @param[in] r the view rectangle
 void RfSignal::drawForeground(QPainter* painter, const QRectF& r)
 {
-    if (!signal_.isEmpty())
+    if (!traces_ || !columns_)
+        return;
+
+    const qreal baseline = r.height() / 2;
+    const qreal step = r.width() / columns_;
+    trace_.resize(columns_ * 2);
+    const int16_t* env = envelope_.data();
+    for (auto t = 0; t < traces_; t++)
     {
-        painter->setPen(QColor(96, 96, 0));
-        qreal x = 0, baseline = r.height() / 2;
-        double sampleSize = static_cast<double>(r.width()) / static_cast<double>(signal_.size());
-        QPointF p(x, baseline);
-        for (auto s : signal_)
+        // zig-zag between the min and max of each column so a single polyline covers the whole envelope
+        qreal x = r.x();
+        for (auto c = 0; c < columns_; c++)
         {
-            qreal y = s * zoom_;
-            QPointF pt(x + sampleSize, baseline + y);
-            painter->drawLine(p, pt);
-            p = pt;
-            x = x + sampleSize;
+            trace_[c * 2] = QPointF(x, baseline + (env[0] * zoom_));
+            trace_[(c * 2) + 1] = QPointF(x, baseline + (env[1] * zoom_));
+            env += 2;
+            x += step;
         }
+
+        // fade the overlaid lines so the center line stands out
+        auto alpha = (traces_ == 1) ? 255 : std::max(64, 255 - (std::abs(t - (traces_ / 2)) * 192) / std::max(1, traces_ / 2));
+        painter->setPen(QColor(96, 96, 0, alpha));
+        painter->drawPolyline(trace_);
     }
 }
 
 /// default constructor
 /// @param[in] parent the parent object
-Prescan::Prescan(QWidget* parent) : QGraphicsView(parent)
+Prescan::Prescan(QWidget* parent) : QGraphicsView(parent), image_(nullptr)
 {
     QGraphicsScene* sc = new QGraphicsScene(this);
     setScene(sc);
@@ -436,31 +591,17 @@ Prescan::Prescan(QWidget* parent) : QGraphicsView(parent)
 
     // initialize to some arbitrary size
     setSceneRect(0, 0, 400, 100);
-    image_ = QImage(400, 100, QImage::Format_ARGB32);
 
     QSizePolicy p(QSizePolicy::Preferred, QSizePolicy::Preferred);
     p.setHeightForWidth(true);
     setSizePolicy(p);
 }
 
-/// loads a new image from raw data
-/// @param[in] img the new prescan data
-/// @param[in] w width of image (aka # of spectrum lines)
-/// @param[in] h height of image (aka # of spectrum samples)
-/// @param[in] bpp bits per pixel (aka bits per sample)
-void Prescan::loadImage(const void* img, int w, int h, int bpp, CusImageFormat format, int sz)
-{
-    // check for size match
-    if (image_.width() != h || image_.height() != w)
-    {
-        image_ = QImage(h, w, QImage::Format_Grayscale8);
-        image_.fill(Qt::black);
-    }
-
-    if (format == Jpeg)
-        image_.loadFromData(static_cast<const uchar*>(img), sz, "JPG");
-    else
-        std::memcpy(image_.bits(), img, w * h * (bpp / 8));
+/// sets a new decoded image to draw, each line of the prescan data is a row of the image
+/// @param[in] img the image, has to stay valid until replaced, typically the front image of the image pipeline
+void Prescan::setImage(const QImage* img)
+{
+    image_ = img;
 
     // redraw
     scene()->invalidate();
@@ -473,7 +614,6 @@ void Prescan::resizeEvent(QResizeEvent* e)
     auto w = e->size().width(), h = e->size().height();
 
     setSceneRect(0, 0, w, h);
-    image_.fill(Qt::black);
 
     QGraphicsView::resizeEvent(e);
 }
@@ -509,8 +649,6 @@ void Prescan::drawBackground(QPainter* painter, const QRectF& r)
 /// @param[in] painter the drawing context
 void Prescan::drawForeground(QPainter* painter, const QRectF& r)
 {
-    if (!image_.isNull())
-    {
-        painter->drawImage(r, image_);
-    }
+    if (image_)
+        painter->drawImage(r, *image_);
 }
@@ -9,11 +9,12 @@ class UltrasoundImage : public QGraphicsView
 public:
     explicit UltrasoundImage(bool overlay, QWidget*);
 
-    void loadImage(const void* img, int w, int h, int bpp, CusImageFormat format, int sz);
-    void setDepth(double d) { depth_ = d; }
+    void setImage(const QImage* img);
+    void setDepth(double d);
     void checkActiveRegion();
     void checkRoi();
     void checkGate();
+    QSize outputSize() const { return output_; }
 
 protected:
     virtual void drawForeground(QPainter*, const QRectF&) override;
@@ -24,13 +25,25 @@ protected:
     virtual int heightForWidth(int w) const override;
     virtual QSize sizeHint() const override;
 
+private:
+    QTransform fit(const QSize& sz) const;
+    void commitOutputSize();
+    void invalidateAnnotations();
+    void renderAnnotations();
+
 private:
     double depth_;          ///< depth display value
     bool overlay_;          ///< flag if this is an overlay display
     QPolygonF activeRoi_;   ///< active region for grayscale imaging
     QPolygonF modeRoi_;     ///< region of interest for doppler or elastography modes
     QVector<QLineF> gate_;  ///< gate lines to draw
-    QImage image_;          ///< the image buffer
+    QSize overlaySize_;     ///< output size the roi and gate lines were retrieved for
+    QSize output_;          ///< output size last requested from the probe, quantized from the view size
+    QTimer settle_;         ///< delays output size requests until a resize settles
+    const QImage* image_;   ///< the image to draw, owned by the image pipeline
+    QRectF imageRect_;      ///< view area covered by the last image drawn
+    QPixmap annotations_;   ///< pre-rendered depth, roi and gate layer
+    bool annotated_;        ///< set while the annotation layer is up to date
 };
 
 /// spectrum display
@@ -52,8 +65,8 @@ protected:
     virtual QSize sizeHint() const override;
 
 private:
-    QImage spectrum_;   ///< the spectrum buffer
-    int offset_;        ///< offset for pushing into buffer
+    QImage spectrum_;   ///< ring of spectral lines stored as columns in display orientation
+    int cursor_;        ///< column the next line is written to
 };
 
 /// rf signal display
@@ -65,6 +78,7 @@ public:
 
     void loadSignal(const void* rf, int l, int s, int ss);
     void setZoom(int zoom);
+    void setLines(int first, int count);
 
 protected:
     virtual void drawForeground(QPainter*, const QRectF&) override;
@@ -75,8 +89,13 @@ protected:
     virtual QSize sizeHint() const override;
 
 private:
-    QVector<int16_t> signal_;   ///< the rf signal
-    qreal zoom_;                ///< zoom level
+    std::vector<int16_t> envelope_; ///< min/max pairs per column for each displayed line
+    QPolygonF trace_;               ///< reusable polyline for drawing a single line
+    int columns_;                   ///< # of columns the envelope was decimated to
+    int traces_;                    ///< # of lines held in the envelope
+    int first_;                     ///< first line to display, -1 to center the range
+    int count_;                     ///< # of lines to overlay
+    qreal zoom_;                    ///< zoom level
 };
 
 /// spectrum display
@@ -86,7 +105,7 @@ class Prescan : public QGraphicsView
 public:
     explicit Prescan(QWidget*);
 
-    void loadImage(const void* img, int w, int h, int bpp, CusImageFormat format, int sz);
+    void setImage(const QImage* img);
 
 protected:
     virtual void drawForeground(QPainter*, const QRectF&) override;
@@ -97,5 +116,5 @@ protected:
     virtual QSize sizeHint() const override;
 
 private:
-    QImage image_;  ///< the spectrum buffer
+    const QImage* image_;   ///< the image to draw, owned by the image pipeline
 };
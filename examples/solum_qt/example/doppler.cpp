@@ -0,0 +1,206 @@
+#include "doppler.h"
+#include <solum/solum.h>
+#include <algorithm>
+#include <cmath>
+
+#define PI              3.14159265358979323846
+#define ROI_POINTS      32
+#define POWER_FLOOR     1e-6f
+
+/// default constructor
+/// @param[in] threads # of threads to estimate with, 0 to use the hardware concurrency
+ColorEstimator::ColorEstimator(int threads) : workers_(threads), lines_(0), samples_(0)
+{
+    params_.prf = 4000.0;
+    params_.frequency = 5e6;
+    params_.soundSpeed = 1540.0;
+    params_.wallOrder = 1;
+    params_.powerThreshold = 20.0;
+    params_.varianceThreshold = 0.8;
+    std::fill(std::begin(roi_), std::end(roi_), 0.0);
+}
+
+/// updates the prf from the current color/power doppler setting on the probe
+/// @return success of the call
+bool ColorEstimator::fetchPrf()
+{
+    auto prf = solumGetParam(ColorPrf);
+    if (prf <= 0)
+        return false;
+
+    params_.prf = prf * 1000.0;
+    return true;
+}
+
+/// updates the bounding box of the current color roi
+/// @return success of the call
+bool ColorEstimator::fetchRoi()
+{
+    double buf[ROI_POINTS * 2];
+    if (solumGetRoi(buf, ROI_POINTS) != 0)
+        return false;
+
+    double x0 = buf[0], x1 = buf[0], y0 = buf[1], y1 = buf[1];
+    for (auto i = 1; i < ROI_POINTS; i++)
+    {
+        x0 = std::min(x0, buf[i * 2]);
+        x1 = std::max(x1, buf[i * 2]);
+        y0 = std::min(y0, buf[(i * 2) + 1]);
+        y1 = std::max(y1, buf[(i * 2) + 1]);
+    }
+    roi_[0] = x0;
+    roi_[1] = y0;
+    roi_[2] = x1 - x0;
+    roi_[3] = y1 - y0;
+    return true;
+}
+
+/// retrieves the nyquist velocity for the current parameters
+/// @return the aliasing velocity in m/s
+double ColorEstimator::nyquist() const
+{
+    return (params_.frequency > 0) ? (params_.soundSpeed * params_.prf) / (4.0 * params_.frequency) : 0.0;
+}
+
+/// runs the estimator on a new ensemble
+/// @param[in] iq the interleaved i/q samples in [ensemble][line][sample] order
+/// @param[in] lines # of lines in the roi
+/// @param[in] samples # of samples per line
+/// @param[in] ensemble # of acquisitions per line (packet size)
+/// @return success of the call
+bool ColorEstimator::process(const int16_t* iq, int lines, int samples, int ensemble)
+{
+    if (!iq || lines <= 0 || samples <= 0 || ensemble < 2)
+        return false;
+
+    const auto sz = static_cast<size_t>(lines) * static_cast<size_t>(samples);
+    // maps only reallocate when the roi grows
+    velocity_.resize(sz);
+    power_.resize(sz);
+    variance_.resize(sz);
+    lines_ = lines;
+    samples_ = samples;
+
+    workers_.run(lines, [this, iq, ensemble](int begin, int end)
+    {
+        for (auto l = begin; l < end; l++)
+            estimateLine(iq, l, ensemble);
+    });
+
+    return true;
+}
+
+/// estimates a single line, the loops over samples are kept branch free so they vectorize
+/// @param[in] iq the ensemble data
+/// @param[in] line the line to estimate
+/// @param[in] ensemble # of acquisitions per line
+void ColorEstimator::estimateLine(const int16_t* iq, int line, int ensemble)
+{
+    const int s = samples_;
+    const auto stride = static_cast<size_t>(lines_) * static_cast<size_t>(s) * 2;
+    const int16_t* base = iq + (static_cast<size_t>(line) * static_cast<size_t>(s) * 2);
+
+    // scratch grows once per thread and is then reused for every line
+    thread_local std::vector<float> scratch;
+    scratch.resize(static_cast<size_t>(s) * 9);
+    float* mi = scratch.data();
+    float* mq = mi + s;
+    float* ti = mq + s;
+    float* tq = ti + s;
+    float* pi = tq + s;
+    float* pq = pi + s;
+    float* r0 = pq + s;
+    float* r1re = r0 + s;
+    float* r1im = r1re + s;
+    std::fill(scratch.begin(), scratch.end(), 0.0f);
+
+    // regression wall filter: project out the mean and linear trend across the ensemble
+    const float center = static_cast<float>(ensemble - 1) / 2.0f;
+    float norm = 0;
+    for (auto k = 0; k < ensemble; k++)
+        norm += (k - center) * (k - center);
+
+    for (auto k = 0; k < ensemble; k++)
+    {
+        const int16_t* p = base + (k * stride);
+        const float t = k - center;
+        for (auto i = 0; i < s; i++)
+        {
+            const float xi = p[i * 2], xq = p[(i * 2) + 1];
+            mi[i] += xi;
+            mq[i] += xq;
+            ti[i] += t * xi;
+            tq[i] += t * xq;
+        }
+    }
+
+    const float meanScale = (params_.wallOrder >= 0) ? (1.0f / static_cast<float>(ensemble)) : 0.0f;
+    const float trendScale = (params_.wallOrder >= 1 && norm > 0) ? (1.0f / norm) : 0.0f;
+    for (auto i = 0; i < s; i++)
+    {
+        mi[i] *= meanScale;
+        mq[i] *= meanScale;
+        ti[i] *= trendScale;
+        tq[i] *= trendScale;
+    }
+
+    // lag-0 and lag-1 autocorrelation of the filtered slow time signal
+    for (auto k = 0; k < ensemble; k++)
+    {
+        const int16_t* p = base + (k * stride);
+        const float t = k - center;
+        const float lag = (k > 0) ? 1.0f : 0.0f;
+        for (auto i = 0; i < s; i++)
+        {
+            const float xi = p[i * 2] - mi[i] - (t * ti[i]);
+            const float xq = p[(i * 2) + 1] - mq[i] - (t * tq[i]);
+            r0[i] += (xi * xi) + (xq * xq);
+            r1re[i] += lag * ((xi * pi[i]) + (xq * pq[i]));
+            r1im[i] += lag * ((xq * pi[i]) - (xi * pq[i]));
+            pi[i] = xi;
+            pq[i] = xq;
+        }
+    }
+
+    const float vscale = static_cast<float>(nyquist() / PI);
+    const float n0 = 1.0f / static_cast<float>(ensemble), n1 = 1.0f / static_cast<float>(ensemble - 1);
+    const float pthresh = static_cast<float>(params_.powerThreshold), vthresh = static_cast<float>(params_.varianceThreshold);
+    const size_t offset = static_cast<size_t>(line) * static_cast<size_t>(s);
+    float* vel = velocity_.data() + offset;
+    float* pwr = power_.data() + offset;
+    float* var = variance_.data() + offset;
+    for (auto i = 0; i < s; i++)
+    {
+        const float p0 = std::max(r0[i] * n0, POWER_FLOOR);
+        const float re = r1re[i] * n1, im = r1im[i] * n1;
+        const float db = 10.0f * std::log10(p0);
+        const float v = 1.0f - std::min(1.0f, std::sqrt((re * re) + (im * im)) / p0);
+        pwr[i] = db;
+        var[i] = v;
+        vel[i] = (db >= pthresh && v <= vthresh) ? (vscale * std::atan2(im, re)) : 0.0f;
+    }
+}
+
+/// renders the velocity map into a color overlay
+/// @param[out] argb the overlay buffer, must hold lines x samples pixels, stored with one row per sample so the lines run horizontally
+/// @param[in] invert flag to swap the map, by default red is towards the probe and blue is away
+void ColorEstimator::colorize(uint32_t* argb, bool invert) const
+{
+    const auto vn = static_cast<float>(nyquist());
+    if (!argb || vn <= 0)
+        return;
+
+    for (auto l = 0; l < lines_; l++)
+    {
+        const float* vel = velocity_.data() + (static_cast<size_t>(l) * static_cast<size_t>(samples_));
+        for (auto i = 0; i < samples_; i++)
+        {
+            const float v = invert ? -vel[i] : vel[i];
+            const auto c = static_cast<uint32_t>(std::min(255.0f, std::fabs(v) / vn * 255.0f));
+            uint32_t px = 0;
+            if (c)
+                px = 0xFF000000u | ((v > 0) ? (c << 16) : c);
+            argb[(static_cast<size_t>(i) * static_cast<size_t>(lines_)) + l] = px;
+        }
+    }
+}
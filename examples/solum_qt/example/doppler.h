@@ -0,0 +1,55 @@
+#pragma once
+
+#include "workers.h"
+#include <cstdint>
+#include <vector>
+
+/// color doppler estimation parameters
+struct DopplerParams
+{
+    double prf;                 ///< pulse repetition frequency in hz
+    double frequency;           ///< transmit center frequency in hz
+    double soundSpeed;          ///< speed of sound in m/s
+    int wallOrder;              ///< regression wall filter order: -1 = off, 0 = mean removal, 1 = mean and linear trend removal
+    double powerThreshold;      ///< power in db below which flow is blanked
+    double varianceThreshold;   ///< normalized variance above which flow is blanked
+};
+
+/// host side kasai (lag-1 autocorrelation) color doppler estimator
+///
+/// consumes iq ensembles covering the color roi, stored as interleaved 16 bit i/q samples in
+/// [ensemble][line][sample] order, and produces velocity, power and variance maps in [line][sample] order
+class ColorEstimator
+{
+public:
+    explicit ColorEstimator(int threads = 0);
+
+    void setParams(const DopplerParams& params) { params_ = params; }
+    const DopplerParams& params() const { return params_; }
+    bool fetchPrf();
+    bool fetchRoi();
+
+    bool process(const int16_t* iq, int lines, int samples, int ensemble);
+    void colorize(uint32_t* argb, bool invert) const;
+
+    int lines() const { return lines_; }
+    int samples() const { return samples_; }
+    double nyquist() const;
+    const double* roi() const { return roi_; }
+    const std::vector<float>& velocity() const { return velocity_; }
+    const std::vector<float>& power() const { return power_; }
+    const std::vector<float>& variance() const { return variance_; }
+
+private:
+    void estimateLine(const int16_t* iq, int line, int ensemble);
+
+private:
+    Workers workers_;               ///< threads used to split the lines
+    DopplerParams params_;          ///< estimation parameters
+    int lines_;                     ///< # of lines in the latest maps
+    int samples_;                   ///< # of samples per line in the latest maps
+    double roi_[4];                 ///< roi bounding box in output pixels (x, y, width, height)
+    std::vector<float> velocity_;   ///< axial velocity in m/s, positive towards the probe
+    std::vector<float> power_;      ///< power in db
+    std::vector<float> variance_;   ///< normalized variance (0 - 1)
+};
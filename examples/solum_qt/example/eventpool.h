@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+
+#define EVENT_POOL_SLOTS    64      // preallocated events per type, a single 64 bit mask tracks them
+#define EVENT_TEXT          256     // characters kept from messages posted from the api callbacks
+#define EVENT_SHORT_TEXT    64      // characters kept from short strings such as serials and ids
+
+namespace event
+{
+    /// storage pool for an event type, events derive from it to be allocated from preallocated slots
+    ///
+    /// qt deletes posted events once they're dispatched, which returns the slot to the pool, so posting from the sdk
+    /// threads and dispatching on the gui thread allocates nothing once the pool is created; slots are claimed and
+    /// released with a single atomic mask, so any thread can post, and the heap is only used once every slot is in
+    /// flight or for a derived type that doesn't fit a slot
+    template <typename T>
+    class Pooled
+    {
+    public:
+        /// allocates an event from the pool
+        /// @param[in] sz size of the event being allocated
+        /// @return the event storage
+        static void* operator new(size_t sz)
+        {
+            auto& p = pool();
+            if (sz <= sizeof(T))
+            {
+                auto used = p.used.load(std::memory_order_relaxed);
+                while (~used)
+                {
+                    int i = 0;
+                    while (used & (1ull << i))
+                        i++;
+                    if (p.used.compare_exchange_weak(used, used | (1ull << i), std::memory_order_acquire, std::memory_order_relaxed))
+                        return p.slots[i].data;
+                }
+            }
+            p.misses.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(sz);
+        }
+
+        /// returns an event to the pool
+        /// @param[in] ptr the event storage
+        static void operator delete(void* ptr)
+        {
+            if (!ptr)
+                return;
+            auto& p = pool();
+            const auto* first = p.slots[0].data;
+            const auto* last = p.slots[EVENT_POOL_SLOTS - 1].data;
+            const auto* q = static_cast<const unsigned char*>(ptr);
+            if (std::less_equal<const unsigned char*>()(first, q) && std::less_equal<const unsigned char*>()(q, last))
+            {
+                const auto i = static_cast<int>((q - first) / sizeof(Slot));
+                p.used.fetch_and(~(1ull << i), std::memory_order_release);
+            }
+            else
+                ::operator delete(ptr);
+        }
+
+        /// @return # of events of this type that had to be allocated from the heap
+        static uint64_t misses() { return pool().misses.load(std::memory_order_relaxed); }
+
+    private:
+        /// storage for a single event
+        struct Slot
+        {
+            alignas(T) unsigned char data[sizeof(T)];   ///< event storage
+        };
+
+        /// slots of the type and their usage
+        struct Pool
+        {
+            Slot slots[EVENT_POOL_SLOTS];       ///< event storage
+            std::atomic<uint64_t> used{ 0 };    ///< bit per slot in flight
+            std::atomic<uint64_t> misses{ 0 };  ///< # of heap allocations
+        };
+
+        /// @return the pool of the type, created on first use in static storage
+        static Pool& pool()
+        {
+            static Pool p;
+            return p;
+        }
+    };
+
+    /// copies a string into a fixed buffer of an event, truncating if needed
+    /// @param[out] dst the destination buffer
+    /// @param[in] src the source string, can be null
+    template <size_t N>
+    void copyText(char (&dst)[N], const char* src)
+    {
+        if (!src)
+        {
+            dst[0] = '\0';
+            return;
+        }
+        std::strncpy(dst, src, N - 1);
+        dst[N - 1] = '\0';
+    }
+}
@@ -0,0 +1,199 @@
+#include "filter.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define FILTER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define FILTER_NEON
+#endif
+
+/// default constructor
+TemporalFilter::TemporalFilter() : mode_(static_cast<int>(Mode::Off)), strength_(0), reset_(true), active_(Mode::Off),
+    alpha_(256), shift_(0), width_(0), height_(0), bpp_(0), slot_(0)
+{
+}
+
+/// sets the filter mode, takes effect with the next frame
+/// @param[in] mode the filter mode
+/// @param[in] strength the weight of the new frame (1-255 out of 256) for recursive, or the number of frames (2, 4 or 8) to average
+/// @note safe to call from any thread
+void TemporalFilter::configure(Mode mode, int strength)
+{
+    mode_ = static_cast<int>(mode);
+    strength_ = strength;
+    reset_ = true;
+}
+
+/// restarts the filter so that the next frame is output untouched
+/// @note safe to call from any thread, typically called on an imaging state change (depth, mode, application, etc.)
+void TemporalFilter::reset()
+{
+    reset_ = true;
+}
+
+/// filters a frame in place
+/// @param[in,out] img the uncompressed image data
+/// @param[in] nfo the image information
+/// @return true if the frame was filtered
+/// @note only uncompressed grayscale frames are filtered, overlays and compressed frames are ignored
+bool TemporalFilter::process(void* img, const CusProcessedImageInfo* nfo)
+{
+    if (!img || !nfo || nfo->overlay || (nfo->format != Uncompressed && nfo->format != Uncompressed8Bit))
+        return false;
+
+    auto mode = static_cast<Mode>(mode_.load());
+    if (mode == Mode::Off)
+    {
+        active_ = Mode::Off;
+        return false;
+    }
+
+    auto sz = static_cast<size_t>(nfo->width) * static_cast<size_t>(nfo->height) * static_cast<size_t>(nfo->bitsPerPixel / 8);
+    if (!sz || sz > static_cast<size_t>(nfo->imageSize))
+        return false;
+
+    auto buf = static_cast<uint8_t*>(img);
+    // restart on any configuration, imaging state or geometry change
+    if (reset_.exchange(false) || mode != active_ || nfo->width != width_ || nfo->height != height_ || nfo->bitsPerPixel != bpp_)
+    {
+        active_ = mode;
+        width_ = nfo->width;
+        height_ = nfo->height;
+        bpp_ = nfo->bitsPerPixel;
+        auto strength = strength_.load();
+        alpha_ = std::clamp(strength, 1, 255);
+        shift_ = (strength >= 8) ? 3 : ((strength >= 4) ? 2 : 1);
+        prime(buf, sz);
+        return true;
+    }
+
+    if (active_ == Mode::Recursive)
+        recursive(buf, sz);
+    else
+        average(buf, sz);
+
+    return true;
+}
+
+/// seeds the state buffers with the first frame, buffers only grow when the frame size does
+/// @param[in] img the first frame
+/// @param[in] sz size of the frame in bytes
+void TemporalFilter::prime(const uint8_t* img, size_t sz)
+{
+    if (active_ == Mode::Recursive)
+    {
+        state_.resize(sz);
+        std::memcpy(state_.data(), img, sz);
+    }
+    else
+    {
+        const size_t frames = static_cast<size_t>(1) << shift_;
+        state_.resize(sz * frames);
+        sum_.resize(sz);
+        for (size_t f = 0; f < frames; f++)
+            std::memcpy(state_.data() + (f * sz), img, sz);
+        for (size_t i = 0; i < sz; i++)
+            sum_[i] = static_cast<uint16_t>(img[i] << shift_);
+        slot_ = 0;
+    }
+}
+
+/// applies the recursive filter, the state holds the previous output
+/// @param[in,out] img the frame to filter
+/// @param[in] sz size of the frame in bytes
+void TemporalFilter::recursive(uint8_t* img, size_t sz)
+{
+    uint8_t* prev = state_.data();
+    const int a = alpha_, b = 256 - alpha_;
+    size_t i = 0;
+#if defined(FILTER_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i va = _mm_set1_epi16(static_cast<short>(a));
+    const __m128i vb = _mm_set1_epi16(static_cast<short>(b));
+    const __m128i round = _mm_set1_epi16(128);
+    for (; i + 16 <= sz; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(img + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+        // weights sum to 256 so the 16 bit products cannot overflow
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), va), _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), vb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), va), _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), vb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+        __m128i out = _mm_packus_epi16(lo, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(img + i), out);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(prev + i), out);
+    }
+#elif defined(FILTER_NEON)
+    const uint8x8_t va = vdup_n_u8(static_cast<uint8_t>(a));
+    const uint8x8_t vb = vdup_n_u8(static_cast<uint8_t>(b));
+    for (; i + 16 <= sz; i += 16)
+    {
+        uint8x16_t x = vld1q_u8(img + i);
+        uint8x16_t s = vld1q_u8(prev + i);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(x), va), vget_low_u8(s), vb);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(x), va), vget_high_u8(s), vb);
+        uint8x16_t out = vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8));
+        vst1q_u8(img + i, out);
+        vst1q_u8(prev + i, out);
+    }
+#endif
+    for (; i < sz; i++)
+    {
+        auto out = static_cast<uint8_t>((img[i] * a + prev[i] * b + 128) >> 8);
+        img[i] = out;
+        prev[i] = out;
+    }
+}
+
+/// applies the box average, the oldest frame in the history is replaced by the new one
+/// @param[in,out] img the frame to filter
+/// @param[in] sz size of the frame in bytes
+void TemporalFilter::average(uint8_t* img, size_t sz)
+{
+    uint8_t* old = state_.data() + (slot_ * sz);
+    uint16_t* sum = sum_.data();
+    const int shift = shift_;
+    size_t i = 0;
+#if defined(FILTER_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    for (; i + 16 <= sz; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(img + i));
+        __m128i o = _mm_loadu_si128(reinterpret_cast<const __m128i*>(old + i));
+        __m128i slo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i));
+        __m128i shi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i + 8));
+        slo = _mm_add_epi16(_mm_sub_epi16(slo, _mm_unpacklo_epi8(o, zero)), _mm_unpacklo_epi8(x, zero));
+        shi = _mm_add_epi16(_mm_sub_epi16(shi, _mm_unpackhi_epi8(o, zero)), _mm_unpackhi_epi8(x, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i), slo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i + 8), shi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(old + i), x);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(img + i), _mm_packus_epi16(_mm_srl_epi16(slo, count), _mm_srl_epi16(shi, count)));
+    }
+#elif defined(FILTER_NEON)
+    const int16x8_t count = vdupq_n_s16(static_cast<int16_t>(-shift));
+    for (; i + 16 <= sz; i += 16)
+    {
+        uint8x16_t x = vld1q_u8(img + i);
+        uint8x16_t o = vld1q_u8(old + i);
+        uint16x8_t slo = vsubw_u8(vaddw_u8(vld1q_u16(sum + i), vget_low_u8(x)), vget_low_u8(o));
+        uint16x8_t shi = vsubw_u8(vaddw_u8(vld1q_u16(sum + i + 8), vget_high_u8(x)), vget_high_u8(o));
+        vst1q_u16(sum + i, slo);
+        vst1q_u16(sum + i + 8, shi);
+        vst1q_u8(old + i, x);
+        vst1q_u8(img + i, vcombine_u8(vmovn_u16(vshlq_u16(slo, count)), vmovn_u16(vshlq_u16(shi, count))));
+    }
+#endif
+    for (; i < sz; i++)
+    {
+        sum[i] = static_cast<uint16_t>(sum[i] - old[i] + img[i]);
+        old[i] = img[i];
+        img[i] = static_cast<uint8_t>(sum[i] >> shift);
+    }
+
+    slot_ = (slot_ + 1) % (static_cast<size_t>(1) << shift_);
+}
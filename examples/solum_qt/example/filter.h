@@ -0,0 +1,47 @@
+#pragma once
+
+#include <solum/solum_def.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// temporal persistence filter applied in place to uncompressed processed frames
+class TemporalFilter
+{
+public:
+    /// filter modes
+    enum class Mode
+    {
+        Off,        ///< frames pass through untouched
+        Recursive,  ///< first order iir, out = alpha * in + (1 - alpha) * previous
+        Average,    ///< box average of the last n frames
+    };
+
+    static constexpr int MaxFrames = 8;     ///< maximum frames for the box average
+
+    TemporalFilter();
+
+    void configure(Mode mode, int strength);
+    void reset();
+    bool process(void* img, const CusProcessedImageInfo* nfo);
+
+private:
+    void prime(const uint8_t* img, size_t sz);
+    void recursive(uint8_t* img, size_t sz);
+    void average(uint8_t* img, size_t sz);
+
+private:
+    std::atomic<int> mode_;         ///< requested mode, applied on the next frame
+    std::atomic<int> strength_;     ///< requested alpha (1-255) or frame count (2, 4, 8)
+    std::atomic_bool reset_;        ///< flag to restart the filter on the next frame
+    Mode active_;                   ///< mode the state buffers were primed for
+    int alpha_;                     ///< recursive weight of the new frame, out of 256
+    int shift_;                     ///< log2 of the number of frames averaged
+    int width_;                     ///< width the state buffers were primed for
+    int height_;                    ///< height the state buffers were primed for
+    int bpp_;                       ///< bits per pixel the state buffers were primed for
+    size_t slot_;                   ///< oldest history slot for the box average
+    std::vector<uint8_t> state_;    ///< previous output for recursive, frame history for average
+    std::vector<uint16_t> sum_;     ///< running sum for the box average
+};
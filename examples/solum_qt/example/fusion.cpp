@@ -0,0 +1,294 @@
+#include "fusion.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define FUSION_SSE2
+#endif
+
+#define NORM_MIN    1e-12f  // squared norm below which a sensor reading is taken as missing
+
+namespace
+{
+    /// single channel, used for the channels left over after the vectors
+    struct Single
+    {
+        float v;    ///< value
+
+        Single(float x) : v(x) {}
+        static Single load(const float* p) { return *p; }
+        void store(float* p) const { *p = v; }
+        static Single sqrt(Single a) { return std::sqrt(a.v); }
+        /// inverse square root, 0 for a missing reading
+        static Single rsqrt(Single a) { return (a.v > NORM_MIN) ? (1.0f / std::sqrt(a.v)) : 0.0f; }
+        /// 1 for a valid reading, 0 for a missing one
+        static Single valid(Single a) { return (a.v > NORM_MIN) ? 1.0f : 0.0f; }
+    };
+
+    inline Single operator+(Single a, Single b) { return a.v + b.v; }
+    inline Single operator-(Single a, Single b) { return a.v - b.v; }
+    inline Single operator*(Single a, Single b) { return a.v * b.v; }
+    inline Single operator-(Single a) { return -a.v; }
+
+#if defined(FUSION_SSE2)
+    /// 4 channels processed together
+    struct Lanes
+    {
+        __m128 v;   ///< values
+
+        Lanes(__m128 x) : v(x) {}
+        Lanes(float x) : v(_mm_set1_ps(x)) {}
+        static Lanes load(const float* p) { return _mm_loadu_ps(p); }
+        void store(float* p) const { _mm_storeu_ps(p, v); }
+        static Lanes sqrt(Lanes a) { return _mm_sqrt_ps(a.v); }
+        static Lanes rsqrt(Lanes a)
+        {
+            const __m128 ok = _mm_cmpgt_ps(a.v, _mm_set1_ps(NORM_MIN));
+            return _mm_and_ps(ok, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(a.v, _mm_set1_ps(NORM_MIN)))));
+        }
+        static Lanes valid(Lanes a) { return _mm_and_ps(_mm_cmpgt_ps(a.v, _mm_set1_ps(NORM_MIN)), _mm_set1_ps(1.0f)); }
+    };
+
+    inline Lanes operator+(Lanes a, Lanes b) { return _mm_add_ps(a.v, b.v); }
+    inline Lanes operator-(Lanes a, Lanes b) { return _mm_sub_ps(a.v, b.v); }
+    inline Lanes operator*(Lanes a, Lanes b) { return _mm_mul_ps(a.v, b.v); }
+    inline Lanes operator-(Lanes a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+#endif
+
+    /// runs one madgwick marg step on a group of channels
+    /// @param[in,out] s the state arrays in field order, offset to the first channel of the group
+    /// @param[in] stride distance between fields
+    /// @param[in] beta gradient descent gain
+    /// @note a missing magnetometer zeroes its terms, which leaves the accelerometer only gradient, and a missing accelerometer
+    /// skips the correction, leaving pure gyroscope integration
+    template <typename T> void madgwick(float* s, int stride, float beta)
+    {
+        auto at = [s, stride](int f) { return s + (f * stride); };
+        T q0 = T::load(at(0)), q1 = T::load(at(1)), q2 = T::load(at(2)), q3 = T::load(at(3));
+        const T gx = T::load(at(4)), gy = T::load(at(5)), gz = T::load(at(6));
+        T ax = T::load(at(7)), ay = T::load(at(8)), az = T::load(at(9));
+        T mx = T::load(at(10)), my = T::load(at(11)), mz = T::load(at(12));
+        const T dt = T::load(at(13));
+        const T half(0.5f), two(2.0f), four(4.0f), one(1.0f);
+
+        // rate of change of the orientation from the gyroscope
+        T qd0 = half * (-(q1 * gx) - (q2 * gy) - (q3 * gz));
+        T qd1 = half * ((q0 * gx) + (q2 * gz) - (q3 * gy));
+        T qd2 = half * ((q0 * gy) - (q1 * gz) + (q3 * gx));
+        T qd3 = half * ((q0 * gz) + (q1 * gy) - (q2 * gx));
+
+        const T a2 = (ax * ax) + (ay * ay) + (az * az), m2 = (mx * mx) + (my * my) + (mz * mz);
+        const T on = T::valid(a2);
+        const T ra = T::rsqrt(a2), rm = T::rsqrt(m2);
+        ax = ax * ra; ay = ay * ra; az = az * ra;
+        mx = mx * rm; my = my * rm; mz = mz * rm;
+
+        const T q0mx2 = two * q0 * mx, q0my2 = two * q0 * my, q0mz2 = two * q0 * mz, q1mx2 = two * q1 * mx;
+        const T q02 = two * q0, q12 = two * q1, q22 = two * q2, q32 = two * q3;
+        const T q0q22 = two * q0 * q2, q2q32 = two * q2 * q3;
+        const T q0q0 = q0 * q0, q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3, q1q1 = q1 * q1;
+        const T q1q2 = q1 * q2, q1q3 = q1 * q3, q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+
+        // reference direction of the earth's magnetic field
+        const T hx = (mx * q0q0) - (q0my2 * q3) + (q0mz2 * q2) + (mx * q1q1) + (q12 * my * q2) + (q12 * mz * q3) - (mx * q2q2) - (mx * q3q3);
+        const T hy = (q0mx2 * q3) + (my * q0q0) - (q0mz2 * q1) + (q1mx2 * q2) - (my * q1q1) + (my * q2q2) + (q22 * mz * q3) - (my * q3q3);
+        const T bx2 = T::sqrt((hx * hx) + (hy * hy));
+        const T bz2 = -(q0mx2 * q2) + (q0my2 * q1) + (mz * q0q0) + (q1mx2 * q3) - (mz * q1q1) + (q22 * my * q3) - (mz * q2q2) + (mz * q3q3);
+        const T bx4 = two * bx2, bz4 = two * bz2;
+
+        // gradient descent corrective step
+        const T fa = (two * q1q3) - q0q22 - ax, fb = (two * q0q1) + q2q32 - ay, fc = one - (two * q1q1) - (two * q2q2) - az;
+        const T fx = (bx2 * (half - q2q2 - q3q3)) + (bz2 * (q1q3 - q0q2)) - mx;
+        const T fy = (bx2 * (q1q2 - q0q3)) + (bz2 * (q0q1 + q2q3)) - my;
+        const T fz = (bx2 * (q0q2 + q1q3)) + (bz2 * (half - q1q1 - q2q2)) - mz;
+        T s0 = -(q22 * fa) + (q12 * fb) - (bz2 * q2 * fx) + (((bz2 * q1) - (bx2 * q3)) * fy) + (bx2 * q2 * fz);
+        T s1 = (q32 * fa) + (q02 * fb) - (four * q1 * fc) + (bz2 * q3 * fx) + (((bx2 * q2) + (bz2 * q0)) * fy) + (((bx2 * q3) - (bz4 * q1)) * fz);
+        T s2 = -(q02 * fa) + (q32 * fb) - (four * q2 * fc) + ((-(bx4 * q2) - (bz2 * q0)) * fx) + (((bx2 * q1) + (bz2 * q3)) * fy) +
+            (((bx2 * q0) - (bz4 * q2)) * fz);
+        T s3 = (q12 * fa) + (q22 * fb) + ((-(bx4 * q3) + (bz2 * q1)) * fx) + (((bz2 * q2) - (bx2 * q0)) * fy) + (bx2 * q1 * fz);
+        const T rs = T::rsqrt((s0 * s0) + (s1 * s1) + (s2 * s2) + (s3 * s3)) * on * T(beta);
+        qd0 = qd0 - (rs * s0);
+        qd1 = qd1 - (rs * s1);
+        qd2 = qd2 - (rs * s2);
+        qd3 = qd3 - (rs * s3);
+
+        q0 = q0 + (qd0 * dt);
+        q1 = q1 + (qd1 * dt);
+        q2 = q2 + (qd2 * dt);
+        q3 = q3 + (qd3 * dt);
+        const T rq = T::rsqrt((q0 * q0) + (q1 * q1) + (q2 * q2) + (q3 * q3));
+        (q0 * rq).store(at(0));
+        (q1 * rq).store(at(1));
+        (q2 * rq).store(at(2));
+        (q3 * rq).store(at(3));
+    }
+}
+
+/// default constructor
+/// @param[in] channels # of independent channels
+/// @param[in] rate output rate in hz
+/// @param[in] beta gradient descent gain
+ImuFusion::ImuFusion(int channels, double rate, float beta) : channels_(std::max(1, channels)), period_(0), beta_(beta), reset_(false)
+{
+    stride_ = (channels_ + 3) & ~3;
+    state_.resize(static_cast<size_t>(Fields) * stride_);
+    gyro_.resize(static_cast<size_t>(channels_) * 3);
+    count_.resize(channels_);
+    base_.resize(channels_);
+    latest_.resize(channels_);
+    steps_.resize(channels_);
+    started_.resize(channels_);
+    setRate(rate);
+}
+
+/// sets the output rate, every channel restarts from its next sample
+/// @param[in] rate the rate in hz
+void ImuFusion::setRate(double rate)
+{
+    period_ = std::max<int64_t>(1, static_cast<int64_t>(1e9 / std::max(rate, 1.0)));
+    clear();
+}
+
+/// restarts every channel
+void ImuFusion::clear()
+{
+    std::fill(state_.begin(), state_.end(), 0.0f);
+    std::fill(field(Q0), field(Q0) + stride_, 1.0f);
+    std::fill(gyro_.begin(), gyro_.end(), 0.0);
+    std::fill(count_.begin(), count_.end(), 0);
+    std::fill(steps_.begin(), steps_.end(), 0);
+    std::fill(started_.begin(), started_.end(), 0);
+    reset_ = false;
+}
+
+/// adds a sample to a channel, call advance to step the filter once samples are pushed
+/// @param[in] channel the channel
+/// @param[in] pos the raw sample
+/// @note a channel starts from the probe's own orientation at its first sample, samples older than the latest are ignored
+void ImuFusion::push(int channel, const CusPosInfo& pos)
+{
+    if (reset_)
+        clear();
+    if (channel < 0 || channel >= channels_)
+        return;
+
+    if (!started_[channel])
+    {
+        const auto n = std::sqrt((pos.qw * pos.qw) + (pos.qx * pos.qx) + (pos.qy * pos.qy) + (pos.qz * pos.qz));
+        if (n > 1e-6)
+        {
+            field(Q0)[channel] = static_cast<float>(pos.qw / n);
+            field(Q1)[channel] = static_cast<float>(pos.qx / n);
+            field(Q2)[channel] = static_cast<float>(pos.qy / n);
+            field(Q3)[channel] = static_cast<float>(pos.qz / n);
+        }
+        base_[channel] = latest_[channel] = pos.tm;
+        started_[channel] = 1;
+    }
+    else if (pos.tm < latest_[channel])
+        return;
+
+    latest_[channel] = pos.tm;
+    gyro_[(channel * 3) + 0] += pos.gx;
+    gyro_[(channel * 3) + 1] += pos.gy;
+    gyro_[(channel * 3) + 2] += pos.gz;
+    count_[channel]++;
+    field(AX)[channel] = static_cast<float>(pos.ax);
+    field(AY)[channel] = static_cast<float>(pos.ay);
+    field(AZ)[channel] = static_cast<float>(pos.az);
+    field(MX)[channel] = static_cast<float>(pos.mx);
+    field(MY)[channel] = static_cast<float>(pos.my);
+    field(MZ)[channel] = static_cast<float>(pos.mz);
+}
+
+/// steps every channel up to its latest sample at the fixed rate, calling the pose callback after each step
+/// @return the # of poses output
+/// @note the gyroscope average of a step that received no samples is held from the previous step
+int ImuFusion::advance()
+{
+    if (reset_)
+        clear();
+
+    const auto dt = static_cast<float>(static_cast<double>(period_) * 1e-9);
+    auto poses = 0;
+    for (;;)
+    {
+        auto pending = false;
+        float* lane = field(DT);
+        for (auto c = 0; c < channels_; c++)
+        {
+            const auto due = started_[c] && ((steps_[c] + 1) * period_) <= (latest_[c] - base_[c]);
+            lane[c] = due ? dt : 0.0f;
+            pending = pending || due;
+            if (due && count_[c])
+            {
+                for (auto k = 0; k < 3; k++)
+                {
+                    field(static_cast<Field>(GX + k))[c] = static_cast<float>(gyro_[(c * 3) + k] / count_[c]);
+                    gyro_[(c * 3) + k] = 0;
+                }
+                count_[c] = 0;
+            }
+        }
+        if (!pending)
+            break;
+
+        auto c = 0;
+#if defined(FUSION_SSE2)
+        for (; c + 4 <= channels_; c += 4)
+            madgwick<Lanes>(state_.data() + c, stride_, beta_);
+#endif
+        for (; c < channels_; c++)
+            madgwick<Single>(state_.data() + c, stride_, beta_);
+
+        for (c = 0; c < channels_; c++)
+        {
+            if (lane[c] > 0)
+            {
+                steps_[c]++;
+                output(c);
+                poses++;
+            }
+        }
+    }
+    return poses;
+}
+
+/// delivers the pose of the latest step of a channel
+/// @param[in] channel the channel
+void ImuFusion::output(int channel)
+{
+    if (!fn_)
+        return;
+
+    CusPosInfo pos;
+    if (pose(channel, pos))
+        fn_(channel, pos);
+}
+
+/// retrieves the pose of the latest step of a channel
+/// @param[in] channel the channel
+/// @param[out] pos the pose
+/// @return success of the call, false until the channel took its first step
+bool ImuFusion::pose(int channel, CusPosInfo& pos) const
+{
+    if (channel < 0 || channel >= channels_ || !started_[channel] || !steps_[channel])
+        return false;
+
+    pos.tm = base_[channel] + (steps_[channel] * period_);
+    pos.gx = field(GX)[channel];
+    pos.gy = field(GY)[channel];
+    pos.gz = field(GZ)[channel];
+    pos.ax = field(AX)[channel];
+    pos.ay = field(AY)[channel];
+    pos.az = field(AZ)[channel];
+    pos.mx = field(MX)[channel];
+    pos.my = field(MY)[channel];
+    pos.mz = field(MZ)[channel];
+    pos.qw = field(Q0)[channel];
+    pos.qx = field(Q1)[channel];
+    pos.qy = field(Q2)[channel];
+    pos.qz = field(Q3)[channel];
+    return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <solum/solum_def.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#define FUSION_RATE     100.0   // default output rate in hz
+#define FUSION_BETA     0.1f    // default gradient descent gain, higher corrects gyro drift faster but follows sensor noise more
+
+/// madgwick orientation filter fusing the raw gyroscope, accelerometer and magnetometer of the imu stream
+///
+/// channels are independent probes or replayed sessions kept in structure of arrays form, so every filter step
+/// updates a vector of channels at once; the filter steps at a fixed rate on each channel's own clock, averaging the
+/// gyroscope over each step and holding the latest accelerometer and magnetometer readings, so poses come out at the
+/// configured rate whatever the rate samples arrive at, and nothing is allocated once constructed
+class ImuFusion
+{
+public:
+    /// fused pose callback
+    /// @param[in] channel the channel the pose belongs to
+    /// @param[in] pose the pose, the sensor values are the inputs of the step and the quaternion is the fused orientation
+    using PoseFn = std::function<void(int channel, const CusPosInfo& pose)>;
+
+    explicit ImuFusion(int channels = 1, double rate = FUSION_RATE, float beta = FUSION_BETA);
+
+    void setCallback(PoseFn fn) { fn_ = std::move(fn); }
+    void setBeta(float beta) { beta_ = beta; }
+    void setRate(double rate);
+    void reset() { reset_ = true; }
+
+    void push(int channel, const CusPosInfo& pos);
+    int advance();
+    bool pose(int channel, CusPosInfo& pos) const;
+
+    int channels() const { return channels_; }
+    double rate() const { return 1e9 / static_cast<double>(period_); }
+
+private:
+    /// per channel fields, each stored as a contiguous array across channels
+    enum Field
+    {
+        Q0, Q1, Q2, Q3,     ///< orientation
+        GX, GY, GZ,         ///< gyroscope averaged over the step
+        AX, AY, AZ,         ///< latest accelerometer
+        MX, MY, MZ,         ///< latest magnetometer
+        DT,                 ///< step length in seconds, 0 for channels that don't step
+        Fields
+    };
+
+    float* field(Field f) { return state_.data() + (static_cast<size_t>(f) * stride_); }
+    const float* field(Field f) const { return state_.data() + (static_cast<size_t>(f) * stride_); }
+    void clear();
+    void output(int channel);
+
+private:
+    PoseFn fn_;                     ///< pose callback
+    int channels_;                  ///< # of channels
+    int stride_;                    ///< channels rounded up to the vector width
+    int64_t period_;                ///< step length in ns
+    float beta_;                    ///< gradient descent gain
+    std::atomic_bool reset_;        ///< set to restart every channel on the next sample
+    std::vector<float> state_;      ///< filter state and step inputs
+    std::vector<double> gyro_;      ///< gyroscope sums since the last step, 3 per channel
+    std::vector<int> count_;        ///< # of gyroscope samples summed per channel
+    std::vector<int64_t> base_;     ///< timestamp of the first sample per channel
+    std::vector<int64_t> latest_;   ///< timestamp of the latest sample per channel
+    std::vector<int64_t> steps_;    ///< # of steps taken per channel
+    std::vector<uint8_t> started_;  ///< set once a channel received its first sample
+};
@@ -0,0 +1,481 @@
+#include "imu.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define IMU_SSE2
+#endif
+
+#define SLERP_LINEAR    0.9995  // quaternion dot product above which slerp falls back to a normalized lerp
+#define IMU_VALUES      13      // sensor values in a sample, gyroscope, accelerometer, magnetometer and quaternion
+#define INT16_FULL      32767.0
+
+static_assert(sizeof(CusPosInfo) % sizeof(uint64_t) == 0, "imu samples are stored as whole words");
+static_assert(sizeof(CusPosInfo) == offsetof(CusPosInfo, gx) + (IMU_VALUES * sizeof(double)), "sensor values follow the timestamp contiguously");
+
+namespace
+{
+    /// 32 bit float sample
+    struct Float32Sample
+    {
+        uint32_t dt;                ///< timestamp offset from the block base
+        float v[IMU_VALUES];        ///< sensor values
+    };
+
+    /// 16 bit fixed point sample, sized so it loads as two vectors
+    struct Int16Sample
+    {
+        uint32_t dt;                ///< timestamp offset from the block base
+        int16_t v[IMU_VALUES];      ///< sensor values in units of the block scales
+        int16_t pad;                ///< padding
+    };
+
+    static_assert(sizeof(Int16Sample) == 32, "int16 samples load as two 16 byte vectors");
+
+    /// retrieves the block scale that applies to a sensor value
+    /// @param[in] k the value index
+    /// @return the scale index
+    int scaleIndex(int k)
+    {
+        return std::min(k / 3, 3);
+    }
+
+    /// converts the values of an int16 sample
+    /// @param[in] p the sample
+    /// @param[in] scale the scale of each value, padded to 14 entries
+    /// @param[out] v the values, padded to 14 entries
+    void int16Values(const uint8_t* p, const double* scale, double* v)
+    {
+#if defined(IMU_SSE2)
+        // the first vector holds the timestamp offset and values 0-5, the second values 6-12 and the padding
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+        const __m128i a0 = _mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16);
+        const __m128i a1 = _mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16);
+        const __m128i b0 = _mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16);
+        const __m128i b1 = _mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16);
+        auto upper = [](__m128i x) { return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 2, 3, 2)); };
+        _mm_storeu_pd(v + 0, _mm_mul_pd(_mm_cvtepi32_pd(upper(a0)), _mm_loadu_pd(scale + 0)));
+        _mm_storeu_pd(v + 2, _mm_mul_pd(_mm_cvtepi32_pd(a1), _mm_loadu_pd(scale + 2)));
+        _mm_storeu_pd(v + 4, _mm_mul_pd(_mm_cvtepi32_pd(upper(a1)), _mm_loadu_pd(scale + 4)));
+        _mm_storeu_pd(v + 6, _mm_mul_pd(_mm_cvtepi32_pd(b0), _mm_loadu_pd(scale + 6)));
+        _mm_storeu_pd(v + 8, _mm_mul_pd(_mm_cvtepi32_pd(upper(b0)), _mm_loadu_pd(scale + 8)));
+        _mm_storeu_pd(v + 10, _mm_mul_pd(_mm_cvtepi32_pd(b1), _mm_loadu_pd(scale + 10)));
+        _mm_storeu_pd(v + 12, _mm_mul_pd(_mm_cvtepi32_pd(upper(b1)), _mm_loadu_pd(scale + 12)));
+#else
+        int16_t raw[IMU_VALUES];
+        std::memcpy(raw, p + offsetof(Int16Sample, v), sizeof(raw));
+        for (auto k = 0; k < IMU_VALUES; k++)
+            v[k] = raw[k] * scale[k];
+#endif
+    }
+
+    /// converts the values of a float sample
+    /// @param[in] p the sample
+    /// @param[out] v the values, padded to 14 entries
+    void float32Values(const uint8_t* p, double* v)
+    {
+#if defined(IMU_SSE2)
+        const float* f = reinterpret_cast<const float*>(p + offsetof(Float32Sample, v));
+        const __m128 a = _mm_loadu_ps(f);
+        const __m128 b = _mm_loadu_ps(f + 4);
+        const __m128 c = _mm_loadu_ps(f + 8);
+        _mm_storeu_pd(v + 0, _mm_cvtps_pd(a));
+        _mm_storeu_pd(v + 2, _mm_cvtps_pd(_mm_movehl_ps(a, a)));
+        _mm_storeu_pd(v + 4, _mm_cvtps_pd(b));
+        _mm_storeu_pd(v + 6, _mm_cvtps_pd(_mm_movehl_ps(b, b)));
+        _mm_storeu_pd(v + 8, _mm_cvtps_pd(c));
+        _mm_storeu_pd(v + 10, _mm_cvtps_pd(_mm_movehl_ps(c, c)));
+        float last;
+        std::memcpy(&last, f + 12, sizeof(last));
+        v[12] = last;
+#else
+        float raw[IMU_VALUES];
+        std::memcpy(raw, p + offsetof(Float32Sample, v), sizeof(raw));
+        for (auto k = 0; k < IMU_VALUES; k++)
+            v[k] = raw[k];
+#endif
+    }
+}
+
+/// default constructor
+/// @param[in] capacity # of samples to hold, rounded up to a power of 2
+ImuBuffer::ImuBuffer(int capacity) : head_(0), base_(0), last_(INT64_MIN)
+{
+    uint64_t n = 2;
+    while (n < static_cast<uint64_t>(std::max(capacity, 2)))
+        n <<= 1;
+    slots_.reset(new Slot[n]());
+    mask_ = n - 1;
+}
+
+/// adds a sample, called from the sdk threads
+/// @param[in] pos the sample
+/// @return success of the call, false if the sample isn't newer than the last one
+/// @note samples embedded in frames repeat streamed ones, the repeats are dropped by their timestamp, while a large step
+///       back (a reconnection or looped playback) restarts the buffer
+bool ImuBuffer::push(const CusPosInfo& pos)
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    if (pos.tm <= last_)
+    {
+        if ((last_ - pos.tm) < IMU_RESTART)
+            return false;
+        base_.store(head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    last_ = pos.tm;
+
+    uint64_t words[Words];
+    std::memcpy(words, &pos, sizeof(words));
+    const auto s = head_.load(std::memory_order_relaxed);
+    auto& slot = slots_[s & mask_];
+    slot.seq.store((2 * s) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (auto i = 0; i < Words; i++)
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    slot.seq.store((2 * s) + 2, std::memory_order_release);
+    head_.store(s + 1, std::memory_order_release);
+    return true;
+}
+
+/// discards the buffered samples
+void ImuBuffer::clear()
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    base_ = head_.load(std::memory_order_relaxed);
+    last_ = INT64_MIN;
+}
+
+/// retrieves the pose at a timestamp
+/// @param[in] tm the timestamp, typically that of a frame
+/// @param[out] pos the pose, orientation is slerped and the sensor values are linearly interpolated between the samples either side
+/// @param[in] tolerance how far the timestamp may be outside the buffered samples, the nearest sample is held within it
+/// @return success of the call
+bool ImuBuffer::pose(int64_t tm, CusPosInfo& pos, int64_t tolerance) const
+{
+    const auto h = head_.load(std::memory_order_acquire);
+    uint64_t a = first(h);
+    if (a >= h)
+        return false;
+    uint64_t b = h - 1;
+
+    // frames usually trail the newest sample slightly, so check it before searching
+    int64_t t;
+    if (!time(b, t))
+        return false;
+    if (tm >= t)
+    {
+        if ((tm - t) > tolerance || !read(b, pos))
+            return false;
+        pos.tm = tm;
+        return true;
+    }
+
+    // skip samples overwritten since the head was read
+    while (!time(a, t))
+    {
+        if (++a >= b)
+            return false;
+    }
+    if (t > tm)
+    {
+        if ((t - tm) > tolerance || !read(a, pos))
+            return false;
+        pos.tm = tm;
+        return true;
+    }
+
+    // samples a and b bracket the timestamp
+    while ((b - a) > 1)
+    {
+        const auto mid = a + ((b - a) / 2);
+        if (!time(mid, t))
+            return false;
+        if (t <= tm)
+            a = mid;
+        else
+            b = mid;
+    }
+
+    CusPosInfo pa, pb;
+    if (!read(a, pa) || !read(b, pb))
+        return false;
+
+    const double f = (pb.tm > pa.tm) ? static_cast<double>(tm - pa.tm) / static_cast<double>(pb.tm - pa.tm) : 0.0;
+    interpolate(pa, pb, f, pos);
+    pos.tm = tm;
+    return true;
+}
+
+/// retrieves the newest sample
+/// @param[out] pos the sample
+/// @return success of the call
+bool ImuBuffer::latest(CusPosInfo& pos) const
+{
+    const auto h = head_.load(std::memory_order_acquire);
+    return (first(h) < h) && read(h - 1, pos);
+}
+
+/// interpolates between two samples
+/// @param[in] a the earlier sample
+/// @param[in] b the later sample
+/// @param[in] t the fraction of the way from a to b
+/// @param[out] out the interpolated sample
+void ImuBuffer::interpolate(const CusPosInfo& a, const CusPosInfo& b, double t, CusPosInfo& out)
+{
+    auto lerp = [t](double x, double y) { return x + ((y - x) * t); };
+    out.tm = a.tm + static_cast<long long>(static_cast<double>(b.tm - a.tm) * t);
+    out.gx = lerp(a.gx, b.gx);
+    out.gy = lerp(a.gy, b.gy);
+    out.gz = lerp(a.gz, b.gz);
+    out.ax = lerp(a.ax, b.ax);
+    out.ay = lerp(a.ay, b.ay);
+    out.az = lerp(a.az, b.az);
+    out.mx = lerp(a.mx, b.mx);
+    out.my = lerp(a.my, b.my);
+    out.mz = lerp(a.mz, b.mz);
+
+    // take the shorter arc
+    double dot = (a.qw * b.qw) + (a.qx * b.qx) + (a.qy * b.qy) + (a.qz * b.qz);
+    const double sign = (dot < 0) ? -1.0 : 1.0;
+    dot = std::fabs(dot);
+
+    double wa, wb;
+    if (dot > SLERP_LINEAR)
+    {
+        wa = 1.0 - t;
+        wb = t;
+    }
+    else
+    {
+        const double theta = std::acos(dot);
+        const double s = std::sin(theta);
+        wa = std::sin((1.0 - t) * theta) / s;
+        wb = std::sin(t * theta) / s;
+    }
+    wb *= sign;
+
+    out.qw = (wa * a.qw) + (wb * b.qw);
+    out.qx = (wa * a.qx) + (wb * b.qx);
+    out.qy = (wa * a.qy) + (wb * b.qy);
+    out.qz = (wa * a.qz) + (wb * b.qz);
+    const double n = std::sqrt((out.qw * out.qw) + (out.qx * out.qx) + (out.qy * out.qy) + (out.qz * out.qz));
+    if (n > 0)
+    {
+        out.qw /= n;
+        out.qx /= n;
+        out.qy /= n;
+        out.qz /= n;
+    }
+}
+
+/// copies a sample out of the ring
+/// @param[in] serial the sample serial
+/// @param[out] pos the sample
+/// @return success of the call, false if the sample was overwritten
+bool ImuBuffer::read(uint64_t serial, CusPosInfo& pos) const
+{
+    const auto& slot = slots_[serial & mask_];
+    const auto seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != (2 * serial) + 2)
+        return false;
+
+    uint64_t words[Words];
+    for (auto i = 0; i < Words; i++)
+        words[i] = slot.words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq)
+        return false;
+
+    std::memcpy(&pos, words, sizeof(pos));
+    return true;
+}
+
+/// retrieves the timestamp of a sample
+/// @param[in] serial the sample serial
+/// @param[out] tm the timestamp
+/// @return success of the call, false if the sample was overwritten
+bool ImuBuffer::time(uint64_t serial, int64_t& tm) const
+{
+    const auto& slot = slots_[serial & mask_];
+    const auto seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != (2 * serial) + 2)
+        return false;
+
+    const auto word = slot.words[0].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq)
+        return false;
+
+    std::memcpy(&tm, &word, sizeof(tm));
+    return true;
+}
+
+/// retrieves the serial of the oldest sample still held
+/// @param[in] head the current head
+/// @return the serial
+uint64_t ImuBuffer::first(uint64_t head) const
+{
+    const auto cap = mask_ + 1;
+    return std::max(base_.load(std::memory_order_acquire), (head > cap) ? head - cap : 0);
+}
+
+/// retrieves the size of a packed sample
+/// @param[in] format the encoding
+/// @return the size in bytes
+size_t ImuPacker::sampleSize(ImuFormat format)
+{
+    switch (format)
+    {
+    case ImuFormat::Float32: return sizeof(Float32Sample);
+    case ImuFormat::Int16: return sizeof(Int16Sample);
+    default: return sizeof(CusPosInfo);
+    }
+}
+
+/// appends a block of packed samples
+/// @param[in] pos the samples
+/// @param[in] count # of samples
+/// @param[in] format the encoding
+/// @param[in,out] out the buffer to append the block to
+/// @return the # of samples packed, a block ends early at a sample before the base or too far past it for the offset
+/// @note int16 values are clamped to the full scale of their sensor
+int ImuPacker::pack(const CusPosInfo* pos, int count, ImuFormat format, std::vector<uint8_t>& out)
+{
+    if (!pos || count <= 0)
+        return 0;
+
+    auto n = 1;
+    while (n < count && pos[n].tm >= pos[0].tm && static_cast<uint64_t>(pos[n].tm - pos[0].tm) <= UINT32_MAX)
+        n++;
+
+    ImuBlock hdr;
+    hdr.base = pos[0].tm;
+    hdr.count = static_cast<uint32_t>(n);
+    hdr.format = static_cast<uint32_t>(format);
+    hdr.scale[0] = static_cast<float>(IMU_GYRO_RANGE / INT16_FULL);
+    hdr.scale[1] = static_cast<float>(IMU_ACCEL_RANGE / INT16_FULL);
+    hdr.scale[2] = static_cast<float>(IMU_MAG_RANGE / INT16_FULL);
+    hdr.scale[3] = static_cast<float>(1.0 / INT16_FULL);
+
+    const auto ss = sampleSize(format);
+    const auto at = out.size();
+    out.resize(at + sizeof(hdr) + (static_cast<size_t>(n) * ss));
+    uint8_t* p = out.data() + at;
+    std::memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    for (auto i = 0; i < n; i++, p += ss)
+    {
+        double v[IMU_VALUES];
+        std::memcpy(v, reinterpret_cast<const uint8_t*>(pos + i) + offsetof(CusPosInfo, gx), sizeof(v));
+        const auto dt = static_cast<uint32_t>(pos[i].tm - hdr.base);
+        if (format == ImuFormat::Float32)
+        {
+            Float32Sample s;
+            s.dt = dt;
+            for (auto k = 0; k < IMU_VALUES; k++)
+                s.v[k] = static_cast<float>(v[k]);
+            std::memcpy(p, &s, sizeof(s));
+        }
+        else if (format == ImuFormat::Int16)
+        {
+            Int16Sample s;
+            s.dt = dt;
+            for (auto k = 0; k < IMU_VALUES; k++)
+                s.v[k] = static_cast<int16_t>(std::lround(std::clamp(v[k] / static_cast<double>(hdr.scale[scaleIndex(k)]), -INT16_FULL, INT16_FULL)));
+            s.pad = 0;
+            std::memcpy(p, &s, sizeof(s));
+        }
+        else
+            std::memcpy(p, pos + i, sizeof(CusPosInfo));
+    }
+
+    return n;
+}
+
+/// unpacks a block of samples
+/// @param[in] block the block
+/// @param[in] size size of the block
+/// @param[out] out the samples
+/// @return the # of samples, -1 if the block is invalid
+int ImuPacker::unpack(const uint8_t* block, size_t size, std::vector<CusPosInfo>& out)
+{
+    ImuBlock hdr;
+    if (!block || size < sizeof(hdr))
+        return -1;
+    std::memcpy(&hdr, block, sizeof(hdr));
+    if (hdr.format > static_cast<uint32_t>(ImuFormat::Int16))
+        return -1;
+
+    const auto format = static_cast<ImuFormat>(hdr.format);
+    const auto ss = sampleSize(format);
+    if (((size - sizeof(hdr)) / ss) < hdr.count)
+        return -1;
+
+    double scale[IMU_VALUES + 1];
+    for (auto k = 0; k < IMU_VALUES; k++)
+        scale[k] = hdr.scale[scaleIndex(k)];
+    scale[IMU_VALUES] = 0;
+
+    out.resize(hdr.count);
+    const uint8_t* p = block + sizeof(hdr);
+    for (uint32_t i = 0; i < hdr.count; i++, p += ss)
+    {
+        auto& o = out[i];
+        if (format == ImuFormat::Double)
+        {
+            std::memcpy(&o, p, sizeof(o));
+            continue;
+        }
+
+        double v[IMU_VALUES + 1];
+        if (format == ImuFormat::Int16)
+            int16Values(p, scale, v);
+        else
+            float32Values(p, v);
+
+        uint32_t dt;
+        std::memcpy(&dt, p, sizeof(dt));
+        o.tm = hdr.base + dt;
+        std::memcpy(reinterpret_cast<uint8_t*>(&o) + offsetof(CusPosInfo, gx), v, IMU_VALUES * sizeof(double));
+    }
+
+    return static_cast<int>(hdr.count);
+}
+
+/// default constructor
+/// @param[in] span span in ns of the samples grouped into one batch
+/// @param[in] maxSamples # of samples that completes a batch regardless of its span
+ImuBatcher::ImuBatcher(int64_t span, int maxSamples) : span_(span), max_(std::max(1, maxSamples))
+{
+    batch_.reserve(static_cast<size_t>(max_));
+}
+
+/// adds a sample, delivering the batch if it's complete
+/// @param[in] pos the sample
+void ImuBatcher::push(const CusPosInfo& pos)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    batch_.push_back(pos);
+    if (static_cast<int>(batch_.size()) >= max_ || (pos.tm - batch_.front().tm) >= span_ || pos.tm < batch_.front().tm)
+        deliver();
+}
+
+/// delivers any pending samples, i.e. when imaging stops and no further samples will complete the batch
+void ImuBatcher::flush()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    deliver();
+}
+
+/// hands the batch to the callback and starts a new one
+void ImuBatcher::deliver()
+{
+    if (!batch_.empty() && fn_)
+        fn_(batch_.data(), static_cast<int>(batch_.size()));
+    batch_.clear();
+}
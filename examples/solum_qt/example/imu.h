@@ -0,0 +1,121 @@
+#pragma once
+
+#include <solum/solum_def.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define IMU_TOLERANCE   20000000    // how far in ns a lookup may fall outside the buffered samples and still hold the nearest one
+#define IMU_RESTART     1000000000  // step back in ns taken as a restarted stream rather than a repeated sample
+#define IMU_BATCH_SPAN  50000000    // span in ns of the samples grouped into one batch
+#define IMU_BATCH_MAX   64          // samples that complete a batch regardless of its span
+#define IMU_GYRO_RANGE  35.0        // int16 full scale for the gyroscope in rad/s (2000 dps)
+#define IMU_ACCEL_RANGE 16.0        // int16 full scale for the accelerometer in g
+#define IMU_MAG_RANGE   8.0         // int16 full scale for the normalized magnetometer
+
+/// compact imu sample encodings
+enum class ImuFormat : uint32_t
+{
+    Double,     ///< CusPosInfo as is, 112 bytes per sample
+    Float32,    ///< 32 bit floats with a 32 bit timestamp offset, 56 bytes per sample
+    Int16,      ///< 16 bit fixed point with per sensor scales and a 32 bit timestamp offset, 32 bytes per sample
+};
+
+/// header in front of a block of packed samples
+struct ImuBlock
+{
+    int64_t base;       ///< timestamp the sample offsets are relative to
+    uint32_t count;     ///< # of samples
+    uint32_t format;    ///< ImuFormat
+    float scale[4];     ///< int16 units of the gyroscope, accelerometer, magnetometer and quaternion
+};
+
+/// converts imu samples to and from the packed encodings
+///
+/// samples are packed in blocks sharing a base timestamp, unpacking converts a sample with a handful of vector
+/// instructions so recordings and streams can stay packed until a consumer needs CusPosInfo
+class ImuPacker
+{
+public:
+    static size_t sampleSize(ImuFormat format);
+    static int pack(const CusPosInfo* pos, int count, ImuFormat format, std::vector<uint8_t>& out);
+    static int unpack(const uint8_t* block, size_t size, std::vector<CusPosInfo>& out);
+};
+
+/// ring of imu samples with lock-free pose lookup at any timestamp
+///
+/// streamed samples and those embedded in frames go into one ring ordered by timestamp, readers never block and
+/// detect a sample being overwritten instead of seeing it torn, so a frame callback can align the pose to its own
+/// timestamp for the cost of a short search and two sample copies; writers on different threads and clears take a
+/// small mutex held for a single sample copy
+class ImuBuffer
+{
+public:
+    explicit ImuBuffer(int capacity = 4096);
+
+    ImuBuffer(const ImuBuffer&) = delete;
+    ImuBuffer& operator=(const ImuBuffer&) = delete;
+
+    bool push(const CusPosInfo& pos);
+    void clear();
+    bool pose(int64_t tm, CusPosInfo& pos, int64_t tolerance = IMU_TOLERANCE) const;
+    bool latest(CusPosInfo& pos) const;
+    uint64_t samples() const { return head_ - base_; }
+
+    static void interpolate(const CusPosInfo& a, const CusPosInfo& b, double t, CusPosInfo& out);
+
+private:
+    static constexpr int Words = sizeof(CusPosInfo) / sizeof(uint64_t);
+
+    /// ring slot, the sample is stored as words so a concurrent overwrite is caught by the sequence rather than torn
+    struct Slot
+    {
+        std::atomic<uint64_t> seq;          ///< 2 * serial + 2 once written, odd while being written
+        std::atomic<uint64_t> words[Words]; ///< sample
+    };
+
+    bool read(uint64_t serial, CusPosInfo& pos) const;
+    bool time(uint64_t serial, int64_t& tm) const;
+    uint64_t first(uint64_t head) const;
+
+private:
+    std::unique_ptr<Slot[]> slots_;             ///< ring storage
+    uint64_t mask_;                             ///< capacity - 1, the capacity is a power of 2
+    std::atomic<uint64_t> head_;                ///< serial of the next sample
+    std::atomic<uint64_t> base_;                ///< serial of the first sample after the last clear
+    std::mutex writeLock_;                      ///< serializes producers on different sdk threads and clears
+    int64_t last_;                              ///< timestamp of the newest sample, guarded by writeLock_
+};
+
+/// groups streamed imu samples into batches so consumers pay per batch rather than per sample
+///
+/// samples are copied into a preallocated batch on the sdk thread, and the batch is handed to the callback once its
+/// samples span the batch interval or it is full, so a consumer posting events or repainting does so a few times a
+/// second rather than at the imu rate
+class ImuBatcher
+{
+public:
+    /// batch callback
+    /// @param[in] pos the samples, oldest first
+    /// @param[in] count the # of samples
+    using BatchFn = std::function<void(const CusPosInfo* pos, int count)>;
+
+    explicit ImuBatcher(int64_t span = IMU_BATCH_SPAN, int maxSamples = IMU_BATCH_MAX);
+
+    void setCallback(BatchFn fn) { fn_ = std::move(fn); }
+    void push(const CusPosInfo& pos);
+    void flush();
+
+private:
+    void deliver();
+
+private:
+    BatchFn fn_;                    ///< batch callback
+    std::mutex lock_;               ///< protects the batch against flushes from other threads
+    std::vector<CusPosInfo> batch_; ///< samples of the current batch
+    int64_t span_;                  ///< batch span in ns
+    int max_;                       ///< maximum batch size
+};
@@ -5,7 +5,6 @@
 
 static std::unique_ptr<Solum> _solum;
 static std::vector<char> _image;
-static std::vector<char> _prescanImage;
 static std::vector<char> _spectrum;
 static std::vector<char> _rfData;
 
@@ -51,7 +50,7 @@ int main(int argc, char *argv[])
     initParams.connectFn =
         [](CusConnection res, int port, const char* msg)
         {
-            QApplication::postEvent(_solum.get(), new event::Connection(res, port, QString::fromLatin1(msg)));
+            QApplication::postEvent(_solum.get(), new event::Connection(res, port, msg));
         };
 
     initParams.certFn =
@@ -69,22 +68,48 @@ int main(int argc, char *argv[])
     initParams.newProcessedImageFn =
         [](const void* img, const CusProcessedImageInfo* nfo, int npos, const CusPosInfo* pos)
         {
+            // record straight from the sdk buffer before any host processing touches the frame
+            _solum->recorder().processed(img, nfo, npos, pos);
+            _solum->cine().processed(img, nfo, npos, pos);
             int sz = nfo->imageSize;
-            // we need to perform a deep copy of the image data since we have to post the event (yes this happens a lot with this api)
+            // persistence needs a writable copy, the pipeline takes its own copy of the result for decoding
             if (_image.size() < static_cast<size_t>(sz))
                 _image.resize(sz);
             std::memcpy(_image.data(), img, sz);
+            // persistence runs in place on the copy so the gui only ever sees filtered frames
+            _solum->filter().process(_image.data(), nfo);
+            // use the pose at the frame's own timestamp rather than whichever sample happened to be tagged with it, when fusing
+            // the ring only holds fused poses
+            for (auto i = 0; pos && i < npos && !_solum->fuseImu(); i++)
+                _solum->imu().push(pos[i]);
+            CusPosInfo aligned;
             QQuaternion imu;
             imu.setScalar(0.0);
-            if (npos && pos)
+            if (_solum->imu().pose(nfo->tm, aligned))
+                imu = QQuaternion(static_cast<float>(aligned.qw), static_cast<float>(aligned.qx), static_cast<float>(aligned.qy), static_cast<float>(aligned.qz));
+            else if (npos && pos)
+            {
+                aligned = pos[0];
                 imu = QQuaternion(static_cast<float>(pos[0].qw), static_cast<float>(pos[0].qx), static_cast<float>(pos[0].qy), static_cast<float>(pos[0].qz));
-
-            QApplication::postEvent(_solum.get(), new event::Image(IMAGE_EVENT, _image.data(), nfo->width, nfo->height, nfo->bitsPerPixel, nfo->format, sz, nfo->overlay, imu));
+            }
+            if (!imu.isNull())
+                _solum->volume().insert(img, nfo, aligned);
+
+            ImageInfo info;
+            info.width = nfo->width;
+            info.height = nfo->height;
+            info.bpp = nfo->bitsPerPixel;
+            info.format = nfo->format;
+            info.size = sz;
+            info.imu = imu;
+            _solum->pipeline().push(nfo->overlay ? ImageStream::Overlay : ImageStream::Processed, _image.data(), info);
         };
 
     initParams.newRawImageFn =
-        [](const void* data, const CusRawImageInfo* nfo, int, const CusPosInfo*)
+        [](const void* data, const CusRawImageInfo* nfo, int npos, const CusPosInfo* pos)
         {
+            _solum->recorder().raw(data, nfo, npos, pos);
+            _solum->exporter().raw(data, nfo);
             // we need to perform a deep copy of the image data since we have to post the event (yes this happens a lot with this api)
             int sz = nfo->lines * nfo->samples * (nfo->bitsPerSample / 8);
             if (nfo->rf)
@@ -97,20 +122,22 @@ int main(int argc, char *argv[])
             }
             else
             {
+                _solum->cine().raw(data, nfo, npos, pos);
                 // image may be a jpeg, adjust the size
-                if (nfo->jpeg)
-                    sz = nfo->jpeg;
-                if (_prescanImage.size() < static_cast<size_t>(sz))
-                    _prescanImage.resize(sz);
-                std::memcpy(_prescanImage.data(), data, sz);
-                QApplication::postEvent(_solum.get(), new event::Image(PRESCAN_EVENT, _prescanImage.data(), nfo->lines, nfo->samples,
-                                                                       nfo->bitsPerSample, nfo->jpeg ? Jpeg : Uncompressed8Bit, sz, false, QQuaternion()));
+                ImageInfo info;
+                info.width = nfo->lines;
+                info.height = nfo->samples;
+                info.bpp = nfo->bitsPerSample;
+                info.format = nfo->jpeg ? Jpeg : Uncompressed8Bit;
+                info.size = nfo->jpeg ? nfo->jpeg : sz;
+                _solum->pipeline().push(ImageStream::Prescan, data, info);
             }
         };
 
     initParams.newSpectralImageFn =
         [](const void* img, const CusSpectralImageInfo* nfo)
         {
+            _solum->recorder().spectral(img, nfo);
             size_t sz = nfo->lines * nfo->samples * (nfo->bitsPerSample / 8);
             // we need to perform a deep copy of the spectrum data since we have to post the event (yes this happens a lot with this api)
             if (_spectrum.size() < sz)
@@ -128,16 +155,26 @@ int main(int argc, char *argv[])
     initParams.newImuDataFn =
         [](const CusPosInfo* pos)
         {
-            QQuaternion imu;
-            imu.setScalar(0.0);
-            if (pos)
-                imu = QQuaternion(static_cast<float>(pos->qw), static_cast<float>(pos->qx), static_cast<float>(pos->qy), static_cast<float>(pos->qz));
-            QApplication::postEvent(_solum.get(), new event::Imu(imu));
+            _solum->recorder().imu(pos);
+            _solum->cine().imu(pos);
+            if (pos && _solum->fuseImu())
+            {
+                _solum->fusion().push(0, *pos);
+                _solum->fusion().advance();
+            }
+            else if (pos)
+            {
+                _solum->imu().push(*pos);
+                _solum->imuBatcher().push(*pos);
+            }
         };
 
     initParams.imagingFn =
         [](CusImagingState state, int imaging)
         {
+            // any change in depth, mode or application invalidates the persistence history
+            _solum->filter().reset();
+            _solum->recorder().imaging(state, imaging);
             // post event here, as the gui (statusbar) will be updated directly, and it needs to come from the application thread
             QApplication::postEvent(_solum.get(), new event::Imaging(state, imaging ? true : false));
         };
@@ -156,6 +193,25 @@ int main(int argc, char *argv[])
             QApplication::postEvent(_solum.get(), new event::Error(code, err));
     };
 
+    // the gui only shows the latest pose, so it's updated once per batch rather than at the imu rate
+    _solum->imuBatcher().setCallback([](const CusPosInfo* pos, int count)
+    {
+        const auto& last = pos[count - 1];
+        QApplication::postEvent(_solum.get(), new event::Imu(QQuaternion(static_cast<float>(last.qw), static_cast<float>(last.qx),
+            static_cast<float>(last.qy), static_cast<float>(last.qz)), count));
+    });
+
+    // fused poses replace the streamed samples at the fixed fusion rate
+    _solum->fusion().setCallback([](int, const CusPosInfo& pose)
+    {
+        _solum->imu().push(pose);
+        _solum->imuBatcher().push(pose);
+    });
+
+    // playback and the simulator deliver through the very same callbacks
+    _solum->player().setCallbacks(initParams);
+    _solum->simulator().setCallbacks(initParams);
+
     if (solumInit(&initParams) != CUS_SUCCESS)
     {
         qDebug() << "error initializing solum";
@@ -166,8 +222,7 @@ int main(int argc, char *argv[])
         [](bool connected, const char* serial, double timeRemaining, const char* id, const char* name, const char* exam)
         {
             // post event here, as the gui (statusbar) will be updated directly, and it needs to come from the application thread
-            QApplication::postEvent(_solum.get(), new event::Tee(connected, QString::fromLatin1(serial), timeRemaining,
-                QString::fromLatin1(id), QString::fromLatin1(name), QString::fromLatin1(exam)));
+            QApplication::postEvent(_solum.get(), new event::Tee(connected, serial, timeRemaining, id, name, exam));
         });
 
     printFirmwareVersions();
@@ -175,6 +230,9 @@ int main(int argc, char *argv[])
     _solum->show();
     const int result = a.exec();
     solumDestroy();
+    // the simulator and playback threads call back through _solum, so stop them while it's still set
+    _solum->simulator().disconnect();
+    _solum->player().close();
     _solum.reset();
     return result;
 }
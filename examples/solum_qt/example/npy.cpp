@@ -0,0 +1,230 @@
+#include "npy.h"
+#include <cstring>
+
+#define NPY_MAGIC   "\x93NUMPY"
+#define NPY_UPDATE  16  // rows between header rewrites, bounds how far a reader can lag during an export
+
+/// default constructor
+NpyWriter::NpyWriter() : rowSize_(0), rows_(0)
+{
+}
+
+/// destructor
+NpyWriter::~NpyWriter()
+{
+    close();
+}
+
+/// creates the array file
+/// @param[in] path the file path
+/// @param[in] descr the numpy dtype descriptor, i.e. '<i2'
+/// @param[in] shape the shape of each row, empty for scalar rows
+/// @param[in] rowSize size of each row in bytes
+/// @return success of the call
+bool NpyWriter::open(const QString& path, const char* descr, const std::vector<int>& shape, uint64_t rowSize)
+{
+    close();
+
+    file_ = std::make_unique<QFile>(path);
+    if (!file_->open(QIODevice::ReadWrite | QIODevice::Truncate))
+    {
+        file_.reset();
+        return false;
+    }
+
+    descr_ = descr;
+    shape_ = shape;
+    rowSize_ = rowSize;
+    rows_ = 0;
+    if (!update())
+    {
+        file_->close();
+        file_.reset();
+        return false;
+    }
+    return true;
+}
+
+/// appends a row
+/// @param[in] data the row data
+/// @return success of the call
+bool NpyWriter::append(const void* data)
+{
+    if (!file_)
+        return false;
+
+    if (file_->write(static_cast<const char*>(data), static_cast<qint64>(rowSize_)) != static_cast<qint64>(rowSize_))
+    {
+        // drop any partial row so the data stays a whole number of rows
+        file_->resize(NPY_HEADER + static_cast<qint64>(rows_ * rowSize_));
+        file_->seek(file_->size());
+        return false;
+    }
+
+    rows_++;
+    return ((rows_ % NPY_UPDATE) != 0) || update();
+}
+
+/// rewrites the header with the current # of rows
+/// @return success of the call
+bool NpyWriter::update()
+{
+    if (!file_)
+        return false;
+
+    std::string dict = "{'descr': '" + descr_ + "', 'fortran_order': False, 'shape': (" + std::to_string(rows_);
+    if (shape_.empty())
+        dict += ',';
+    for (auto d : shape_)
+        dict += ", " + std::to_string(d);
+    dict += "), }";
+
+    const size_t len = NPY_HEADER - (sizeof(NPY_MAGIC) - 1) - 4;
+    if (dict.size() + 1 > len)
+        return false;
+    dict.resize(len - 1, ' ');
+    dict += '\n';
+
+    char hdr[NPY_HEADER];
+    std::memcpy(hdr, NPY_MAGIC, sizeof(NPY_MAGIC) - 1);
+    hdr[6] = 1;
+    hdr[7] = 0;
+    hdr[8] = static_cast<char>(len & 0xff);
+    hdr[9] = static_cast<char>(len >> 8);
+    std::memcpy(hdr + 10, dict.data(), dict.size());
+
+    const auto end = NPY_HEADER + static_cast<qint64>(rows_ * rowSize_);
+    return file_->seek(0) && file_->write(hdr, NPY_HEADER) == NPY_HEADER && file_->seek(end);
+}
+
+/// finalizes the header and closes the file
+/// @return success of the call
+bool NpyWriter::close()
+{
+    if (!file_)
+        return false;
+
+    const auto ok = update();
+    file_->close();
+    file_.reset();
+    return ok;
+}
+
+/// default constructor
+NpyExporter::NpyExporter() : open_(false), started_(false), lines_(0), samples_(0), bits_(0), rf_(0), frames_(0), dropped_(0)
+{
+}
+
+/// starts an export, the arrays are created when the first frame arrives and fixes their shape
+/// @param[in] path the path of the frame array, sidecars are named after it
+/// @return success of the call
+bool NpyExporter::open(const QString& path)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (open_)
+        return false;
+
+    base_ = path;
+    if (base_.endsWith(QStringLiteral(".npy")))
+        base_.chop(4);
+    started_ = false;
+    frames_ = 0;
+    dropped_ = 0;
+    open_ = true;
+    return true;
+}
+
+/// stops the export and finalizes all the arrays
+/// @return success of the call
+bool NpyExporter::close()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!open_)
+        return false;
+
+    open_ = false;
+    if (!started_)
+        return true;
+
+    auto ok = data_.close();
+    ok = tm_.close() && ok;
+    ok = axial_.close() && ok;
+    ok = lateral_.close() && ok;
+    ok = tgc_.close() && ok;
+    return ok;
+}
+
+/// creates the arrays for the stream a frame belongs to
+/// @param[in] nfo the raw image information
+/// @return success of the call
+bool NpyExporter::start(const CusRawImageInfo* nfo)
+{
+    const char* descr = nullptr;
+    if (nfo->bitsPerSample == 8)
+        descr = "|u1";
+    else if (nfo->bitsPerSample == 16)
+        descr = nfo->rf ? "<i2" : "<u2";
+    else if (nfo->bitsPerSample == 32)
+        descr = nfo->rf ? "<i4" : "<u4";
+    if (!descr || nfo->lines <= 0 || nfo->samples <= 0)
+        return false;
+
+    lines_ = nfo->lines;
+    samples_ = nfo->samples;
+    bits_ = nfo->bitsPerSample;
+    rf_ = nfo->rf;
+    const auto size = static_cast<uint64_t>(lines_) * static_cast<uint64_t>(samples_) * static_cast<uint64_t>(bits_ / 8);
+    if (!data_.open(base_ + QStringLiteral(".npy"), descr, { lines_, samples_ }, size) ||
+        !tm_.open(base_ + QStringLiteral("_tm.npy"), "<i8", {}, sizeof(int64_t)) ||
+        !axial_.open(base_ + QStringLiteral("_axial.npy"), "<f8", {}, sizeof(double)) ||
+        !lateral_.open(base_ + QStringLiteral("_lateral.npy"), "<f8", {}, sizeof(double)) ||
+        !tgc_.open(base_ + QStringLiteral("_tgc.npy"), "<f8", { CUS_MAXTGC, 2 }, sizeof(nfo->tgc)))
+    {
+        data_.close();
+        tm_.close();
+        axial_.close();
+        lateral_.close();
+        return false;
+    }
+
+    started_ = true;
+    return true;
+}
+
+/// exports a raw frame, called from the sdk thread
+/// @param[in] data the raw data
+/// @param[in] nfo the raw image information
+/// @note jpeg compressed frames and frames that don't match the shape of the first frame are counted as dropped
+void NpyExporter::raw(const void* data, const CusRawImageInfo* nfo)
+{
+    if (!open_ || !data || !nfo)
+        return;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!open_ || (started_ && nfo->rf != rf_))
+        return;
+
+    if (nfo->jpeg || (!started_ && !start(nfo)))
+    {
+        dropped_++;
+        return;
+    }
+    if (nfo->lines != lines_ || nfo->samples != samples_ || nfo->bitsPerSample != bits_)
+    {
+        dropped_++;
+        return;
+    }
+
+    // sidecars are only written once the frame is, so every array keeps the same # of rows
+    const int64_t tm = nfo->tm;
+    if (!data_.append(data))
+    {
+        dropped_++;
+        return;
+    }
+    tm_.append(&tm);
+    axial_.append(&nfo->axialSize);
+    lateral_.append(&nfo->lateralSize);
+    tgc_.append(nfo->tgc);
+    frames_++;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <solum/solum_def.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define NPY_HEADER  4096
+
+/// appendable .npy array file
+///
+/// the header is padded to a full page so the data starts page aligned and the leading dimension can be rewritten
+/// in place as rows are appended, after every header update the file is a valid array of the rows written so far
+/// that numpy can memory-map without any conversion
+class NpyWriter
+{
+public:
+    NpyWriter();
+    ~NpyWriter();
+
+    NpyWriter(const NpyWriter&) = delete;
+    NpyWriter& operator=(const NpyWriter&) = delete;
+
+    bool open(const QString& path, const char* descr, const std::vector<int>& shape, uint64_t rowSize);
+    bool append(const void* data);
+    bool update();
+    bool close();
+    bool isOpen() const { return file_ != nullptr; }
+    uint64_t rows() const { return rows_; }
+
+private:
+    std::unique_ptr<QFile> file_;   ///< array file
+    std::string descr_;             ///< numpy dtype descriptor
+    std::vector<int> shape_;        ///< shape of each row
+    uint64_t rowSize_;              ///< size of each row in bytes
+    uint64_t rows_;                 ///< # of rows written
+};
+
+/// exports raw frames into numpy arrays
+///
+/// frames are written straight from the sdk buffer into <name>.npy shaped (frames, lines, samples), with per frame
+/// sidecar arrays <name>_tm.npy, <name>_axial.npy, <name>_lateral.npy and <name>_tgc.npy (frames, CUS_MAXTGC, depth/gain)
+class NpyExporter
+{
+public:
+    NpyExporter();
+
+    bool open(const QString& path);
+    bool close();
+    bool isOpen() const { return open_; }
+    void raw(const void* data, const CusRawImageInfo* nfo);
+
+    uint64_t frames() const { return frames_; }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    bool start(const CusRawImageInfo* nfo);
+
+private:
+    std::mutex lock_;               ///< serializes frames against open and close
+    QString base_;                  ///< output path without the extension
+    std::atomic_bool open_;         ///< export state
+    bool started_;                  ///< set once the first frame has fixed the array shape
+    int lines_;                     ///< lines per frame
+    int samples_;                   ///< samples per line
+    int bits_;                      ///< bits per sample
+    int rf_;                        ///< rf flag of the exported stream, frames of the other kind are ignored
+    NpyWriter data_;                ///< frames
+    NpyWriter tm_;                  ///< timestamps
+    NpyWriter axial_;               ///< axial microns per sample
+    NpyWriter lateral_;             ///< lateral microns per line
+    NpyWriter tgc_;                 ///< tgc points
+    std::atomic<uint64_t> frames_;  ///< # of frames exported
+    std::atomic<uint64_t> dropped_; ///< # of frames that didn't match the array shape or failed to write
+};
@@ -20,6 +20,7 @@
 #include <Qt3DCore/Qt3DCore>
 #include <Qt3DRender/Qt3DRender>
 #include <Qt3DExtras/Qt3DExtras>
+#include <Qt3DLogic/Qt3DLogic>
 
 #ifdef __clang__
     #pragma clang diagnostic pop
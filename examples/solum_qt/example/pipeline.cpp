@@ -0,0 +1,241 @@
+#include "pipeline.h"
+#include <cstring>
+
+namespace
+{
+    /// copies raw pixels row by row, as the image rows are padded to 32 bits
+    /// @param[out] dst the destination image, already of the right dimensions and format
+    /// @param[in] src the raw pixels
+    /// @param[in] w width in pixels
+    /// @param[in] h height in pixels
+    /// @param[in] bpp bits per pixel of the raw pixels
+    void copyRaw(QImage& dst, const uint8_t* src, int w, int h, int bpp)
+    {
+        const auto stride = static_cast<size_t>(w) * (bpp / 8);
+        if (static_cast<size_t>(dst.bytesPerLine()) == stride)
+            std::memcpy(dst.bits(), src, stride * h);
+        else
+        {
+            for (int y = 0; y < h; y++)
+                std::memcpy(dst.scanLine(y), src + (stride * y), stride);
+        }
+    }
+}
+
+/// default constructor, starts the decoding thread
+ImagePipeline::ImagePipeline() : quit_(false), decoded_(0), dropped_(0)
+{
+    thread_ = std::thread(&ImagePipeline::loop, this);
+}
+
+/// destructor, stops the decoding thread
+ImagePipeline::~ImagePipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        quit_ = true;
+    }
+    wake_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+/// sets the ready callback, should be called before any images are pushed
+/// @param[in] fn the callback, typically posts an event to the gui thread
+void ImagePipeline::setCallback(ReadyFn fn)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    fn_ = std::move(fn);
+}
+
+/// queues an image for decoding, replacing the pending image of the stream if the worker hasn't picked it up yet
+/// @param[in] stream the stream the image belongs to
+/// @param[in] data the image data as received from the sdk
+/// @param[in] nfo the image information, the size is the # of bytes copied from the data
+void ImagePipeline::push(ImageStream stream, const void* data, const ImageInfo& nfo)
+{
+    if (!data || nfo.size <= 0)
+        return;
+
+    auto& s = streams_[static_cast<int>(stream)];
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (s.hasPending)
+            dropped_++;
+        s.pending.resize(static_cast<size_t>(nfo.size));
+        std::memcpy(s.pending.data(), data, s.pending.size());
+        s.pendingInfo = nfo;
+        s.bytes += s.pending.size();
+        s.hasPending = true;
+    }
+    wake_.notify_one();
+}
+
+/// retrieves the latest image of a stream, must be called from the gui thread
+/// @param[in] stream the stream to retrieve
+/// @param[out] nfo the information of the returned image
+/// @param[out] bytes optional bytes pushed on the stream since the previous call, including images replaced before display
+/// @return the front image of the stream, stays valid for the lifetime of the pipeline and is only changed by the
+///         next call for the same stream, null if nothing was decoded yet
+const QImage* ImagePipeline::acquire(ImageStream stream, ImageInfo& nfo, uint64_t* bytes)
+{
+    auto& s = streams_[static_cast<int>(stream)];
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        s.notified = false;
+        if (bytes)
+            *bytes = s.bytes;
+        s.bytes = 0;
+        if (s.fresh)
+        {
+            s.front.swap(s.ready);
+            s.frontInfo = s.readyInfo;
+            s.fresh = false;
+        }
+    }
+
+    nfo = s.frontInfo;
+    return s.front.isNull() ? nullptr : &s.front;
+}
+
+/// discards the pending and ready images of a stream, the front image is kept until the next acquire
+/// @param[in] stream the stream to clear
+void ImagePipeline::clear(ImageStream stream)
+{
+    auto& s = streams_[static_cast<int>(stream)];
+    std::lock_guard<std::mutex> lock(lock_);
+    s.hasPending = false;
+    s.fresh = false;
+}
+
+/// decoding thread, takes the pending image of every stream in turn and publishes the result as the ready image
+void ImagePipeline::loop()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    for (;;)
+    {
+        wake_.wait(lock, [this]()
+        {
+            if (quit_)
+                return true;
+            for (const auto& s : streams_)
+            {
+                if (s.hasPending)
+                    return true;
+            }
+            return false;
+        });
+        if (quit_)
+            break;
+
+        for (int i = 0; i < static_cast<int>(ImageStream::Count); i++)
+        {
+            auto& s = streams_[i];
+            if (!s.hasPending)
+                continue;
+
+            // take the payload, the sdk thread can fill the pending slot again while decoding
+            s.work.swap(s.pending);
+            s.workInfo = s.pendingInfo;
+            s.hasPending = false;
+
+            lock.unlock();
+            const auto stream = static_cast<ImageStream>(i);
+            const bool ok = decode(stream, s);
+            lock.lock();
+
+            if (!ok)
+            {
+                dropped_++;
+                continue;
+            }
+
+            decoded_++;
+            s.back.swap(s.ready);
+            s.readyInfo = s.workInfo;
+            s.fresh = true;
+
+            // only notify once until the gui has picked the image up, later images just replace the ready one
+            if (fn_ && !s.notified.exchange(true))
+            {
+                auto fn = fn_;
+                lock.unlock();
+                fn(stream);
+                lock.lock();
+            }
+        }
+    }
+}
+
+/// makes the back image of a stream match a size and format, reusing a spare of that size if one is kept, the
+/// previous back image becomes the most recent spare so switching back to its size doesn't allocate either
+/// @param[in,out] s the stream buffers
+/// @param[in] w width in pixels
+/// @param[in] h height in pixels
+/// @param[in] fmt the pixel format
+void ImagePipeline::reserve(Stream& s, int w, int h, QImage::Format fmt)
+{
+    auto matches = [w, h, fmt](const QImage& img)
+    {
+        return img.width() == w && img.height() == h && img.format() == fmt;
+    };
+
+    if (matches(s.back))
+        return;
+
+    int i = 0;
+    while (i < PIPELINE_SPARES && !matches(s.spares[i]))
+        i++;
+
+    // shift the spares down to free the front slot, dropping the oldest if none matched
+    QImage img;
+    img.swap(s.spares[i < PIPELINE_SPARES ? i : PIPELINE_SPARES - 1]);
+    for (int j = (i < PIPELINE_SPARES ? i : PIPELINE_SPARES - 1); j > 0; j--)
+        s.spares[j].swap(s.spares[j - 1]);
+    if (!s.back.isNull())
+        s.spares[0].swap(s.back);
+
+    if (matches(img))
+        s.back.swap(img);
+    else
+        s.back = QImage(w, h, fmt);
+}
+
+/// decodes or converts the payload of a stream into its back image, runs on the decoding thread
+/// @param[in] stream the stream being decoded
+/// @param[in,out] s the stream buffers
+/// @return success of the call
+bool ImagePipeline::decode(ImageStream stream, Stream& s)
+{
+    const auto& nfo = s.workInfo;
+    const auto* data = s.work.data();
+    const auto raw = static_cast<int64_t>(nfo.width) * nfo.height * (nfo.bpp / 8);
+
+    if (nfo.width <= 0 || nfo.height <= 0)
+        return false;
+
+    // check that the size matches the dimensions (uncompressed), prescan data is stored line by line, so each line becomes a row
+    if (nfo.size >= raw && (nfo.bpp == 8 || (nfo.bpp == 32 && stream != ImageStream::Prescan)))
+    {
+        const auto w = (stream == ImageStream::Prescan) ? nfo.height : nfo.width;
+        const auto h = (stream == ImageStream::Prescan) ? nfo.width : nfo.height;
+        const auto fmt = (nfo.bpp == 8) ? QImage::Format_Grayscale8 : QImage::Format_ARGB32;
+        reserve(s, w, h, fmt);
+        copyRaw(s.back, data, w, h, nfo.bpp);
+        return true;
+    }
+    else if (nfo.format != Jpeg && nfo.format != Png)
+        return false;
+
+    auto bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data), nfo.size);
+    QBuffer buf(&bytes);
+    if (!buf.open(QIODevice::ReadOnly))
+        return false;
+
+    // the reader decodes in place when the target already has the size and format from the header
+    QImageReader reader(&buf, nfo.format == Jpeg ? "JPG" : "PNG");
+    const auto sz = reader.size();
+    if (sz.isValid())
+        reserve(s, sz.width(), sz.height(), reader.imageFormat());
+    return reader.read(&s.back);
+}
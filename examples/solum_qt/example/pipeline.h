@@ -0,0 +1,94 @@
+#pragma once
+
+#include <solum/solum_def.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define PIPELINE_SPARES     3   // buffers of another size kept per stream, one per rotating buffer, so switching back and forth between two sizes doesn't allocate
+
+/// image streams decoded by the pipeline
+enum class ImageStream
+{
+    Processed,  ///< processed grayscale or color image
+    Overlay,    ///< separated color overlay
+    Prescan,    ///< prescan (raw) grayscale image, one row per line
+    Count
+};
+
+/// information carried with a decoded image
+struct ImageInfo
+{
+    int width = 0;                          ///< width as received
+    int height = 0;                         ///< height as received
+    int bpp = 0;                            ///< bits per pixel as received
+    CusImageFormat format = Uncompressed;   ///< format as received
+    int size = 0;                           ///< size in bytes as received
+    QQuaternion imu;                        ///< orientation at the time of the image, null if none
+};
+
+/// decodes and converts the image streams on a worker thread into triple buffered images ready to draw
+///
+/// the sdk thread only copies the payload into the pending slot of its stream, replacing any frame the worker hasn't
+/// picked up yet, the worker decodes into the back image and publishes it as the ready image, and the gui swaps the
+/// ready image to the front when notified, so the gui thread never decodes, converts or allocates for a frame and
+/// the front image it draws is never written while displayed
+class ImagePipeline
+{
+public:
+    /// called on the worker thread once a stream has a new image ready, at most once until the image is acquired
+    /// @param[in] stream the stream with the new image
+    using ReadyFn = std::function<void(ImageStream stream)>;
+
+    ImagePipeline();
+    ~ImagePipeline();
+
+    ImagePipeline(const ImagePipeline&) = delete;
+    ImagePipeline& operator=(const ImagePipeline&) = delete;
+
+    void setCallback(ReadyFn fn);
+    void push(ImageStream stream, const void* data, const ImageInfo& nfo);
+    const QImage* acquire(ImageStream stream, ImageInfo& nfo, uint64_t* bytes = nullptr);
+    void clear(ImageStream stream);
+
+    uint64_t decoded() const { return decoded_; }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    /// per stream buffers
+    struct Stream
+    {
+        std::vector<uint8_t> pending;           ///< latest payload from the sdk thread
+        std::vector<uint8_t> work;              ///< payload being decoded
+        ImageInfo pendingInfo;                  ///< information of the pending payload
+        ImageInfo workInfo;                     ///< information of the payload being decoded
+        ImageInfo readyInfo;                    ///< information of the ready image
+        ImageInfo frontInfo;                    ///< information of the front image
+        uint64_t bytes = 0;                     ///< bytes pushed since the last acquire
+        bool hasPending = false;                ///< set when a payload waits for the worker
+        bool fresh = false;                     ///< set when the ready image is newer than the front
+        std::atomic_bool notified{ false };     ///< set while a ready notification is outstanding
+        QImage back;                            ///< image being decoded into, only touched by the worker
+        QImage ready;                           ///< latest decoded image
+        QImage front;                           ///< image handed to the gui, only touched by the gui
+        QImage spares[PIPELINE_SPARES];         ///< buffers of other sizes, most recent first, only touched by the worker
+    };
+
+    void loop();
+    bool decode(ImageStream stream, Stream& s);
+    static void reserve(Stream& s, int w, int h, QImage::Format fmt);
+
+private:
+    ReadyFn fn_;                                            ///< ready callback
+    Stream streams_[static_cast<int>(ImageStream::Count)];  ///< stream buffers
+    std::mutex lock_;                                       ///< protects the pending and ready slots
+    std::condition_variable wake_;                          ///< signals a pending payload or shutdown
+    std::thread thread_;                                    ///< decoding thread
+    bool quit_;                                             ///< decoding thread shutdown flag
+    std::atomic<uint64_t> decoded_;                         ///< # of images decoded
+    std::atomic<uint64_t> dropped_;                         ///< # of payloads replaced before they were decoded, or that failed to decode
+};
@@ -0,0 +1,255 @@
+#include "player.h"
+#include <chrono>
+#include <cstring>
+
+using namespace cine;
+
+/// default constructor
+CinePlayer::CinePlayer() : data_(nullptr), size_(0), quit_(false), playing_(false), played_(0), loops_(0)
+{
+    std::memset(&params_, 0, sizeof(params_));
+}
+
+/// destructor
+CinePlayer::~CinePlayer()
+{
+    close();
+}
+
+/// maps a capture file and loads its index
+/// @param[in] path the capture file
+/// @return success of the call
+/// @note files that were never finalized (e.g. the recording application crashed) are indexed by walking the records
+bool CinePlayer::open(const QString& path)
+{
+    close();
+
+    file_ = std::make_unique<QFile>(path);
+    if (!file_->open(QIODevice::ReadOnly) || file_->size() < static_cast<qint64>(sizeof(FileHeader)))
+    {
+        file_.reset();
+        return false;
+    }
+
+    size_ = static_cast<uint64_t>(file_->size());
+    data_ = file_->map(0, file_->size());
+    FileHeader hdr;
+    if (data_)
+        std::memcpy(&hdr, data_, sizeof(hdr));
+    if (!data_ || std::memcmp(hdr.magic, CINE_MAGIC, sizeof(CINE_MAGIC)) != 0 || hdr.version != CINE_VERSION || !hdr.chunkSize)
+    {
+        close();
+        return false;
+    }
+
+    if (!loadIndex())
+        scanIndex();
+
+    return true;
+}
+
+/// stops playback and releases the file
+void CinePlayer::close()
+{
+    stop();
+    if (file_ && data_)
+        file_->unmap(const_cast<uchar*>(data_));
+    data_ = nullptr;
+    size_ = 0;
+    file_.reset();
+    index_.clear();
+}
+
+/// loads the index written when the capture was finalized
+/// @return success of the call
+bool CinePlayer::loadIndex()
+{
+    if (size_ < sizeof(FileHeader) + sizeof(Footer))
+        return false;
+
+    Footer footer;
+    std::memcpy(&footer, data_ + size_ - sizeof(Footer), sizeof(footer));
+    if (std::memcmp(footer.magic, CINE_INDEX, sizeof(footer.magic)) != 0 ||
+        footer.offset + (footer.count * sizeof(IndexEntry)) + sizeof(Footer) != size_)
+        return false;
+
+    index_.resize(footer.count);
+    std::memcpy(index_.data(), data_ + footer.offset, footer.count * sizeof(IndexEntry));
+    return true;
+}
+
+/// rebuilds the index by walking the records chunk by chunk
+void CinePlayer::scanIndex()
+{
+    FileHeader hdr;
+    std::memcpy(&hdr, data_, sizeof(hdr));
+    const uint64_t chunk = hdr.chunkSize;
+
+    index_.clear();
+    uint64_t offset = sizeof(FileHeader);
+    while (offset + sizeof(RecordHeader) <= size_)
+    {
+        RecordHeader rec;
+        std::memcpy(&rec, data_ + offset, sizeof(rec));
+        const uint64_t end = ((offset / chunk) + 1) * chunk;
+        // padding or the unwritten tail of a chunk, continue with the next one
+        if (rec.type == Pad || rec.size < sizeof(RecordHeader))
+        {
+            offset = end;
+            continue;
+        }
+        if (rec.type > ImuPacked || offset + rec.size > std::min(end, size_))
+            break;
+
+        index_.push_back({ rec.tm, rec.host, offset, rec.type, rec.frame });
+        offset += rec.size;
+    }
+}
+
+/// retrieves the recorded length of the capture
+/// @return the duration in seconds
+double CinePlayer::duration() const
+{
+    return index_.empty() ? 0.0 : static_cast<double>(index_.back().host - index_.front().host) / 1e9;
+}
+
+/// starts playback on a dedicated thread, which then acts as the sdk callback thread
+/// @param[in] pacing the playback pacing
+/// @param[in] loop flag to restart from the beginning once the end is reached
+/// @param[in] speed playback rate multiplier for real time pacing
+/// @return success of the call
+bool CinePlayer::play(Pacing pacing, bool loop, double speed)
+{
+    stop();
+    if (!data_ || index_.empty())
+        return false;
+
+    quit_ = false;
+    played_ = 0;
+    loops_ = 0;
+    playing_ = true;
+    thread_ = std::thread(&CinePlayer::loop, this, pacing, loop, (speed > 0) ? speed : 1.0);
+    return true;
+}
+
+/// stops playback and waits for the current callback to return
+void CinePlayer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        quit_ = true;
+    }
+    wake_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+    playing_ = false;
+}
+
+/// playback thread
+/// @param[in] pacing the playback pacing
+/// @param[in] repeat flag to loop the capture
+/// @param[in] speed playback rate multiplier
+void CinePlayer::loop(Pacing pacing, bool repeat, double speed)
+{
+    do
+    {
+        // the host receive time is monotonic across every stream, the sdk timestamps are per stream and absent on some
+        const auto start = std::chrono::steady_clock::now();
+        const auto first = index_.front().host;
+        for (const auto& e : index_)
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            if (pacing == Pacing::RealTime)
+            {
+                const auto due = start + std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(e.host - first) / speed));
+                wake_.wait_until(lock, due, [this] { return quit_; });
+            }
+            if (quit_)
+                break;
+            lock.unlock();
+
+            dispatch(e);
+            played_++;
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        if (quit_)
+            break;
+        loops_++;
+    }
+    while (repeat);
+
+    playing_ = false;
+}
+
+/// delivers a single record to its callback
+/// @param[in] e the index entry of the record
+void CinePlayer::dispatch(const IndexEntry& e)
+{
+    if (e.offset + sizeof(RecordHeader) > size_)
+        return;
+
+    RecordHeader rec;
+    std::memcpy(&rec, data_ + e.offset, sizeof(rec));
+    const uint64_t posSize = static_cast<uint64_t>(rec.posCount) * sizeof(CusPosInfo);
+    if (e.offset + sizeof(RecordHeader) + rec.infoSize + posSize + rec.dataSize > size_)
+        return;
+
+    const uchar* info = data_ + e.offset + sizeof(RecordHeader);
+    const uchar* data = info + rec.infoSize + posSize;
+    // positions are copied out since the info struct in front of them is not padded to their alignment
+    pos_.resize(rec.posCount);
+    if (posSize)
+        std::memcpy(pos_.data(), info + rec.infoSize, posSize);
+    const CusPosInfo* pos = rec.posCount ? pos_.data() : nullptr;
+    const int npos = static_cast<int>(rec.posCount);
+
+    // the info structs have to match the sdk headers this application was built against
+    switch (rec.type)
+    {
+    case Processed:
+        if (params_.newProcessedImageFn && rec.infoSize == sizeof(CusProcessedImageInfo))
+        {
+            CusProcessedImageInfo nfo;
+            std::memcpy(&nfo, info, sizeof(nfo));
+            params_.newProcessedImageFn(data, &nfo, npos, pos);
+        }
+        break;
+    case Raw:
+        if (params_.newRawImageFn && rec.infoSize == sizeof(CusRawImageInfo))
+        {
+            CusRawImageInfo nfo;
+            std::memcpy(&nfo, info, sizeof(nfo));
+            params_.newRawImageFn(data, &nfo, npos, pos);
+        }
+        break;
+    case Spectral:
+        if (params_.newSpectralImageFn && rec.infoSize == sizeof(CusSpectralImageInfo))
+        {
+            CusSpectralImageInfo nfo;
+            std::memcpy(&nfo, info, sizeof(nfo));
+            params_.newSpectralImageFn(data, &nfo);
+        }
+        break;
+    case Imu:
+        if (params_.newImuDataFn && pos)
+            params_.newImuDataFn(pos);
+        break;
+    case ImuPacked:
+        if (params_.newImuDataFn && ImuPacker::unpack(data, rec.dataSize, imu_) > 0)
+        {
+            for (const auto& sample : imu_)
+                params_.newImuDataFn(&sample);
+        }
+        break;
+    case Imaging:
+        if (params_.imagingFn && rec.infoSize == sizeof(ImagingInfo))
+        {
+            ImagingInfo nfo;
+            std::memcpy(&nfo, info, sizeof(nfo));
+            params_.imagingFn(static_cast<CusImagingState>(nfo.state), nfo.imaging);
+        }
+        break;
+    default: break;
+    }
+}
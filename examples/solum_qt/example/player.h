@@ -0,0 +1,58 @@
+#pragma once
+
+#include "recorder.h"
+#include <solum/solum.h>
+
+/// replays a capture written by CineRecorder through the same callbacks the sdk uses
+///
+/// the file is mapped once and payloads are handed to the callbacks straight from the mapping, so playback
+/// exercises the consumer pipeline exactly as a live probe would, without any hardware attached
+class CinePlayer
+{
+public:
+    /// playback pacing
+    enum class Pacing
+    {
+        RealTime,   ///< delivers records with the recorded spacing
+        Fast,       ///< delivers records as fast as the callbacks return
+    };
+
+    CinePlayer();
+    ~CinePlayer();
+
+    void setCallbacks(const CusInitParams& params) { params_ = params; }
+    bool open(const QString& path);
+    void close();
+    bool isOpen() const { return data_ != nullptr; }
+
+    bool play(Pacing pacing, bool loop, double speed = 1.0);
+    void stop();
+    bool isPlaying() const { return playing_; }
+
+    uint64_t records() const { return index_.size(); }
+    uint64_t played() const { return played_; }
+    uint64_t loops() const { return loops_; }
+    double duration() const;
+
+private:
+    bool loadIndex();
+    void scanIndex();
+    void loop(Pacing pacing, bool repeat, double speed);
+    void dispatch(const cine::IndexEntry& e);
+
+private:
+    CusInitParams params_;                  ///< callbacks to deliver to
+    std::unique_ptr<QFile> file_;           ///< capture file
+    const uchar* data_;                     ///< mapping of the entire file
+    uint64_t size_;                         ///< size of the file
+    std::vector<cine::IndexEntry> index_;   ///< record index in recorded order
+    std::vector<CusPosInfo> pos_;           ///< aligned copy of the positions of the current record
+    std::vector<CusPosInfo> imu_;           ///< unpacked samples of the current imu block
+    std::mutex lock_;                       ///< protects the stop flag
+    std::condition_variable wake_;          ///< interrupts pacing waits
+    std::thread thread_;                    ///< playback thread
+    bool quit_;                             ///< playback thread shutdown flag
+    std::atomic_bool playing_;              ///< playback state
+    std::atomic<uint64_t> played_;          ///< # of records delivered
+    std::atomic<uint64_t> loops_;           ///< # of completed passes through the file
+};
@@ -0,0 +1,536 @@
+#include "rawpackage.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#define TAR_BLOCK       512
+#define LZO_EXT         ".lzo"
+#define LZOP_MAX_BLOCK  (64 * 1024 * 1024)
+#define LZO_MAX_ZEROS   ((SIZE_MAX / 255) - 2)
+#define RAW_HEADER      (5 * sizeof(int32_t))
+
+// lzop header flags
+#define F_ADLER32_D     0x00000001
+#define F_ADLER32_C     0x00000002
+#define F_H_EXTRA_FIELD 0x00000040
+#define F_CRC32_D       0x00000100
+#define F_CRC32_C       0x00000200
+#define F_H_FILTER      0x00000800
+
+static const uint8_t lzopMagic[] = { 0x89, 'L', 'Z', 'O', 0x00, 0x0d, 0x0a, 0x1a, 0x0a };
+
+namespace
+{
+    /// bounds checked big endian reader for the lzop headers
+    struct Reader
+    {
+        const uint8_t* p;   ///< current position
+        const uint8_t* end; ///< end of the data
+        bool ok;            ///< cleared once a read runs past the end
+
+        bool have(uint64_t n) const { return ok && static_cast<uint64_t>(end - p) >= n; }
+
+        uint32_t be(int n)
+        {
+            uint32_t v = 0;
+            if (!have(static_cast<uint64_t>(n)))
+            {
+                ok = false;
+                return v;
+            }
+            for (auto i = 0; i < n; i++)
+                v = (v << 8) | *p++;
+            return v;
+        }
+
+        void skip(uint64_t n)
+        {
+            if (have(n))
+                p += n;
+            else
+                ok = false;
+        }
+    };
+
+    /// parses a tar octal field, including the gnu base 256 extension used for large members
+    /// @param[in] f the field
+    /// @param[in] n size of the field
+    /// @return the value
+    uint64_t tarNumber(const uint8_t* f, int n)
+    {
+        uint64_t v = 0;
+        if (f[0] & 0x80)
+        {
+            for (auto i = 1; i < n; i++)
+                v = (v << 8) | f[i];
+            return v;
+        }
+
+        for (auto i = 0; i < n && f[i]; i++)
+        {
+            if (f[i] >= '0' && f[i] <= '7')
+                v = (v << 3) | static_cast<uint64_t>(f[i] - '0');
+        }
+        return v;
+    }
+
+    /// reads an lzo length that continues through zero bytes
+    /// @param[in,out] ip the input position
+    /// @param[in] ie the end of the input
+    /// @param[in,out] t the length
+    /// @param[in] base the length the encoding starts from
+    /// @return success of the call
+    bool lzoLength(const uint8_t*& ip, const uint8_t* ie, size_t& t, size_t base)
+    {
+        size_t zeros = 0;
+        while (ip < ie && *ip == 0)
+        {
+            ip++;
+            zeros++;
+        }
+        if (ip >= ie || zeros > LZO_MAX_ZEROS)
+            return false;
+
+        t += (zeros * 255) + base + *ip++;
+        return true;
+    }
+
+    bool endsWith(const std::string& s, const char* suffix)
+    {
+        const auto n = std::strlen(suffix);
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    }
+}
+
+/// default constructor
+/// @param[in] threads # of decompression threads, 0 to use the hardware concurrency
+RawPackage::RawPackage(int threads) : workers_(threads), data_(nullptr), size_(0)
+{
+}
+
+/// destructor
+RawPackage::~RawPackage()
+{
+    close();
+}
+
+/// opens a package, decompressing and indexing all of its members
+/// @param[in] path the package path
+/// @return success of the call
+bool RawPackage::open(const QString& path)
+{
+    close();
+
+    file_ = std::make_unique<QFile>(path);
+    if (!file_->open(QIODevice::ReadOnly) || file_->size() < TAR_BLOCK)
+    {
+        file_.reset();
+        return false;
+    }
+
+    size_ = static_cast<uint64_t>(file_->size());
+    data_ = file_->map(0, file_->size());
+    if (!data_ || !parseTar())
+    {
+        close();
+        return false;
+    }
+
+    // split the compressed members into their blocks so large members are spread across all the threads
+    std::vector<Block> blocks;
+    buffers_.resize(members_.size());
+    for (auto i = 0; i < members(); i++)
+    {
+        auto& m = members_[static_cast<size_t>(i)];
+        if (!endsWith(m.name, LZO_EXT))
+            continue;
+
+        const auto first = blocks.size();
+        if (!parseLzop(i, m.data, m.size, blocks))
+        {
+            close();
+            return false;
+        }
+
+        uint64_t size = 0;
+        for (auto b = first; b < blocks.size(); b++)
+            size += blocks[b].dstSize;
+        auto& buf = buffers_[static_cast<size_t>(i)];
+        buf.resize(size);
+        m.name.resize(m.name.size() - std::strlen(LZO_EXT));
+        m.data = buf.data();
+        m.size = size;
+    }
+
+    std::atomic_bool ok(true);
+    workers_.run(static_cast<int>(blocks.size()), [this, &blocks, &ok](int begin, int end)
+    {
+        for (auto i = begin; i < end && ok; i++)
+        {
+            const auto& b = blocks[static_cast<size_t>(i)];
+            auto dst = buffers_[static_cast<size_t>(b.member)].data() + b.offset;
+            if (b.srcSize == b.dstSize)
+                std::memcpy(dst, b.src, b.dstSize);
+            else if (!lzo1x(b.src, b.srcSize, dst, b.dstSize))
+                ok = false;
+        }
+    });
+    if (!ok)
+    {
+        close();
+        return false;
+    }
+
+    for (auto i = 0; i < members(); i++)
+        indexMember(i);
+    std::stable_sort(index_.begin(), index_.end(), [](const Frame& a, const Frame& b) { return a.tm < b.tm; });
+    return true;
+}
+
+/// closes the package and releases the decompressed data
+void RawPackage::close()
+{
+    if (file_ && data_)
+        file_->unmap(const_cast<uchar*>(data_));
+    data_ = nullptr;
+    size_ = 0;
+    file_.reset();
+    members_.clear();
+    buffers_.clear();
+    index_.clear();
+}
+
+/// finds the frame of a type closest to a timestamp
+/// @param[in] tm the timestamp
+/// @param[in] type the data type
+/// @return the index of the frame, -1 if there are no frames of the type
+int RawPackage::find(int64_t tm, Type type) const
+{
+    auto it = std::lower_bound(index_.begin(), index_.end(), tm, [](const Frame& f, int64_t t) { return f.tm < t; });
+    auto after = it;
+    while (after != index_.end() && after->type != type)
+        ++after;
+    auto before = it;
+    while (before != index_.begin() && (before - 1)->type != type)
+        --before;
+
+    const bool hasAfter = (after != index_.end()), hasBefore = (before != index_.begin());
+    if (!hasAfter && !hasBefore)
+        return -1;
+    if (!hasAfter || (hasBefore && (tm - (before - 1)->tm) <= (after->tm - tm)))
+        return static_cast<int>((before - 1) - index_.begin());
+    return static_cast<int>(after - index_.begin());
+}
+
+/// retrieves the data of a frame
+/// @param[in] f the frame
+/// @param[out] size size of the frame data
+/// @return the frame data, which remains valid until the package is closed
+const uint8_t* RawPackage::frame(const Frame& f, uint64_t& size) const
+{
+    const auto& m = members_[static_cast<size_t>(f.member)];
+    size = m.frameSize - sizeof(int64_t);
+    return m.data + f.offset;
+}
+
+/// lists the regular files in the tarball
+/// @return success of the call
+bool RawPackage::parseTar()
+{
+    std::string longName;
+    uint64_t pos = 0;
+    while (pos + TAR_BLOCK <= size_)
+    {
+        const uint8_t* hdr = data_ + pos;
+        if (!hdr[0])
+            break;
+
+        const auto size = tarNumber(hdr + 124, 12);
+        const auto type = hdr[156];
+        pos += TAR_BLOCK;
+        if (size > size_ - pos)
+            return false;
+
+        if (type == 'L')
+            longName.assign(reinterpret_cast<const char*>(data_ + pos), strnlen(reinterpret_cast<const char*>(data_ + pos), size));
+        else if (type == '0' || type == 0)
+        {
+            Member m;
+            if (!longName.empty())
+                m.name.swap(longName);
+            else
+            {
+                m.name.assign(reinterpret_cast<const char*>(hdr), strnlen(reinterpret_cast<const char*>(hdr), 100));
+                if (std::memcmp(hdr + 257, "ustar", 5) == 0 && hdr[345])
+                    m.name = std::string(reinterpret_cast<const char*>(hdr + 345), strnlen(reinterpret_cast<const char*>(hdr + 345), 155)) + '/' + m.name;
+            }
+            m.type = Type::Other;
+            m.data = data_ + pos;
+            m.size = size;
+            m.frames = m.lines = m.samples = m.sampleSize = 0;
+            m.frameSize = 0;
+            members_.push_back(m);
+        }
+
+        pos += (size + TAR_BLOCK - 1) & ~static_cast<uint64_t>(TAR_BLOCK - 1);
+    }
+
+    return !members_.empty();
+}
+
+/// lists the blocks of an lzop compressed member
+/// @param[in] member the member index
+/// @param[in] p the compressed member
+/// @param[in] size size of the compressed member
+/// @param[out] blocks the list to add the blocks to
+/// @return success of the call
+bool RawPackage::parseLzop(int member, const uint8_t* p, uint64_t size, std::vector<Block>& blocks)
+{
+    if (size < sizeof(lzopMagic) || std::memcmp(p, lzopMagic, sizeof(lzopMagic)) != 0)
+        return false;
+
+    Reader r = { p + sizeof(lzopMagic), p + size, true };
+    const auto version = r.be(2);
+    r.skip(2);
+    if (version >= 0x0940)
+        r.skip(2);
+    const auto method = r.be(1);
+    if (version >= 0x0940)
+        r.skip(1);
+    const auto flags = r.be(4);
+    if (flags & F_H_FILTER)
+        r.skip(4);
+    r.skip((version >= 0x0940) ? 12 : 8);
+    r.skip(r.be(1));
+    r.skip(4);
+    if (flags & F_H_EXTRA_FIELD)
+    {
+        r.skip(r.be(4));
+        r.skip(4);
+    }
+    // all the lzop methods produce lzo1x streams
+    if (!r.ok || method < 1 || method > 3)
+        return false;
+
+    uint64_t offset = 0;
+    for (;;)
+    {
+        const auto dst = r.be(4);
+        if (!r.ok)
+            return false;
+        if (!dst)
+            break;
+
+        const auto src = r.be(4);
+        if (flags & F_ADLER32_D)
+            r.skip(4);
+        if (flags & F_CRC32_D)
+            r.skip(4);
+        if (src < dst)
+        {
+            if (flags & F_ADLER32_C)
+                r.skip(4);
+            if (flags & F_CRC32_C)
+                r.skip(4);
+        }
+        if (!r.have(src) || src > dst || dst > LZOP_MAX_BLOCK)
+            return false;
+
+        blocks.push_back({ r.p, src, dst, member, offset });
+        offset += dst;
+        r.p += src;
+    }
+
+    return true;
+}
+
+/// reads the frame layout of a raw member and adds its frames to the index
+/// @param[in] i the member index
+/// @note raw members hold a header of 5 integers (id, frames, lines, samples, sample size) followed by each frame's timestamp and data
+void RawPackage::indexMember(int i)
+{
+    auto& m = members_[static_cast<size_t>(i)];
+    if (endsWith(m.name, "_env.raw"))
+        m.type = Type::Env;
+    else if (endsWith(m.name, "_iq.raw"))
+        m.type = Type::Iq;
+    else if (endsWith(m.name, "_rf.raw"))
+        m.type = Type::Rf;
+    else
+        return;
+
+    int32_t hdr[5];
+    if (m.size < RAW_HEADER)
+    {
+        m.type = Type::Other;
+        return;
+    }
+    std::memcpy(hdr, m.data, sizeof(hdr));
+    const uint64_t frameBytes = static_cast<uint64_t>(std::max(hdr[2], 0)) * static_cast<uint64_t>(std::max(hdr[3], 0)) * static_cast<uint64_t>(std::max(hdr[4], 0));
+    if (hdr[1] <= 0 || !frameBytes)
+    {
+        m.type = Type::Other;
+        return;
+    }
+
+    // iq members carry two values per sample, so take the stride from the member size rather than the header
+    const uint64_t stride = (m.size - RAW_HEADER) / static_cast<uint64_t>(hdr[1]);
+    if (stride < sizeof(int64_t) + frameBytes)
+    {
+        m.type = Type::Other;
+        return;
+    }
+
+    m.frames = hdr[1];
+    m.lines = hdr[2];
+    m.samples = hdr[3];
+    m.sampleSize = hdr[4];
+    m.frameSize = stride;
+    for (auto f = 0; f < m.frames; f++)
+    {
+        const uint64_t offset = RAW_HEADER + (static_cast<uint64_t>(f) * stride);
+        int64_t tm;
+        std::memcpy(&tm, m.data + offset, sizeof(tm));
+        index_.push_back({ tm, i, offset + sizeof(int64_t), m.type });
+    }
+}
+
+/// decompresses an lzo1x stream
+/// @param[in] src the compressed data
+/// @param[in] srcSize size of the compressed data
+/// @param[out] dst the output buffer
+/// @param[in] dstSize the exact decompressed size
+/// @return success of the call, false if the stream is corrupt or doesn't decompress to exactly the output size
+/// @note every read and write is bounds checked, matches that don't overlap their output are copied a word at a time
+bool RawPackage::lzo1x(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+#define NEED_IP(n) if (static_cast<size_t>(ie - ip) < static_cast<size_t>(n)) return false
+#define NEED_OP(n) if (static_cast<size_t>(oe - op) < static_cast<size_t>(n)) return false
+
+    const uint8_t* ip = src;
+    const uint8_t* const ie = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* const oe = dst + dstSize;
+    size_t t, next, dist, state = 0;
+
+    NEED_IP(3);
+    if (*ip > 17)
+    {
+        t = *ip++ - 17u;
+        NEED_IP(t + 3);
+        NEED_OP(t);
+        std::memcpy(op, ip, t);
+        op += t;
+        ip += t;
+        state = (t < 4) ? t : 4;
+    }
+
+    for (;;)
+    {
+        NEED_IP(1);
+        t = *ip++;
+        if (t < 16)
+        {
+            if (state == 0)
+            {
+                // literal run
+                if (t == 0 && !lzoLength(ip, ie, t, 15))
+                    return false;
+                t += 3;
+                NEED_IP(t + 3);
+                NEED_OP(t);
+                std::memcpy(op, ip, t);
+                op += t;
+                ip += t;
+                state = 4;
+                continue;
+            }
+
+            NEED_IP(1);
+            next = t & 3;
+            if (state != 4)
+            {
+                // 2 byte match within the last 1 kB, following a short literal run
+                dist = 1 + (t >> 2) + (static_cast<size_t>(*ip++) << 2);
+                t = 2;
+            }
+            else
+            {
+                // 3 byte match between 2 and 3 kB back, following a long literal run
+                dist = 1 + 0x800 + (t >> 2) + (static_cast<size_t>(*ip++) << 2);
+                t = 3;
+            }
+        }
+        else if (t >= 64)
+        {
+            // 3 to 8 byte match within the last 2 kB
+            NEED_IP(1);
+            next = t & 3;
+            dist = 1 + ((t >> 2) & 7) + (static_cast<size_t>(*ip++) << 3);
+            t = (t >> 5) + 1;
+        }
+        else if (t >= 32)
+        {
+            // match within the last 16 kB
+            t = (t & 31) + 2;
+            if (t == 2 && !lzoLength(ip, ie, t, 31))
+                return false;
+            NEED_IP(2);
+            const size_t v = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+            dist = 1 + (v >> 2);
+            next = v & 3;
+        }
+        else
+        {
+            // match 16 to 48 kB back, or the end of the stream
+            dist = (t & 8) << 11;
+            t = (t & 7) + 2;
+            if (t == 2 && !lzoLength(ip, ie, t, 7))
+                return false;
+            NEED_IP(2);
+            const size_t v = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+            dist += v >> 2;
+            next = v & 3;
+            if (!dist)
+                return (t == 3 && ip == ie && op == oe);
+            dist += 0x4000;
+        }
+
+        if (dist > static_cast<size_t>(op - dst))
+            return false;
+        NEED_OP(t);
+        const uint8_t* m = op - dist;
+        if (dist >= t)
+        {
+            std::memcpy(op, m, t);
+            op += t;
+        }
+        else
+        {
+            // overlapping match, word copies are safe as long as each one reads output that's already written
+            if (dist >= 8)
+            {
+                for (; t >= 8; t -= 8, op += 8, m += 8)
+                    std::memcpy(op, m, 8);
+            }
+            while (t--)
+                *op++ = *m++;
+        }
+
+        // up to 3 literals follow a match
+        state = next;
+        if (next)
+        {
+            NEED_IP(next + 3);
+            NEED_OP(next);
+            std::memcpy(op, ip, next);
+            op += next;
+            ip += next;
+        }
+    }
+
+#undef NEED_IP
+#undef NEED_OP
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "workers.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// opens a raw data package downloaded with solumRequestRawData and indexes every frame in it
+///
+/// the package is a tarball whose members are either stored or lzop compressed, compressed members are split into
+/// their lzop blocks and all the blocks of all the members are decompressed in parallel, stored members are used
+/// straight from the mapping, and the frames of every raw member are merged into a single index ordered by timestamp
+class RawPackage
+{
+public:
+    /// member data type, as named in the package
+    enum class Type
+    {
+        Env,    ///< envelope (b) data
+        Iq,     ///< iq data
+        Rf,     ///< rf data
+        Other,  ///< metadata, tgc, etc.
+    };
+
+    /// package member
+    struct Member
+    {
+        std::string name;       ///< name within the package, without the .lzo extension
+        Type type;              ///< data type
+        const uint8_t* data;    ///< decompressed contents
+        uint64_t size;          ///< decompressed size
+        int frames;             ///< # of frames for raw members, 0 otherwise
+        int lines;              ///< # of lines per frame
+        int samples;            ///< # of samples per line
+        int sampleSize;         ///< size of each sample in bytes
+        uint64_t frameSize;     ///< stride between frames, including the timestamp
+    };
+
+    /// frame index entry
+    struct Frame
+    {
+        int64_t tm;         ///< frame timestamp
+        int member;         ///< member holding the frame
+        uint64_t offset;    ///< offset of the frame data within the member
+        Type type;          ///< data type
+    };
+
+    explicit RawPackage(int threads = 0);
+    ~RawPackage();
+
+    RawPackage(const RawPackage&) = delete;
+    RawPackage& operator=(const RawPackage&) = delete;
+
+    bool open(const QString& path);
+    void close();
+    bool isOpen() const { return data_ != nullptr; }
+
+    int members() const { return static_cast<int>(members_.size()); }
+    const Member& member(int i) const { return members_[static_cast<size_t>(i)]; }
+    const std::vector<Frame>& frames() const { return index_; }
+    int find(int64_t tm, Type type) const;
+    const uint8_t* frame(const Frame& f, uint64_t& size) const;
+
+    static bool lzo1x(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+private:
+    /// compressed block to decode
+    struct Block
+    {
+        const uint8_t* src;     ///< compressed data
+        uint32_t srcSize;       ///< compressed size
+        uint32_t dstSize;       ///< decompressed size
+        int member;             ///< member the block belongs to
+        uint64_t offset;        ///< offset of the block within the decompressed member
+    };
+
+    bool parseTar();
+    bool parseLzop(int member, const uint8_t* p, uint64_t size, std::vector<Block>& blocks);
+    void indexMember(int i);
+
+private:
+    Workers workers_;                               ///< decompression threads
+    std::unique_ptr<QFile> file_;                   ///< package file
+    const uchar* data_;                             ///< mapping of the package
+    uint64_t size_;                                 ///< size of the package
+    std::vector<Member> members_;                   ///< package members
+    std::vector<std::vector<uint8_t>> buffers_;     ///< decompressed member contents
+    std::vector<Frame> index_;                      ///< all frames ordered by timestamp
+};
@@ -0,0 +1,475 @@
+#include "recorder.h"
+#include <chrono>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#define CINE_PAGE       4096
+#define MIN_CHUNK       (1024 * 1024)
+#define INDEX_BLOCK     (64 * 1024)     // index entries per block, 2 MB
+#define INDEX_BLOCKS    1024            // block pointers reserved up front, enough for 64M records
+#define SYNC_INTERVAL   std::chrono::seconds(1)
+#define WAKE_INTERVAL   std::chrono::milliseconds(100)
+
+using namespace cine;
+
+/// retrieves the steady clock time used for the host receive times
+/// @return the time in nanoseconds
+int64_t CineRecorder::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// rounds a size up to the record alignment
+/// @param[in] sz the size to align
+/// @return the aligned size
+static uint64_t align(uint64_t sz)
+{
+    return (sz + CINE_ALIGN - 1) & ~static_cast<uint64_t>(CINE_ALIGN - 1);
+}
+
+/// default constructor
+CineRecorder::CineRecorder() : open_(false), blocking_(false), quit_(false), chunkSize_(0), chunk_(0), used_(0), current_(nullptr), next_(nullptr),
+    indexed_(0), start_(0), records_(0), dropped_(0), written_(0), imuFormat_(ImuFormat::Double), imuHost_(0)
+{
+    std::memset(frames_, 0, sizeof(frames_));
+    imuPending_.reserve(IMU_BATCH_MAX);
+}
+
+/// destructor
+CineRecorder::~CineRecorder()
+{
+    close();
+}
+
+/// creates a new capture file and starts recording
+/// @param[in] path the file to create
+/// @param[in] chunkSize the size of each mapped chunk, rounded up to a multiple of the page size
+/// @return success of the call
+bool CineRecorder::open(const QString& path, uint32_t chunkSize)
+{
+    if (open_)
+        return false;
+
+    chunkSize_ = std::max<uint32_t>(MIN_CHUNK, (chunkSize + CINE_PAGE - 1) & ~static_cast<uint32_t>(CINE_PAGE - 1));
+    file_ = std::make_unique<QFile>(path);
+    if (!file_->open(QIODevice::ReadWrite | QIODevice::Truncate))
+    {
+        file_.reset();
+        return false;
+    }
+
+    current_ = mapChunk(0);
+    if (!current_)
+    {
+        file_->close();
+        file_.reset();
+        return false;
+    }
+
+    FileHeader hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, CINE_MAGIC, sizeof(CINE_MAGIC));
+    hdr.version = CINE_VERSION;
+    hdr.chunkSize = chunkSize_;
+    hdr.created = QDateTime::currentMSecsSinceEpoch();
+    std::memcpy(current_, &hdr, sizeof(hdr));
+
+    chunk_ = 0;
+    used_ = sizeof(FileHeader);
+    next_ = nullptr;
+    retired_.clear();
+    index_.clear();
+    index_.reserve(INDEX_BLOCKS);
+    index_.push_back(std::make_unique<IndexEntry[]>(INDEX_BLOCK));
+    indexSpare_.reset();
+    indexed_ = 0;
+    std::memset(frames_, 0, sizeof(frames_));
+    records_ = 0;
+    dropped_ = 0;
+    written_ = 0;
+    start_ = now();
+    quit_ = false;
+    {
+        // samples left from a previous recording would carry a host time relative to its start
+        std::lock_guard<std::mutex> lock(imuLock_);
+        imuPending_.clear();
+        imuHost_ = 0;
+    }
+    open_ = true;
+    thread_ = std::thread(&CineRecorder::loop, this);
+    return true;
+}
+
+/// stops recording, writes the index and finalizes the file
+/// @return success of the call
+bool CineRecorder::close()
+{
+    if (!file_)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(imuLock_);
+        flushImu();
+    }
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        open_ = false;
+        quit_ = true;
+    }
+    {
+        // an imu() call already past the open check may have queued a sample after the flush above
+        std::lock_guard<std::mutex> lock(imuLock_);
+        imuPending_.clear();
+    }
+    wake_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+
+    // every view has to be gone before the file can be truncated
+    for (auto mem : retired_)
+        flushChunk(mem, true);
+    retired_.clear();
+    if (next_)
+        file_->unmap(next_);
+    next_ = nullptr;
+    flushChunk(current_, true);
+    current_ = nullptr;
+
+    const auto end = (chunk_ * chunkSize_) + used_;
+    bool ok = file_->resize(static_cast<qint64>(end)) && file_->seek(static_cast<qint64>(end));
+    if (ok)
+    {
+        Footer footer;
+        std::memcpy(footer.magic, CINE_INDEX, sizeof(footer.magic));
+        footer.count = indexed_;
+        footer.offset = end;
+        for (uint64_t i = 0; ok && i < indexed_; i += INDEX_BLOCK)
+        {
+            const auto sz = static_cast<qint64>(std::min<uint64_t>(INDEX_BLOCK, indexed_ - i) * sizeof(IndexEntry));
+            ok = (file_->write(reinterpret_cast<const char*>(index_[i / INDEX_BLOCK].get()), sz) == sz);
+        }
+        ok = ok && (file_->write(reinterpret_cast<const char*>(&footer), sizeof(footer)) == sizeof(footer));
+        file_->flush();
+        syncFile();
+    }
+
+    file_->close();
+    file_.reset();
+    index_.clear();
+    index_.shrink_to_fit();
+    indexSpare_.reset();
+    indexed_ = 0;
+    return ok;
+}
+
+/// records a processed image
+/// @param[in] img the image data straight from the sdk
+/// @param[in] nfo the image information
+/// @param[in] npos # of positions tagged with the image
+/// @param[in] pos the positions
+/// @param[in] host the steady clock receive time, negative to use the current time
+void CineRecorder::processed(const void* img, const CusProcessedImageInfo* nfo, int npos, const CusPosInfo* pos, int64_t host)
+{
+    if (!open_ || !nfo)
+        return;
+
+    append(Processed, nfo->tm, nfo, sizeof(*nfo), pos, npos, img, static_cast<uint32_t>(std::max(0, nfo->imageSize)), host);
+}
+
+/// records a raw image
+/// @param[in] img the raw data straight from the sdk
+/// @param[in] nfo the raw image information
+/// @param[in] npos # of positions tagged with the image
+/// @param[in] pos the positions
+/// @param[in] host the steady clock receive time, negative to use the current time
+void CineRecorder::raw(const void* img, const CusRawImageInfo* nfo, int npos, const CusPosInfo* pos, int64_t host)
+{
+    if (!open_ || !nfo)
+        return;
+
+    auto sz = nfo->jpeg ? nfo->jpeg : (nfo->lines * nfo->samples * (nfo->bitsPerSample / 8));
+    append(Raw, nfo->tm, nfo, sizeof(*nfo), pos, npos, img, static_cast<uint32_t>(std::max(0, sz)), host);
+}
+
+/// records a spectral block
+/// @param[in] img the spectral data straight from the sdk
+/// @param[in] nfo the spectral information
+/// @note spectral blocks carry no timestamp, only the host receive time is stored
+void CineRecorder::spectral(const void* img, const CusSpectralImageInfo* nfo)
+{
+    if (!open_ || !nfo)
+        return;
+
+    auto sz = nfo->lines * nfo->samples * (nfo->bitsPerSample / 8);
+    append(Spectral, 0, nfo, sizeof(*nfo), nullptr, 0, img, static_cast<uint32_t>(std::max(0, sz)), -1);
+}
+
+/// sets the encoding of recorded imu samples, any samples pending in the previous encoding are written first
+/// @param[in] format the encoding
+void CineRecorder::setImuFormat(ImuFormat format)
+{
+    std::lock_guard<std::mutex> lock(imuLock_);
+    flushImu();
+    imuFormat_ = format;
+}
+
+/// records a streamed imu sample
+/// @param[in] pos the imu sample
+/// @param[in] host the steady clock receive time, negative to use the current time
+/// @note packed samples are held until a block spans the batch interval or is full, the block carries the receive time of its first sample
+void CineRecorder::imu(const CusPosInfo* pos, int64_t host)
+{
+    if (!open_ || !pos)
+        return;
+
+    std::lock_guard<std::mutex> lock(imuLock_);
+    if (imuFormat_ == ImuFormat::Double)
+    {
+        append(Imu, pos->tm, nullptr, 0, pos, 1, nullptr, 0, host);
+        return;
+    }
+
+    if (!imuPending_.empty() && (pos->tm < imuPending_.front().tm || pos->tm - imuPending_.front().tm > IMU_BATCH_SPAN))
+        flushImu();
+    if (imuPending_.empty())
+        imuHost_ = (host < 0) ? now() : host;
+    imuPending_.push_back(*pos);
+    if (imuPending_.size() >= IMU_BATCH_MAX)
+        flushImu();
+}
+
+/// writes the pending imu samples as a packed block, called with the imu lock held
+void CineRecorder::flushImu()
+{
+    if (imuPending_.empty())
+        return;
+
+    imuBlock_.clear();
+    if (ImuPacker::pack(imuPending_.data(), static_cast<int>(imuPending_.size()), imuFormat_, imuBlock_) > 0)
+        append(ImuPacked, imuPending_.front().tm, nullptr, 0, nullptr, 0, imuBlock_.data(), static_cast<uint32_t>(imuBlock_.size()), imuHost_);
+    imuPending_.clear();
+}
+
+/// records an imaging state change
+/// @param[in] state the imaging state
+/// @param[in] imaging the running flag
+void CineRecorder::imaging(CusImagingState state, int imaging)
+{
+    if (!open_)
+        return;
+
+    ImagingInfo nfo = { static_cast<int32_t>(state), static_cast<int32_t>(imaging) };
+    append(Imaging, 0, &nfo, sizeof(nfo), nullptr, 0, nullptr, 0, -1);
+}
+
+/// appends a record to the current chunk
+/// @param[in] type the record type
+/// @param[in] tm the record timestamp
+/// @param[in] info the info struct
+/// @param[in] infoSize size of the info struct
+/// @param[in] pos the positions
+/// @param[in] npos # of positions
+/// @param[in] data the payload
+/// @param[in] dataSize size of the payload
+/// @param[in] host the steady clock receive time, negative to use the current time
+/// @return success of the call, false if the record was dropped
+bool CineRecorder::append(RecordType type, int64_t tm, const void* info, uint32_t infoSize, const CusPosInfo* pos, int npos,
+    const void* data, uint32_t dataSize, int64_t host)
+{
+    const auto posSize = static_cast<uint64_t>((pos && npos > 0) ? npos : 0) * sizeof(CusPosInfo);
+    const auto raw = sizeof(RecordHeader) + infoSize + posSize + (data ? dataSize : 0);
+    const auto total = align(raw);
+    if (total > chunkSize_ - sizeof(FileHeader))
+    {
+        dropped_++;
+        return false;
+    }
+
+    if (host < 0)
+        host = now();
+    std::unique_lock<std::mutex> lock(lock_);
+    if (!open_)
+        return false;
+
+    if (used_ + total > chunkSize_)
+    {
+        if (!next_ && blocking_)
+        {
+            wake_.notify_one();
+            ready_.wait_for(lock, std::chrono::seconds(1), [this] { return next_ || !open_; });
+            if (!open_)
+                return false;
+        }
+        // streaming never waits for the disk, drop the record if the next chunk isn't mapped yet
+        if (!next_)
+        {
+            dropped_++;
+            wake_.notify_one();
+            return false;
+        }
+
+        if (chunkSize_ - used_ >= sizeof(RecordHeader))
+        {
+            RecordHeader pad;
+            std::memset(&pad, 0, sizeof(pad));
+            pad.type = Pad;
+            pad.size = chunkSize_ - used_;
+            std::memcpy(current_ + used_, &pad, sizeof(pad));
+        }
+        retired_.push_back(current_);
+        current_ = next_;
+        next_ = nullptr;
+        chunk_++;
+        used_ = 0;
+        wake_.notify_one();
+    }
+
+    RecordHeader hdr;
+    hdr.type = type;
+    hdr.size = static_cast<uint32_t>(total);
+    hdr.tm = tm;
+    hdr.host = host - start_;
+    hdr.frame = frames_[type]++;
+    hdr.infoSize = infoSize;
+    hdr.posCount = static_cast<uint32_t>(posSize / sizeof(CusPosInfo));
+    hdr.dataSize = data ? dataSize : 0;
+
+    uchar* dst = current_ + used_;
+    std::memcpy(dst, &hdr, sizeof(hdr));
+    dst += sizeof(hdr);
+    if (infoSize)
+    {
+        std::memcpy(dst, info, infoSize);
+        dst += infoSize;
+    }
+    if (posSize)
+    {
+        std::memcpy(dst, pos, posSize);
+        dst += posSize;
+    }
+    if (hdr.dataSize)
+    {
+        std::memcpy(dst, data, hdr.dataSize);
+        dst += hdr.dataSize;
+    }
+    if (total > raw)
+        std::memset(dst, 0, total - raw);
+
+    // the index grows a block at a time, taking the spare the background thread allocated so nothing is copied here
+    if (indexed_ == index_.size() * INDEX_BLOCK)
+    {
+        index_.push_back(indexSpare_ ? std::move(indexSpare_) : std::make_unique<IndexEntry[]>(INDEX_BLOCK));
+        wake_.notify_all();
+    }
+    index_[indexed_ / INDEX_BLOCK][indexed_ % INDEX_BLOCK] = { hdr.tm, hdr.host, (chunk_ * chunkSize_) + used_, type, hdr.frame };
+    indexed_++;
+    used_ += static_cast<uint32_t>(total);
+    records_++;
+    written_ += total;
+    return true;
+}
+
+/// background thread that maps chunks ahead of the writer, flushes filled chunks and syncs the file
+void CineRecorder::loop()
+{
+    std::vector<uchar*> flush;
+    auto synced = std::chrono::steady_clock::now();
+    bool failed = false;
+
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!quit_)
+    {
+        if (!next_)
+        {
+            const auto index = chunk_ + 1;
+            lock.unlock();
+            auto mem = mapChunk(index);
+            // touch every page now so the writer never takes a page fault that waits on the disk
+            if (mem)
+                for (uint32_t i = 0; i < chunkSize_; i += CINE_PAGE)
+                    mem[i] = 0;
+            lock.lock();
+            failed = (mem == nullptr);
+            next_ = mem;
+            ready_.notify_all();
+        }
+
+        if (!indexSpare_)
+        {
+            lock.unlock();
+            auto block = std::make_unique<IndexEntry[]>(INDEX_BLOCK);
+            lock.lock();
+            indexSpare_ = std::move(block);
+        }
+
+        if (!retired_.empty())
+        {
+            flush.swap(retired_);
+            lock.unlock();
+            for (auto mem : flush)
+                flushChunk(mem, true);
+            flush.clear();
+            lock.lock();
+        }
+
+        if (std::chrono::steady_clock::now() - synced >= SYNC_INTERVAL)
+        {
+            lock.unlock();
+            syncFile();
+            synced = std::chrono::steady_clock::now();
+            lock.lock();
+        }
+
+        wake_.wait_for(lock, WAKE_INTERVAL, [this, failed] { return quit_ || (!next_ && !failed) || !retired_.empty() || !indexSpare_; });
+    }
+}
+
+/// grows the file to hold a chunk and maps it
+/// @param[in] index the chunk index
+/// @return the mapped memory, null on failure
+uchar* CineRecorder::mapChunk(uint64_t index)
+{
+    const auto offset = static_cast<qint64>(index * chunkSize_);
+    if (file_->size() < offset + chunkSize_ && !file_->resize(offset + chunkSize_))
+        return nullptr;
+
+    return file_->map(offset, chunkSize_);
+}
+
+/// writes a mapped chunk back to the file and unmaps it
+/// @param[in] mem the mapped chunk
+/// @param[in] sync flag to wait for the data to reach the disk before unmapping
+void CineRecorder::flushChunk(uchar* mem, bool sync)
+{
+    if (!mem)
+        return;
+
+#ifdef Q_OS_WIN
+    if (sync)
+        FlushViewOfFile(mem, chunkSize_);
+#else
+    if (sync)
+        msync(mem, chunkSize_, MS_SYNC);
+#endif
+    file_->unmap(mem);
+}
+
+/// flushes the file contents and metadata to the disk
+void CineRecorder::syncFile()
+{
+    if (!file_ || file_->handle() < 0)
+        return;
+
+#ifdef Q_OS_WIN
+    FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file_->handle())));
+#else
+    fsync(file_->handle());
+#endif
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "imu.h"
+#include <solum/solum_def.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CINE_MAGIC      "CUSCINE"
+#define CINE_INDEX      "CUSINDEX"
+#define CINE_VERSION    1
+#define CINE_ALIGN      8
+
+namespace cine
+{
+    /// record types stored in a capture file
+    enum RecordType : uint32_t
+    {
+        Pad,        ///< filler up to the end of a chunk
+        Processed,  ///< processed image, info is CusProcessedImageInfo
+        Raw,        ///< raw image, info is CusRawImageInfo
+        Spectral,   ///< spectral block, info is CusSpectralImageInfo
+        Imu,        ///< streamed imu sample, no info and a single position
+        Imaging,    ///< imaging state change, info is ImagingInfo
+        ImuPacked,  ///< block of streamed imu samples, payload is an ImuBlock followed by the packed samples
+    };
+
+    /// file header, the first record starts right after it
+    struct FileHeader
+    {
+        char magic[8];          ///< CINE_MAGIC
+        uint32_t version;       ///< CINE_VERSION
+        uint32_t chunkSize;     ///< size of each chunk, records never straddle chunks
+        int64_t created;        ///< creation time in milliseconds since epoch
+        uint8_t reserved[40];   ///< reserved for future use
+    };
+
+    /// header placed in front of every record, followed by the info struct, positions and payload
+    struct RecordHeader
+    {
+        uint32_t type;          ///< record type
+        uint32_t size;          ///< total record size including this header and alignment padding
+        int64_t tm;             ///< timestamp from the info struct or position in nanoseconds, 0 if the stream has none
+        int64_t host;           ///< host receive time in nanoseconds relative to the start of the recording, negative for buffered data
+        uint32_t frame;         ///< sequence number of the record within its type
+        uint32_t infoSize;      ///< size of the info struct
+        uint32_t posCount;      ///< # of CusPosInfo entries
+        uint32_t dataSize;      ///< size of the payload
+    };
+
+    /// imaging state info
+    struct ImagingInfo
+    {
+        int32_t state;          ///< CusImagingState
+        int32_t imaging;        ///< running flag
+    };
+
+    /// index entry, the index is written as an array at the end of the file followed by the footer
+    struct IndexEntry
+    {
+        int64_t tm;             ///< record timestamp
+        int64_t host;           ///< host receive time, monotonic across all records
+        uint64_t offset;        ///< file offset of the record header
+        uint32_t type;          ///< record type
+        uint32_t frame;         ///< sequence number within the type
+    };
+
+    /// footer at the very end of a finalized file
+    struct Footer
+    {
+        char magic[8];          ///< CINE_INDEX
+        uint64_t count;         ///< # of index entries
+        uint64_t offset;        ///< file offset of the first index entry
+    };
+}
+
+/// append-only capture of every callback payload into a chunked memory-mapped file
+///
+/// records are copied straight from the sdk buffers into the mapped chunk, the next chunk is mapped and pre-faulted ahead of time
+/// and finished chunks are flushed on a background thread, so the callbacks never wait on the disk; when the next chunk is
+/// not ready in time the record is dropped and counted instead
+class CineRecorder
+{
+public:
+    CineRecorder();
+    ~CineRecorder();
+
+    bool open(const QString& path, uint32_t chunkSize = 64 * 1024 * 1024);
+    bool close();
+    bool isOpen() const { return open_; }
+    void setBlocking(bool blocking) { blocking_ = blocking; }
+    void setImuFormat(ImuFormat format);
+
+    void processed(const void* img, const CusProcessedImageInfo* nfo, int npos, const CusPosInfo* pos, int64_t host = -1);
+    void raw(const void* img, const CusRawImageInfo* nfo, int npos, const CusPosInfo* pos, int64_t host = -1);
+    void spectral(const void* img, const CusSpectralImageInfo* nfo);
+    void imu(const CusPosInfo* pos, int64_t host = -1);
+
+    static int64_t now();
+    void imaging(CusImagingState state, int imaging);
+
+    uint64_t records() const { return records_; }
+    uint64_t dropped() const { return dropped_; }
+    uint64_t bytes() const { return written_; }
+
+private:
+    bool append(cine::RecordType type, int64_t tm, const void* info, uint32_t infoSize, const CusPosInfo* pos, int npos, const void* data, uint32_t dataSize,
+        int64_t host);
+    void loop();
+    uchar* mapChunk(uint64_t index);
+    void flushChunk(uchar* mem, bool sync);
+    void syncFile();
+    void flushImu();
+
+private:
+    std::unique_ptr<QFile> file_;               ///< capture file
+    std::atomic_bool open_;                     ///< recording state, checked before taking the lock
+    std::mutex lock_;                           ///< protects the write position and chunk hand-over
+    std::condition_variable wake_;              ///< wakes the background thread
+    std::condition_variable ready_;             ///< signals that the next chunk is mapped
+    std::atomic_bool blocking_;                 ///< wait for the next chunk instead of dropping, for bulk writes
+    std::thread thread_;                        ///< chunk preparation and flushing thread
+    bool quit_;                                 ///< background thread shutdown flag
+    uint32_t chunkSize_;                        ///< size of each chunk
+    uint64_t chunk_;                            ///< index of the chunk being written
+    uint32_t used_;                             ///< bytes used within the current chunk
+    uchar* current_;                            ///< mapped chunk being written
+    uchar* next_;                               ///< pre-mapped next chunk, null until ready
+    std::vector<uchar*> retired_;               ///< filled chunks waiting to be flushed and unmapped
+    std::vector<std::unique_ptr<cine::IndexEntry[]>> index_;  ///< index of all records in fixed size blocks, never copied as it grows
+    std::unique_ptr<cine::IndexEntry[]> indexSpare_;        ///< next index block, allocated ahead by the background thread
+    uint64_t indexed_;                          ///< # of index entries
+    uint32_t frames_[cine::ImuPacked + 1];      ///< per type sequence counters
+    int64_t start_;                             ///< steady clock time the recording started
+    std::atomic<uint64_t> records_;             ///< # of records written
+    std::atomic<uint64_t> dropped_;             ///< # of records dropped
+    std::atomic<uint64_t> written_;             ///< # of bytes written
+    std::mutex imuLock_;                        ///< protects the pending imu samples
+    ImuFormat imuFormat_;                       ///< encoding of recorded imu samples, double writes one record per sample
+    std::vector<CusPosInfo> imuPending_;        ///< imu samples waiting to be packed into a block
+    std::vector<uint8_t> imuBlock_;             ///< packing buffer
+    int64_t imuHost_;                           ///< receive time of the first pending sample
+};
@@ -0,0 +1,805 @@
+#include "simulator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#define PI              3.14159265358979323846
+#define SOUND_SPEED     1540.0
+#define GRID_RES        0.2     // phantom resolution in mm
+#define GRID_WIDTH      180.0   // phantom width in mm, centered on the probe
+#define GRID_DEPTH      320.0   // phantom depth in mm
+#define GRID_MARGIN     8       // extra columns on either side to absorb the simulated motion
+#define LINEAR_WIDTH    38.0    // linear array aperture in mm
+#define CONVEX_RADIUS   45.0    // convex array radius in mm
+#define CONVEX_FOV      1.22    // convex field of view in radians
+#define ATTENUATION     0.3     // residual attenuation after tgc in db/cm
+#define PW_SCATTERERS   16
+#define M_LINES         4       // m mode lines per frame
+#define M_SAMPLES       256     // samples per m mode line
+#define RF_LINES        64      // rf lines per frame
+#define RF_MAX_SAMPLES  4096
+#define MAX_IMU         64      // imu samples tagged onto a single frame
+
+/// retrieves the steady clock time
+/// @return the time in nanoseconds
+static int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// retrieves the simulated transmit frequency
+/// @param[in] convex the probe geometry
+/// @return the center frequency in hz
+static double frequency(bool convex)
+{
+    return convex ? 3.5e6 : 7.5e6;
+}
+
+/// rotates a vector into the frame of a quaternion (by its conjugate)
+/// @param[in] w,x,y,z the quaternion
+/// @param[in,out] v the vector to rotate
+static void rotateInverse(double w, double x, double y, double z, double v[3])
+{
+    x = -x;
+    y = -y;
+    z = -z;
+    // t = 2 * cross(q.xyz, v), v' = v + w * t + cross(q.xyz, t)
+    const double tx = 2.0 * ((y * v[2]) - (z * v[1]));
+    const double ty = 2.0 * ((z * v[0]) - (x * v[2]));
+    const double tz = 2.0 * ((x * v[1]) - (y * v[0]));
+    v[0] += (w * tx) + ((y * tz) - (z * ty));
+    v[1] += (w * ty) + ((z * tx) - (x * tz));
+    v[2] += (w * tz) + ((x * ty) - (y * tx));
+}
+
+/// default constructor
+Simulator::Simulator() : quit_(false), connected_(false), loaded_(false), running_(false), frames_(0), start_(0), seed_(0x2545F491u),
+    cols_(0), rows_(0), micronsPerPixel_(0), pwCarry_(0), pwPrf_(0), pwGain_(0)
+{
+    std::memset(&params_, 0, sizeof(params_));
+    state_.width = 640;
+    state_.height = 480;
+    state_.fps = 30.0;
+    state_.imuRate = 100.0;
+    state_.convex = false;
+    state_.mode = BMode;
+    state_.format = Uncompressed;
+    state_.params.fill(0);
+    state_.params[ImageDepth] = 4.0;
+    state_.params[Gain] = 50.0;
+    state_.params[DynamicRange] = 50.0;
+    state_.params[ColorGain] = 50.0;
+    state_.params[ColorPrf] = 4.0;
+    state_.params[PwGain] = 50.0;
+    state_.params[PwPrf] = 4.0;
+    state_.params[RfStreaming] = 1.0;
+    mapped_ = state_;
+    mapped_.width = 0;
+    for (auto i = 0; i < PW_SCATTERERS; i++)
+    {
+        pwPhase_[i] = 2.0 * PI * (noise() & 0xFFFF) / 65536.0;
+        pwSpeed_[i] = static_cast<float>(noise() & 0xFFFF) / 65536.0f;
+    }
+}
+
+/// destructor
+Simulator::~Simulator()
+{
+    disconnect();
+}
+
+/// sets the callbacks to deliver to, typically the same parameters passed to solumInit
+/// @param[in] params the callbacks
+void Simulator::setCallbacks(const CusInitParams& params)
+{
+    params_ = params;
+    if (params.width > 0 && params.height > 0)
+        setOutputSize(params.width, params.height);
+    spectral_.setCallback(params.newSpectralImageFn);
+}
+
+/// simulates a probe connection and starts the generator thread
+/// @return success of the call
+bool Simulator::connect()
+{
+    if (connected_)
+        return false;
+
+    if (echo_.empty())
+        buildPhantom();
+
+    start_ = now();
+    frames_ = 0;
+    quit_ = false;
+    connected_ = true;
+    thread_ = std::thread(&Simulator::loop, this);
+    if (params_.connectFn)
+        params_.connectFn(ProbeConnected, 0, "simulator");
+    return true;
+}
+
+/// simulates a probe disconnection
+/// @return success of the call
+bool Simulator::disconnect()
+{
+    if (!connected_)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        quit_ = true;
+    }
+    wake_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+
+    connected_ = false;
+    loaded_ = false;
+    running_ = false;
+    if (params_.connectFn)
+        params_.connectFn(ProbeDisconnected, 0, "simulator");
+    return true;
+}
+
+/// loads an application, convex and phased array models get a sector geometry and a deeper default depth
+/// @param[in] probe the probe model
+/// @param[in] application the application name, only used for reporting
+/// @return success of the call
+bool Simulator::loadApplication(const char* probe, const char* application)
+{
+    (void)application;
+    if (!connected_ || !probe)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        probe_ = probe;
+        state_.convex = (probe_[0] == 'C' || probe_[0] == 'P');
+        state_.params[ImageDepth] = state_.convex ? 15.0 : 4.0;
+    }
+    running_ = false;
+    loaded_ = true;
+    wake_.notify_all();
+    if (params_.imagingFn)
+        params_.imagingFn(ImagingReady, 0);
+    return true;
+}
+
+/// starts or stops imaging
+/// @param[in] run the run flag
+/// @return success of the call
+bool Simulator::run(bool run)
+{
+    if (!loaded_)
+        return false;
+
+    running_ = run;
+    wake_.notify_all();
+    if (params_.imagingFn)
+        params_.imagingFn(ImagingReady, run ? 1 : 0);
+    return true;
+}
+
+/// sets an imaging parameter, values are clamped to the simulated ranges
+/// @param[in] prm the parameter
+/// @param[in] val the new value
+/// @return success of the call
+bool Simulator::setParam(CusParam prm, double val)
+{
+    if (prm < ImageDepth || prm > EcoMode || prm == DopplerVelocity)
+        return false;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    switch (prm)
+    {
+    case ImageDepth: val = std::clamp(val, 1.0, state_.convex ? 30.0 : 10.0); break;
+    case Gain: case DynamicRange: case ColorGain: case PwGain: case StrainOpacity: val = std::clamp(val, 0.0, 100.0); break;
+    case ColorPrf: case PwPrf: val = std::clamp(val, 0.2, 20.0); break;
+    default: break;
+    }
+    state_.params[prm] = val;
+    return true;
+}
+
+/// retrieves an imaging parameter
+/// @param[in] prm the parameter
+/// @return the value, -1 if not connected or invalid
+double Simulator::getParam(CusParam prm) const
+{
+    if (!connected_ || prm < ImageDepth || prm > EcoMode)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (prm == DopplerVelocity)
+    {
+        const double prf = (state_.mode == PwMode) ? state_.params[PwPrf] : state_.params[ColorPrf];
+        const bool doppler = (state_.mode == ColorMode || state_.mode == PwMode);
+        const double f0 = frequency(state_.convex);
+        return doppler ? (SOUND_SPEED * prf * 1000.0 / (4.0 * f0)) * 100.0 : 0.0;
+    }
+    return state_.params[prm];
+}
+
+/// sets the imaging mode
+/// @param[in] mode the new mode
+/// @return success of the call
+bool Simulator::setMode(CusMode mode)
+{
+    if (!connected_ || mode < BMode || mode > RfMode)
+        return false;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    state_.mode = mode;
+    return true;
+}
+
+/// sets the processed image format
+/// @param[in] format the new format
+/// @return success of the call
+bool Simulator::setFormat(CusImageFormat format)
+{
+    if (format < Uncompressed || format > Png)
+        return false;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    state_.format = format;
+    return true;
+}
+
+/// sets the processed image size
+/// @param[in] w the width in pixels
+/// @param[in] h the height in pixels
+/// @return success of the call
+bool Simulator::setOutputSize(int w, int h)
+{
+    if (w <= 0 || h <= 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    state_.width = w;
+    state_.height = h;
+    return true;
+}
+
+/// sets the frame rate
+/// @param[in] fps frames per second, 1 - 1000
+/// @return success of the call
+bool Simulator::setFrameRate(double fps)
+{
+    if (fps < 1.0 || fps > 1000.0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    state_.fps = fps;
+    return true;
+}
+
+/// sets the imu sample rate
+/// @param[in] hz samples per second, 1 - 1000
+/// @return success of the call
+bool Simulator::setImuRate(double hz)
+{
+    if (hz < 1.0 || hz > 1000.0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    state_.imuRate = hz;
+    return true;
+}
+
+/// fast pseudo random generator (xorshift)
+/// @return the next random value
+uint32_t Simulator::noise()
+{
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+}
+
+/// pulsatile flow velocity at the vessel center
+/// @param[in] t the time in seconds
+/// @return the velocity in m/s
+double Simulator::flowVelocity(double t) const
+{
+    // 72 bpm, sharp systolic peak over a diastolic baseline
+    const double s = std::max(0.0, std::sin(2.0 * PI * 1.2 * t));
+    return 0.12 + (0.5 * s * s * s);
+}
+
+/// builds the phantom in physical space: rayleigh speckle with cysts, point targets and a tilted vessel
+void Simulator::buildPhantom()
+{
+    cols_ = static_cast<int>(GRID_WIDTH / GRID_RES) + (GRID_MARGIN * 2);
+    rows_ = static_cast<int>(GRID_DEPTH / GRID_RES);
+    const auto sz = static_cast<size_t>(cols_) * static_cast<size_t>(rows_);
+
+    // complex gaussian scatterers, box-filtered to the psf size so the speckle grain is realistic
+    std::vector<float> re(sz), im(sz), tmp(sz);
+    for (size_t i = 0; i < sz; i++)
+    {
+        const double u1 = (static_cast<double>(noise() & 0xFFFFFF) + 1.0) / 16777217.0;
+        const double u2 = static_cast<double>(noise() & 0xFFFFFF) / 16777216.0;
+        const double r = std::sqrt(-2.0 * std::log(u1));
+        re[i] = static_cast<float>(r * std::cos(2.0 * PI * u2));
+        im[i] = static_cast<float>(r * std::sin(2.0 * PI * u2));
+    }
+    auto smooth = [this, &tmp](std::vector<float>& v)
+    {
+        // lateral 3 taps, axial 5 taps
+        for (auto r = 0; r < rows_; r++)
+            for (auto c = 1; c < cols_ - 1; c++)
+            {
+                const auto i = (static_cast<size_t>(r) * cols_) + c;
+                tmp[i] = v[i - 1] + v[i] + v[i + 1];
+            }
+        for (auto r = 2; r < rows_ - 2; r++)
+            for (auto c = 0; c < cols_; c++)
+            {
+                const auto i = (static_cast<size_t>(r) * cols_) + c;
+                v[i] = tmp[i - (2 * cols_)] + tmp[i - cols_] + tmp[i] + tmp[i + cols_] + tmp[i + (2 * cols_)];
+            }
+    };
+    smooth(re);
+    smooth(im);
+
+    double power = 0;
+    for (size_t i = 0; i < sz; i++)
+        power += (re[i] * re[i]) + (im[i] * im[i]);
+    const double rms = std::sqrt(power / static_cast<double>(sz));
+
+    echo_.resize(sz);
+    phase_.resize(sz);
+    flow_.assign(sz, 0);
+    for (size_t i = 0; i < sz; i++)
+    {
+        const double a = std::sqrt((re[i] * re[i]) + (im[i] * im[i])) / rms;
+        echo_[i] = static_cast<float>(20.0 * std::log10(std::max(a, 1e-4)));
+        phase_[i] = static_cast<uint8_t>((std::atan2(im[i], re[i]) + PI) / (2.0 * PI) * 255.0);
+    }
+
+    // structures in mm: lateral position, depth, radius and echo level in db relative to the background
+    auto disc = [this](double x, double z, double radius, float db)
+    {
+        const int c0 = static_cast<int>((x - radius + (GRID_WIDTH / 2.0)) / GRID_RES) + GRID_MARGIN;
+        const int c1 = static_cast<int>((x + radius + (GRID_WIDTH / 2.0)) / GRID_RES) + GRID_MARGIN;
+        const int r0 = static_cast<int>((z - radius) / GRID_RES), r1 = static_cast<int>((z + radius) / GRID_RES);
+        for (auto r = std::max(0, r0); r <= std::min(rows_ - 1, r1); r++)
+            for (auto c = std::max(0, c0); c <= std::min(cols_ - 1, c1); c++)
+            {
+                const double dx = ((c - GRID_MARGIN + 0.5) * GRID_RES) - (GRID_WIDTH / 2.0) - x, dz = ((r + 0.5) * GRID_RES) - z;
+                if ((dx * dx) + (dz * dz) <= radius * radius)
+                    echo_[(static_cast<size_t>(r) * cols_) + c] += db;
+            }
+    };
+    disc(-10, 25, 4, -40.0f);
+    disc(10, 45, 6, -40.0f);
+    disc(-8, 80, 5, 8.0f);
+    disc(5, 120, 8, -40.0f);
+    disc(-12, 160, 10, -12.0f);
+    disc(25, 220, 15, -40.0f);
+    for (auto z = 10; z <= 300; z += 10)
+        disc(15, z, 0.3, 30.0f);
+    for (auto x = -15; x <= 10; x += 5)
+        disc(x, 35, 0.3, 30.0f);
+
+    // vessel running deeper from left to right with a parabolic flow profile
+    const double x0 = -60, z0 = 30, x1 = 60, z1 = 75, radius = 3.0, wall = 0.6;
+    const double len = std::hypot(x1 - x0, z1 - z0), dx = (x1 - x0) / len, dz = (z1 - z0) / len;
+    for (auto r = 0; r < rows_; r++)
+    {
+        const double z = (r + 0.5) * GRID_RES;
+        if (z < std::min(z0, z1) - radius - wall || z > std::max(z0, z1) + radius + wall)
+            continue;
+        for (auto c = 0; c < cols_; c++)
+        {
+            const double x = ((c - GRID_MARGIN + 0.5) * GRID_RES) - (GRID_WIDTH / 2.0);
+            // distance from the vessel axis
+            const double d = std::fabs(((x - x0) * dz) - ((z - z0) * dx));
+            const auto i = (static_cast<size_t>(r) * cols_) + c;
+            if (d <= radius)
+            {
+                const double profile = 1.0 - ((d / radius) * (d / radius));
+                echo_[i] -= 35.0f;
+                // flow runs along +x and therefore away from the probe
+                flow_[i] = static_cast<int8_t>(std::clamp(-profile * dz * 127.0, -127.0, 127.0));
+            }
+            else if (d <= radius + wall)
+                echo_[i] += 8.0f;
+        }
+    }
+}
+
+/// rebuilds the scan conversion map when the output size, depth or geometry change
+/// @param[in] st the settings to map for
+void Simulator::buildMap(const State& st)
+{
+    if (mapped_.width == st.width && mapped_.height == st.height && mapped_.convex == st.convex &&
+        mapped_.params[ImageDepth] == st.params[ImageDepth] && !map_.empty())
+        return;
+
+    const double depth = st.params[ImageDepth] * 10.0;
+    const double half = CONVEX_FOV / 2.0, radius = CONVEX_RADIUS;
+    const double apex = -radius * std::cos(half);
+    double extentW = LINEAR_WIDTH, extentH = depth;
+    if (st.convex)
+    {
+        extentW = 2.0 * (radius + depth) * std::sin(half);
+        extentH = radius + depth + apex;
+    }
+    const double mpp = std::max(extentW / st.width, extentH / st.height);
+    micronsPerPixel_ = mpp * 1000.0;
+
+    const auto sz = static_cast<size_t>(st.width) * static_cast<size_t>(st.height);
+    map_.assign(sz, -1);
+    depth_.assign(sz, 0.0f);
+    for (auto py = 0; py < st.height; py++)
+    {
+        for (auto px = 0; px < st.width; px++)
+        {
+            const double x = (px + 0.5 - (st.width / 2.0)) * mpp, y = (py + 0.5) * mpp;
+            double tissue = y;
+            if (st.convex)
+            {
+                const double r = std::hypot(x, y - apex), a = std::atan2(x, y - apex);
+                if (std::fabs(a) > half || r < radius || r > radius + depth)
+                    continue;
+                tissue = r - radius;
+            }
+            else if (std::fabs(x) > LINEAR_WIDTH / 2.0 || y > depth)
+                continue;
+
+            // the skin at the center of the array is the phantom surface
+            const double z = st.convex ? (y + apex + radius) : y;
+            const int c = static_cast<int>((x + (GRID_WIDTH / 2.0)) / GRID_RES) + GRID_MARGIN;
+            const int r = std::clamp(static_cast<int>(z / GRID_RES), 0, rows_ - 1);
+            const auto i = (static_cast<size_t>(py) * st.width) + px;
+            map_[i] = (r * cols_) + std::clamp(c, GRID_MARGIN, cols_ - GRID_MARGIN - 1);
+            depth_[i] = static_cast<float>(tissue / 10.0);
+        }
+    }
+    mapped_ = st;
+}
+
+/// generator thread, paces frames and imu samples and delivers them through the callbacks
+void Simulator::loop()
+{
+    using clock = std::chrono::steady_clock;
+    std::vector<CusPosInfo> pending;
+    pending.reserve(MAX_IMU);
+    auto nextFrame = clock::now(), nextImu = nextFrame;
+
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!quit_)
+    {
+        if (!running_)
+        {
+            wake_.wait(lock, [this] { return quit_ || running_; });
+            nextFrame = nextImu = clock::now();
+            pending.clear();
+            continue;
+        }
+
+        const bool imu = state_.params[ImuStreaming] > 0;
+        const auto due = imu ? std::min(nextFrame, nextImu) : nextFrame;
+        if (wake_.wait_until(lock, due, [this] { return quit_ || !running_; }))
+            continue;
+
+        const State st = state_;
+        lock.unlock();
+
+        const auto tp = clock::now();
+        const double t = static_cast<double>(now() - start_) / 1e9;
+        if (imu)
+        {
+            while (nextImu <= tp)
+            {
+                CusPosInfo pos;
+                sampleImu(t, pos);
+                if (pending.size() < MAX_IMU)
+                    pending.push_back(pos);
+                if (params_.newImuDataFn)
+                    params_.newImuDataFn(&pos);
+                nextImu += std::chrono::nanoseconds(static_cast<int64_t>(1e9 / st.imuRate));
+            }
+        }
+        else
+            nextImu = tp;
+
+        if (nextFrame <= tp)
+        {
+            const auto period = std::chrono::nanoseconds(static_cast<int64_t>(1e9 / st.fps));
+            buildMap(st);
+            renderFrame(st, t, static_cast<int>(pending.size()), pending.empty() ? nullptr : pending.data());
+            pending.clear();
+            if (st.mode == MMode)
+                renderMLines(st, t);
+            else if (st.mode == PwMode)
+                renderPw(st, t);
+            else if (st.mode == RfMode && st.params[RfStreaming] > 0)
+                renderRf(st, t);
+            frames_++;
+            // frames that can't be generated in time are skipped instead of queued
+            nextFrame += period;
+            if (nextFrame < tp)
+                nextFrame = tp + period;
+        }
+
+        lock.lock();
+    }
+}
+
+/// renders and delivers a processed frame
+/// @param[in] st the settings to render with
+/// @param[in] t the time in seconds since connecting
+/// @param[in] npos # of imu samples collected since the last frame
+/// @param[in] pos the imu samples
+void Simulator::renderFrame(const State& st, double t, int npos, const CusPosInfo* pos)
+{
+    const int w = st.width, h = st.height;
+    const bool gray = (st.format == Uncompressed8Bit);
+    const bool color = !gray && (st.mode == ColorMode || st.mode == PowerMode);
+    frame_.resize(static_cast<size_t>(w) * static_cast<size_t>(h) * (gray ? 1 : 4));
+
+    // 50% gain and dynamic range map the speckle background to mid gray over 60 db
+    const float gain = static_cast<float>((st.params[Gain] - 50.0) * 0.5);
+    const float dr = static_cast<float>(30.0 + (0.6 * st.params[DynamicRange]));
+    const float scale = 255.0f / dr, offset = 0.43f * dr;
+    // breathing motion moves the phantom laterally by up to 0.6 mm
+    const int shift = static_cast<int>(std::lround(0.6 * std::sin(2.0 * PI * 0.25 * t) / GRID_RES));
+
+    const double prf = st.params[ColorPrf] * 1000.0;
+    const double f0 = frequency(st.convex);
+    const float nyquist = static_cast<float>(SOUND_SPEED * prf / (4.0 * f0));
+    const float velocity = static_cast<float>(flowVelocity(t)) / 127.0f;
+    const float cgain = static_cast<float>(st.params[ColorGain] / 50.0);
+    const bool invert = st.params[ColorInvert] > 0;
+
+    for (auto py = 0; py < h; py++)
+    {
+        const auto row = static_cast<size_t>(py) * static_cast<size_t>(w);
+        for (auto px = 0; px < w; px++)
+        {
+            const auto i = row + px;
+            const int idx = map_[i];
+            int g = 0;
+            uint32_t argb = 0xFF000000u;
+            if (idx >= 0)
+            {
+                // electronic noise of up to 3 db keeps the frames from being identical
+                const float n = static_cast<float>(noise() & 0xFF) * (3.0f / 255.0f);
+                const float db = echo_[idx + shift] + gain - (ATTENUATION * depth_[i]) + n;
+                g = static_cast<int>(std::clamp((db + offset) * scale, 0.0f, 255.0f));
+                argb |= static_cast<uint32_t>(g) * 0x010101u;
+                if (color && flow_[idx + shift])
+                {
+                    const int f = flow_[idx + shift];
+                    if (st.mode == ColorMode)
+                    {
+                        // wrap to the nyquist range so a low prf aliases like the real thing
+                        float v = velocity * static_cast<float>(f);
+                        v = v - (2.0f * nyquist * std::floor((v + nyquist) / (2.0f * nyquist)));
+                        const auto c = static_cast<uint32_t>(std::clamp(std::fabs(v) / nyquist * 255.0f * cgain, 0.0f, 255.0f));
+                        if (c)
+                            argb = 0xFF000000u | (((v > 0) != invert) ? (c << 16) : c);
+                    }
+                    else
+                    {
+                        const auto c = static_cast<uint32_t>(std::clamp(std::abs(f) * 2.0f * cgain, 0.0f, 255.0f));
+                        if (c)
+                            argb = 0xFF000000u | (c << 16) | ((c * 5 / 8) << 8);
+                    }
+                }
+            }
+
+            if (gray)
+                frame_[i] = static_cast<uint8_t>(g);
+            else
+                reinterpret_cast<uint32_t*>(frame_.data())[i] = argb;
+        }
+    }
+
+    CusProcessedImageInfo nfo;
+    std::memset(&nfo, 0, sizeof(nfo));
+    nfo.width = w;
+    nfo.height = h;
+    nfo.bitsPerPixel = gray ? 8 : 32;
+    nfo.imageSize = static_cast<int>(frame_.size());
+    nfo.micronsPerPixel = micronsPerPixel_;
+    nfo.originX = (w / 2.0) * micronsPerPixel_;
+    nfo.originY = 0;
+    nfo.tm = now() - start_;
+    nfo.fps = st.fps;
+    nfo.format = st.format;
+
+    if (!params_.newProcessedImageFn)
+        return;
+
+    if (st.format == Jpeg || st.format == Png)
+    {
+        QByteArray encoded;
+        QBuffer buffer(&encoded);
+        buffer.open(QIODevice::WriteOnly);
+        QImage(frame_.data(), w, h, QImage::Format_ARGB32).save(&buffer, (st.format == Jpeg) ? "JPG" : "PNG");
+        nfo.imageSize = static_cast<int>(encoded.size());
+        params_.newProcessedImageFn(encoded.constData(), &nfo, npos, pos);
+    }
+    else
+        params_.newProcessedImageFn(frame_.data(), &nfo, npos, pos);
+}
+
+/// renders and delivers a block of m mode lines through the center of the array
+/// @param[in] st the settings to render with
+/// @param[in] t the time in seconds since connecting
+void Simulator::renderMLines(const State& st, double t)
+{
+    if (!params_.newSpectralImageFn)
+        return;
+
+    mlines_.resize(M_LINES * M_SAMPLES);
+    const double depth = st.params[ImageDepth] * 10.0;
+    const float gain = static_cast<float>((st.params[Gain] - 50.0) * 0.5);
+    const float dr = static_cast<float>(30.0 + (0.6 * st.params[DynamicRange]));
+    const float scale = 255.0f / dr, offset = 0.43f * dr;
+    const double period = 1.0 / (st.fps * M_LINES);
+    const int col = static_cast<int>((GRID_WIDTH / 2.0) / GRID_RES) + GRID_MARGIN;
+    for (auto l = 0; l < M_LINES; l++)
+    {
+        // cardiac motion moves the tissue axially by up to 2 mm
+        const double lt = t + (l * period);
+        const double motion = 2.0 * std::sin(2.0 * PI * 1.2 * lt);
+        uint8_t* line = mlines_.data() + (l * M_SAMPLES);
+        for (auto s = 0; s < M_SAMPLES; s++)
+        {
+            const double z = (s + 0.5) * depth / M_SAMPLES;
+            const int r = std::clamp(static_cast<int>((z + motion) / GRID_RES), 0, rows_ - 1);
+            const float db = echo_[(static_cast<size_t>(r) * cols_) + col] + gain - static_cast<float>(ATTENUATION * z / 10.0);
+            line[s] = static_cast<uint8_t>(std::clamp((db + offset) * scale, 0.0f, 255.0f));
+        }
+    }
+
+    CusSpectralImageInfo nfo;
+    nfo.lines = M_LINES;
+    nfo.samples = M_SAMPLES;
+    nfo.bitsPerSample = 8;
+    nfo.period = period;
+    nfo.micronsPerSample = depth * 1000.0 / M_SAMPLES;
+    nfo.velocityPerSample = 0;
+    nfo.pw = 0;
+    params_.newSpectralImageFn(mlines_.data(), &nfo);
+}
+
+/// synthesizes the slow time signal of a gate in the vessel center and runs it through the spectral engine
+/// @param[in] st the settings to render with
+/// @param[in] t the time in seconds since connecting
+void Simulator::renderPw(const State& st, double t)
+{
+    const double prf = st.params[PwPrf] * 1000.0;
+    const double f0 = frequency(st.convex);
+    if (prf != pwPrf_ || st.params[PwGain] != pwGain_)
+    {
+        auto prms = spectral_.params();
+        prms.prf = prf;
+        prms.frequency = f0;
+        prms.soundSpeed = SOUND_SPEED;
+        prms.gain = (st.params[PwGain] - 50.0) * 0.5;
+        spectral_.setParams(prms);
+        spectral_.reset();
+        pwPrf_ = prf;
+        pwGain_ = st.params[PwGain];
+    }
+
+    // axial component of the vessel direction, flow is away from the probe
+    const double axial = -45.0 / std::hypot(120.0, 45.0);
+    const double samples = (prf / st.fps) + pwCarry_;
+    const int n = static_cast<int>(samples);
+    pwCarry_ = samples - n;
+    iq_.resize(static_cast<size_t>(n) * 2);
+
+    // scatterers leave the gate over time and are replaced at a random position in the profile
+    const auto k = noise() % PW_SCATTERERS;
+    pwSpeed_[k] = static_cast<float>(noise() & 0xFFFF) / 65536.0f;
+    for (auto i = 0; i < n; i++)
+    {
+        const double v = flowVelocity(t + (i / prf)) * axial;
+        double si = 0, sq = 0;
+        for (auto s = 0; s < PW_SCATTERERS; s++)
+        {
+            const double fd = 2.0 * f0 * v * pwSpeed_[s] / SOUND_SPEED;
+            pwPhase_[s] = std::fmod(pwPhase_[s] + (2.0 * PI * fd / prf), 2.0 * PI);
+            si += std::cos(pwPhase_[s]);
+            sq += std::sin(pwPhase_[s]);
+        }
+        iq_[i * 2] = static_cast<int16_t>((si * 1200.0) + static_cast<int>(noise() % 121) - 60);
+        iq_[(i * 2) + 1] = static_cast<int16_t>((sq * 1200.0) + static_cast<int>(noise() % 121) - 60);
+    }
+
+    spectral_.push(iq_.data(), n);
+}
+
+/// renders and delivers an rf frame
+/// @param[in] st the settings to render with
+/// @param[in] t the time in seconds since connecting
+void Simulator::renderRf(const State& st, double t)
+{
+    if (!params_.newRawImageFn)
+        return;
+
+    // sampling at 4x the center frequency, so the carrier advances a quarter cycle per sample
+    const double f0 = frequency(st.convex);
+    const double axial = SOUND_SPEED / (2.0 * 4.0 * f0) * 1000.0;
+    const double depth = st.params[ImageDepth] * 10.0;
+    const int samples = std::min(RF_MAX_SAMPLES, static_cast<int>(depth / axial));
+    const double width = st.convex ? (CONVEX_FOV * CONVEX_RADIUS) : LINEAR_WIDTH;
+    const float gain = static_cast<float>((st.params[Gain] - 50.0) * 0.5);
+    const int shift = static_cast<int>(std::lround(0.6 * std::sin(2.0 * PI * 0.25 * t) / GRID_RES));
+    static const float carrier[4][4] =
+    {
+        { 1, 0, -1, 0 }, { 0, -1, 0, 1 }, { -1, 0, 1, 0 }, { 0, 1, 0, -1 },
+    };
+
+    rf_.resize(static_cast<size_t>(RF_LINES) * static_cast<size_t>(samples));
+    for (auto l = 0; l < RF_LINES; l++)
+    {
+        const double x = ((l + 0.5) / RF_LINES - 0.5) * width;
+        const int c = std::clamp(static_cast<int>((x + (GRID_WIDTH / 2.0)) / GRID_RES) + GRID_MARGIN + shift, 0, cols_ - 1);
+        int16_t* line = rf_.data() + (static_cast<size_t>(l) * samples);
+        for (auto s = 0; s < samples; s++)
+        {
+            const double z = s * axial;
+            const auto idx = (static_cast<size_t>(std::min(static_cast<int>(z / GRID_RES), rows_ - 1)) * cols_) + c;
+            const float db = echo_[idx] + gain - static_cast<float>(ATTENUATION * z / 10.0);
+            const float amp = std::min(30000.0f, 2000.0f * std::pow(10.0f, db / 20.0f));
+            line[s] = static_cast<int16_t>(amp * carrier[phase_[idx] >> 6][s & 3]);
+        }
+    }
+
+    CusRawImageInfo nfo;
+    std::memset(&nfo, 0, sizeof(nfo));
+    nfo.lines = RF_LINES;
+    nfo.samples = samples;
+    nfo.bitsPerSample = 16;
+    nfo.axialSize = axial * 1000.0;
+    nfo.lateralSize = width * 1000.0 / RF_LINES;
+    nfo.tm = now() - start_;
+    nfo.rf = 1;
+    nfo.fps = st.fps;
+    params_.newRawImageFn(rf_.data(), &nfo, 0, nullptr);
+}
+
+/// generates an imu sample for a probe being gently rocked by hand
+/// @param[in] t the time in seconds since connecting
+/// @param[out] pos the sample
+void Simulator::sampleImu(double t, CusPosInfo& pos)
+{
+    const double w0 = 2.0 * PI * 0.11, w1 = 2.0 * PI * 0.07, w2 = 2.0 * PI * 0.05;
+    const double roll = 0.15 * std::sin(w0 * t), pitch = 0.1 * std::sin((w1 * t) + 1.0), yaw = 0.25 * std::sin((w2 * t) + 2.0);
+    const double cr = std::cos(roll / 2), sr = std::sin(roll / 2), cp = std::cos(pitch / 2), sp = std::sin(pitch / 2);
+    const double cy = std::cos(yaw / 2), sy = std::sin(yaw / 2);
+    auto jitter = [this](double amount) { return (static_cast<double>(noise() & 0xFFFF) / 32768.0 - 1.0) * amount; };
+
+    pos.tm = now() - start_;
+    pos.qw = (cr * cp * cy) + (sr * sp * sy);
+    pos.qx = (sr * cp * cy) - (cr * sp * sy);
+    pos.qy = (cr * sp * cy) + (sr * cp * sy);
+    pos.qz = (cr * cp * sy) - (sr * sp * cy);
+
+    // the euler rates are small enough to stand in for the body rates
+    pos.gx = (0.15 * w0 * std::cos(w0 * t)) + jitter(0.003);
+    pos.gy = (0.1 * w1 * std::cos((w1 * t) + 1.0)) + jitter(0.003);
+    pos.gz = (0.25 * w2 * std::cos((w2 * t) + 2.0)) + jitter(0.003);
+
+    double g[3] = { 0, 0, 1 };
+    rotateInverse(pos.qw, pos.qx, pos.qy, pos.qz, g);
+    pos.ax = g[0] + jitter(0.01);
+    pos.ay = g[1] + jitter(0.01);
+    pos.az = g[2] + jitter(0.01);
+
+    // earth field with a 60 degree inclination
+    double m[3] = { 0.5, 0, -0.866 };
+    rotateInverse(pos.qw, pos.qx, pos.qy, pos.qz, m);
+    pos.mx = m[0] + jitter(0.02);
+    pos.my = m[1] + jitter(0.02);
+    pos.mz = m[2] + jitter(0.02);
+}
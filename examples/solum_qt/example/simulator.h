@@ -0,0 +1,106 @@
+#pragma once
+
+#include "spectral.h"
+#include <solum/solum.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// in-process stand-in for a connected probe
+///
+/// renders a parametric phantom (speckle, cysts, point targets and a pulsatile vessel) at the requested output size
+/// and frame rate, honoring depth, gain, mode and format, and delivers frames, spectra, rf and imu samples through
+/// the same callbacks the sdk uses, so the whole consumer pipeline can be exercised without hardware
+class Simulator
+{
+public:
+    Simulator();
+    ~Simulator();
+
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+
+    void setCallbacks(const CusInitParams& params);
+    bool connect();
+    bool disconnect();
+    bool isConnected() const { return connected_; }
+    bool loadApplication(const char* probe, const char* application);
+    bool run(bool run);
+    bool isRunning() const { return running_; }
+
+    bool setParam(CusParam prm, double val);
+    double getParam(CusParam prm) const;
+    bool setMode(CusMode mode);
+    bool setFormat(CusImageFormat format);
+    bool setOutputSize(int w, int h);
+    bool setFrameRate(double fps);
+    bool setImuRate(double hz);
+
+    uint64_t frames() const { return frames_; }
+
+private:
+    /// snapshot of the settings used to render a frame
+    struct State
+    {
+        int width;              ///< output width
+        int height;             ///< output height
+        double fps;             ///< frame rate
+        double imuRate;         ///< imu sample rate
+        bool convex;            ///< probe geometry
+        CusMode mode;           ///< imaging mode
+        CusImageFormat format;  ///< output format
+        std::array<double, EcoMode + 1> params; ///< imaging parameters
+    };
+
+    void loop();
+    void buildPhantom();
+    void buildMap(const State& st);
+    void renderFrame(const State& st, double t, int npos, const CusPosInfo* pos);
+    void renderMLines(const State& st, double t);
+    void renderPw(const State& st, double t);
+    void renderRf(const State& st, double t);
+    void sampleImu(double t, CusPosInfo& pos);
+    double flowVelocity(double t) const;
+    uint32_t noise();
+
+private:
+    CusInitParams params_;                  ///< callbacks to deliver to
+    mutable std::mutex lock_;               ///< protects the settings and the thread state
+    std::condition_variable wake_;          ///< wakes the generator thread
+    std::thread thread_;                    ///< generator thread, acts as the sdk callback thread
+    bool quit_;                             ///< generator thread shutdown flag
+    State state_;                           ///< requested settings
+    std::atomic_bool connected_;            ///< connection state
+    std::atomic_bool loaded_;               ///< application loaded state
+    std::atomic_bool running_;              ///< imaging state
+    std::atomic<uint64_t> frames_;          ///< # of frames generated
+    std::string probe_;                     ///< loaded probe model
+    int64_t start_;                         ///< steady clock time of the connection
+    uint32_t seed_;                         ///< noise generator state
+    // phantom, built once in physical space
+    int cols_;                              ///< lateral grid size
+    int rows_;                              ///< axial grid size
+    std::vector<float> echo_;               ///< echo level in db relative to the speckle background
+    std::vector<uint8_t> phase_;            ///< scatterer phase used for rf synthesis
+    std::vector<int8_t> flow_;              ///< axial flow fraction towards the probe (-127 to 127), 0 outside the vessel
+    // cached scan conversion
+    std::vector<int32_t> map_;              ///< phantom index per output pixel, -1 outside the field of view
+    std::vector<float> depth_;              ///< attenuation depth in cm per output pixel
+    State mapped_;                          ///< settings the map was built for
+    double micronsPerPixel_;                ///< output pixel size
+    std::vector<uint8_t> frame_;            ///< output frame
+    std::vector<uint8_t> mlines_;           ///< m mode block
+    std::vector<int16_t> rf_;               ///< rf frame
+    std::vector<int16_t> iq_;               ///< pw slow time samples for the current frame
+    double pwCarry_;                        ///< fractional pw samples carried between frames
+    double pwPrf_;                          ///< prf the spectral engine is configured for
+    double pwGain_;                         ///< gain the spectral engine is configured for
+    double pwPhase_[16];                    ///< phase of each simulated pw scatterer
+    float pwSpeed_[16];                     ///< velocity fraction of each simulated pw scatterer
+    SpectralEngine spectral_;               ///< turns the simulated gate signal into spectra
+};
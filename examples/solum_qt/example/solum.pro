@@ -1,6 +1,6 @@
 TARGET = solum
 TEMPLATE = app
-QT += core widgets gui bluetooth 3dcore 3drender 3dextras
+QT += core widgets gui bluetooth 3dcore 3drender 3dextras 3dlogic
 CONFIG += c++17 precompile_header
 DEFINES += QT_DEPRECATED_WARNINGS USE_QT_3D
 PRECOMPILED_HEADER = pch.h
@@ -10,8 +10,8 @@ LIBPATH = $$PWD/../../lib
 INCLUDEPATH += $$PWD/../../include
 LIBS += -L$$LIBPATH/ -lsolum
 
-SOURCES += main.cpp solumqt.cpp ble.cpp display.cpp 3d.cpp
-HEADERS += solumqt.h ble.h display.h 3d.h
+SOURCES += main.cpp solumqt.cpp ble.cpp display.cpp 3d.cpp filter.cpp workers.cpp doppler.cpp spectral.cpp recorder.cpp player.cpp simulator.cpp cinebuffer.cpp rawpackage.cpp npy.cpp imu.cpp volume.cpp fusion.cpp pipeline.cpp
+HEADERS += solumqt.h ble.h display.h 3d.h filter.h workers.h doppler.h spectral.h recorder.h player.h simulator.h cinebuffer.h rawpackage.h npy.h imu.h volume.h fusion.h pipeline.h eventpool.h
 FORMS += solumqt.ui
 
 RESOURCES += \
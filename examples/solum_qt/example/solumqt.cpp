@@ -3,18 +3,23 @@
 #include "3d.h"
 #include "ui_solumqt.h"
 #include <solum/solum.h>
+#include <algorithm>
 
 #define RAW_TAB         3
 #define IMU_TAB         4
 #define UPDATE_PROGRESS 0
 #define RAW_PROGRESS    1
 #define MB_CONV         (1024.0 * 1024.0)
+#define CINE_SECONDS    10.0
+#define CINE_FPS        30.0    // frame rate assumed until the stream reports one
+#define CINE_RAW_BYTES  (2 * 1024 * 1024)
+#define CINE_IMU_RATE   200.0
 
 static Solum* _me;
 
 /// default constructor
 /// @param[in] parent the parent object
-Solum::Solum(QWidget *parent) : QMainWindow(parent), connected_(false), imaging_(false), teeConnected_(false), imuSamples_(0), acquired_(0), ui_(new Ui::Solum)
+Solum::Solum(QWidget *parent) : QMainWindow(parent), connected_(false), imaging_(false), teeConnected_(false), imuSamples_(0), acquired_(0), ui_(new Ui::Solum), fuse_(false)
 {
     _me = this;
     ui_->setupUi(this);
@@ -30,6 +35,11 @@ Solum::Solum(QWidget *parent) : QMainWindow(parent), connected_(false), imaging_
     ui_->image->addWidget(spectrum_);
     ui_->image->addWidget(signal_);
     ui_->image2->addWidget(image2_);
+    // only a notification crosses to the gui thread, the image itself is picked up from the pipeline when handled
+    pipeline_.setCallback([this](ImageStream stream)
+    {
+        QApplication::postEvent(this, new event::Decoded(stream == ImageStream::Prescan ? PRESCAN_EVENT : IMAGE_EVENT, stream));
+    });
     render_ = new ProbeRender(QGuiApplication::primaryScreen());
     ui_->render->addWidget(QWidget::createWindowContainer(render_));
     auto reset = new QPushButton(QStringLiteral("Reset"), this);
@@ -42,6 +52,7 @@ Solum::Solum(QWidget *parent) : QMainWindow(parent), connected_(false), imaging_
     ui_->opacity->setVisible(false);
     ui_->rfzoom->setVisible(false);
     ui_->rfStream->setVisible(false);
+    ui_->rfLines->setVisible(false);
     ui_->rawAvailability->setVisible(false);
     ui_->downloadRaw->setVisible(false);
     ui_->split->setVisible(false);
@@ -213,6 +224,11 @@ Solum::Solum(QWidget *parent) : QMainWindow(parent), connected_(false), imaging_
 Solum::~Solum()
 {
     timer_.stop();
+    pipeline_.setCallback(nullptr);
+    simulator_.disconnect();
+    player_.close();
+    recorder_.close();
+    exporter_.close();
     delete ui_;
 }
 
@@ -324,114 +340,106 @@ void Solum::onAp()
 /// @return handling status
 bool Solum::event(QEvent *event)
 {
-    if (event->type() == CONNECT_EVENT)
-    {
-        auto evt = static_cast<event::Connection*>(event);
-        setConnected(evt->result_, evt->port_, evt->message_);
-        return true;
-    }
-    else if (event->type() == CERT_EVENT)
-    {
-        auto evt = static_cast<event::Cert*>(event);
-        certification(evt->daysValid_);
-        return true;
-    }
-    else if (event->type() == POWER_EVENT)
-    {
-        auto evt = static_cast<event::PowerDown*>(event);
-        poweringDown(evt->res_, evt->timeOut_);
-        return true;
-    }
-    else if (event->type() == SWUPDATE_EVENT)
-    {
-        auto evt = static_cast<event::SwUpdate*>(event);
-        softwareUpdate(evt->res_);
-        return true;
-    }
-    else if (event->type() == LIST_EVENT)
-    {
-        auto evt = static_cast<event::List*>(event);
-        if (evt->probes_)
-            loadProbes(evt->list_);
-        else
-            loadApplications(evt->list_);
-        return true;
-    }
-    else if (event->type() == IMAGE_EVENT)
-    {
-        auto evt = static_cast<event::Image*>(event);
-        newProcessedImage(evt->data_, evt->width_, evt->height_, evt->bpp_, evt->format_, evt->size_, evt->overlay_, evt->imu_);
-        return true;
-    }
-    else if (event->type() == PRESCAN_EVENT)
-    {
-        auto evt = static_cast<event::Image*>(event);
-        newPrescanImage(evt->data_, evt->width_, evt->height_, evt->bpp_, evt->size_, evt->format_);
-        return true;
-    }
-    else if (event->type() == SPECTRUM_EVENT)
-    {
-        auto evt = static_cast<event::SpectrumImage*>(event);
-        newSpectrumImage(evt->data_, evt->lines_, evt->samples_, evt->bps_);
-        return true;
-    }
-    else if (event->type() == RF_EVENT)
-    {
-        auto evt = static_cast<event::RfImage*>(event);
-        newRfImage(evt->data_, evt->width_, evt->height_, evt->bpp_ / 8);
-        return true;
-    }
-    else if (event->type() == IMAGING_EVENT)
-    {
-        auto evt = static_cast<event::Imaging*>(event);
-        imagingState(evt->state_, evt->imaging_);
-        return true;
-    }
-    else if (event->type() == IMU_EVENT)
-    {
-        auto evt = static_cast<event::Imu*>(event);
-        newImuData(evt->imu_);
-        return true;
-    }
-    else if (event->type() == BUTTON_EVENT)
-    {
-        auto evt = static_cast<event::Button*>(event);
-        onButton(evt->button_, evt->clicks_);
-        return true;
-    }
-    else if (event->type() == PROGRESS_EVENT)
-    {
-        auto evt = static_cast<event::Progress*>(event);
-        setProgress(evt->selection_, evt->progress_);
-        return true;
-    }
-    else if (event->type() == ERROR_EVENT)
-    {
-        setError((static_cast<event::Error*>(event))->error_);
-        return true;
-    }
-    else if (event->type() == TEE_EVENT)
-    {
-        auto evt = static_cast<event::Tee*>(event);
-        onTee(evt->connected_, evt->serial_, evt->timeRemaining_);
-        return true;
-    }
-    else if (event->type() == RAWAVAIL_EVENT)
-    {
-        auto evt = static_cast<event::RawAvailability*>(event);
-        onRawAvailabilityResult(evt->res_, evt->b_, evt->iqrf_);
-        return true;
-    }
-    else if (event->type() == RAWREADY_EVENT)
+    using Handler = void (*)(Solum*, QEvent*);
+
+    // handlers indexed by custom event type, in the order the events are numbered
+    static const Handler handlers[EVENT_COUNT] =
     {
-        auto evt = static_cast<event::RawReady*>(event);
-        onRawReadyToDownload(evt->sz_, evt->ext_);
-        return true;
-    }
-    else if (event->type() == RAWDOWNLOADED_EVENT)
+        // CONNECT_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::Connection*>(e);
+            s->setConnected(evt->result_, evt->port_, QString::fromLatin1(evt->message_));
+        },
+        // CERT_EVENT
+        [](Solum* s, QEvent* e) { s->certification(static_cast<event::Cert*>(e)->daysValid_); },
+        // POWER_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::PowerDown*>(e);
+            s->poweringDown(evt->res_, evt->timeOut_);
+        },
+        // SWUPDATE_EVENT
+        [](Solum* s, QEvent* e) { s->softwareUpdate(static_cast<event::SwUpdate*>(e)->res_); },
+        // LIST_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::List*>(e);
+            if (evt->probes_)
+                s->loadProbes(evt->list_);
+            else
+                s->loadApplications(evt->list_);
+        },
+        // IMAGE_EVENT
+        [](Solum* s, QEvent* e) { s->newProcessedImage(static_cast<event::Decoded*>(e)->stream_); },
+        // PRESCAN_EVENT
+        [](Solum* s, QEvent*) { s->newPrescanImage(); },
+        // SPECTRUM_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::SpectrumImage*>(e);
+            s->newSpectrumImage(evt->data_, evt->lines_, evt->samples_, evt->bps_);
+        },
+        // RF_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::RfImage*>(e);
+            s->newRfImage(evt->data_, evt->lines_, evt->samples_, evt->bps_ / 8);
+        },
+        // IMAGING_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::Imaging*>(e);
+            s->imagingState(evt->state_, evt->imaging_);
+        },
+        // BUTTON_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::Button*>(e);
+            s->onButton(evt->button_, evt->clicks_);
+        },
+        // ERROR_EVENT
+        [](Solum* s, QEvent* e) { s->setError(QString::fromUtf8(static_cast<event::Error*>(e)->error_)); },
+        // PROGRESS_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::Progress*>(e);
+            s->setProgress(evt->selection_, evt->progress_);
+        },
+        // TEE_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::Tee*>(e);
+            s->onTee(evt->connected_, QString::fromLatin1(evt->serial_), evt->timeRemaining_);
+        },
+        // IMU_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::Imu*>(e);
+            s->newImuData(evt->imu_, evt->samples_);
+        },
+        // RAWAVAIL_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::RawAvailability*>(e);
+            s->onRawAvailabilityResult(evt->res_, evt->b_, evt->iqrf_, evt->times_);
+        },
+        // RAWREADY_EVENT
+        [](Solum* s, QEvent* e)
+        {
+            auto evt = static_cast<event::RawReady*>(e);
+            s->onRawReadyToDownload(evt->sz_, QString::fromLatin1(evt->ext_));
+        },
+        // RAWDOWNLOADED_EVENT
+        [](Solum* s, QEvent* e) { s->onRawDownloaded(static_cast<event::RawDownloaded*>(e)->res_); },
+        // IMU_PORT_EVENT, only informational
+        nullptr
+    };
+
+    const auto i = static_cast<int>(event->type()) - static_cast<int>(CONNECT_EVENT);
+    if (i >= 0 && i < EVENT_COUNT && handlers[i])
     {
-        auto evt = static_cast<event::RawDownloaded*>(event);
-        onRawDownloaded(evt->res_);
+        handlers[i](this, event);
         return true;
     }
 
@@ -457,6 +465,7 @@ void Solum::setConnected(CusConnection res, int port, const QString& msg)
         connected_ = true;
         ui_->status->showMessage(QStringLiteral("Connected on port: %1").arg(port));
         ui_->connect->setText("Disconnect");
+        ui_->playback->setEnabled(false);
         ui_->update->setEnabled(true);
         ui_->load->setEnabled(true);
 
@@ -471,6 +480,7 @@ void Solum::setConnected(CusConnection res, int port, const QString& msg)
         connected_ = false;
         ui_->status->showMessage(QStringLiteral("Disconnected"));
         ui_->connect->setText(QStringLiteral("Connect"));
+        ui_->playback->setEnabled(true);
         ui_->cert->clear();
         ui_->freeze->setEnabled(false);
         ui_->update->setEnabled(false);
@@ -479,7 +489,10 @@ void Solum::setConnected(CusConnection res, int port, const QString& msg)
         imagingState(ImagingNotReady, false);
     }
     else if (res == ConnectionFailed || res == ConnectionError)
+    {
         ui_->status->showMessage(QStringLiteral("Error connecting: %1").arg(msg));
+        ui_->playback->setEnabled(!connected_);
+    }
     else if (res == OSUpdateRequired)
         ui_->status->showMessage(QStringLiteral("Scanner O/S update required prior to imaging"));
     else if (res == SwUpdateRequired)
@@ -546,6 +559,7 @@ void Solum::imagingState(CusImagingState state, bool imaging)
     ui_->opacity->setEnabled(ready ? true : false);
     ui_->rfzoom->setEnabled(ready ? true : false);
     ui_->rfStream->setEnabled(ready ? true : false);
+    ui_->rfLines->setEnabled(ready ? true : false);
     ui_->rawBuffer->setEnabled(ready ? true : false);
     ui_->prescan->setEnabled(ready ? true : false);
     ui_->split->setEnabled(ready ? true : false);
@@ -563,6 +577,9 @@ void Solum::imagingState(CusImagingState state, bool imaging)
         {
             if (!imaging_)
             {
+                configureCine();
+                imu_.clear();
+                fusion_.reset();
                 acquired_ = 0;
                 brTimer_.start(100);
                 elapsed_.restart();
@@ -570,6 +587,7 @@ void Solum::imagingState(CusImagingState state, bool imaging)
             else
             {
                 brTimer_.stop();
+                imuBatcher_.flush();
             }
         }
 
@@ -634,10 +652,54 @@ void Solum::onTee(bool connected, const QString& serial, double timeRemaining)
 /// @param[in] res the result of the original call
 /// @param[in] b the number of raw b frames
 /// @param[in] iqrf the number of raw iq/rf frames
-void Solum::onRawAvailabilityResult(int res, int b, int iqrf)
+/// @param[in] times timestamps of all the frames
+void Solum::onRawAvailabilityResult(int res, int b, int iqrf, const std::vector<long long>& times)
 {
     Q_UNUSED(res)
     ui_->status->showMessage(QStringLiteral("Raw Data Available: %1 B Frames & %2 IQ or RF Frames").arg(b).arg(iqrf));
+    if (!rawData_.partition_)
+        return;
+
+    rawData_.partition_ = false;
+    auto sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    if (sorted.empty())
+    {
+        ui_->status->showMessage(QStringLiteral("No Raw Data Buffered"));
+        return;
+    }
+
+    // split into ranges holding an equal share of the frames, each range is inclusive of its end frame
+    const auto count = sorted.size();
+    const auto n = std::min(static_cast<size_t>(rawData_.parts_), count);
+    rawData_.ranges_.clear();
+    for (size_t i = 0; i < n; i++)
+        rawData_.ranges_.push_back({ sorted[(count * i) / n], sorted[((count * (i + 1)) / n) - 1] });
+
+    rawData_.part_ = 0;
+    if (!requestRawPart(0))
+    {
+        ui_->status->showMessage(QStringLiteral("Raw Download Failed"));
+        endRawDownload();
+    }
+}
+
+/// requests the probe to package a range of a partitioned download
+/// @param[in] part the range to request
+/// @return success of the call
+bool Solum::requestRawPart(int part)
+{
+    const auto& range = rawData_.ranges_[static_cast<size_t>(part)];
+    rawData_.requested_ = part;
+    if (solumRequestRawData(range.first, range.second, 1, [](int sz, const char* extension)
+    {
+        QApplication::postEvent(_me, new event::RawReady(sz, extension));
+    }) < 0)
+        return false;
+
+    rawData_.outstanding_++;
+    return true;
 }
 
 /// called when raw data is ready to download
@@ -645,58 +707,197 @@ void Solum::onRawAvailabilityResult(int res, int b, int iqrf)
 /// @param[in] ext extension of the package
 void Solum::onRawReadyToDownload(int sz, const QString& ext)
 {
-    if (sz > 0)
+    // replies arrive in request order, so those still due from a download that ended are dropped before any reply
+    // is matched to the current one, and a reply nothing is waiting for is dropped as well
+    if (rawData_.stale_ > 0 || !rawData_.outstanding_)
+    {
+        rawData_.stale_ = std::max(0, rawData_.stale_ - 1);
+        return;
+    }
+    rawData_.outstanding_--;
+
+    if (sz <= 0)
+    {
+        // every range after the first is packaged while the previous one downloads, if the probe can't do that
+        // then fall back to packaging each range once the previous download completes
+        if (!rawData_.ranges_.empty() && !rawData_.serial_ && rawData_.requested_ > 0)
+        {
+            rawData_.serial_ = true;
+            if (rawData_.ptr_)
+                rawData_.requested_ = rawData_.part_;
+            else if (!requestRawPart(rawData_.part_))
+            {
+                ui_->status->showMessage(QStringLiteral("Raw Download Failed"));
+                endRawDownload();
+            }
+            return;
+        }
+
+        ui_->status->showMessage(QStringLiteral("Error Packaging Raw Data"));
+        endRawDownload();
+        return;
+    }
+
+    // the next range was packaged while the previous one is still downloading, read it once that completes
+    if (rawData_.ptr_)
+    {
+        rawData_.pending_ = sz;
+        rawData_.pendingExt_ = ext;
+        return;
+    }
+
+    readRawData(sz, ext);
+}
+
+/// reads a packaged download into its file
+/// @param[in] sz size of the package
+/// @param[in] ext extension of the package
+void Solum::readRawData(int sz, const QString& ext)
+{
+    const auto parts = static_cast<int>(rawData_.ranges_.size());
+    const auto mb = QString::number(static_cast<double>(sz) / MB_CONV, 'f', 2);
+    if (parts > 1)
+        ui_->status->showMessage(QStringLiteral("Raw Package %1 of %2 Size: %3 MB").arg(rawData_.part_ + 1).arg(parts).arg(mb));
+    else
+        ui_->status->showMessage(QStringLiteral("Raw Package Size: %1 MB").arg(mb));
+
+    rawData_.size_ = sz;
+    if (rawData_.part_ == 0)
     {
-        ui_->status->showMessage(QStringLiteral("Raw Package Size: %1 MB").arg(QString::number(static_cast<double>(sz) / MB_CONV, 'f', 2)));
-        rawData_.size_ = sz;
         rawData_.file_ = QFileDialog::getSaveFileName(this, QStringLiteral("Save Raw Data"), QDir::homePath() + QLatin1Char('/') + QStringLiteral("raw_data%1").arg(ext), QStringLiteral("(*%1)").arg(ext));
         if (rawData_.file_.isEmpty())
+        {
+            endRawDownload();
             return;
+        }
 
         setProgress(RAW_PROGRESS, 0);
+    }
 
-        rawData_.data_.resize(rawData_.size_);
-        rawData_.ptr_ = rawData_.data_.data();
+    // each range is a complete package of its own, so number the files
+    auto path = rawData_.file_;
+    if (parts > 1)
+    {
+        const auto suffix = path.endsWith(ext) ? ext : QString();
+        path.chop(suffix.size());
+        path += QStringLiteral("_part%1").arg(rawData_.part_ + 1) + suffix;
+    }
 
-        if (solumReadRawData((void**)(&rawData_.ptr_),
-            [](int res)
-            {
-                // call is complete, post event to manage actual storage
-                QApplication::postEvent(_me, new event::RawDownloaded(res));
-            },
-            [](int progress)
-            {
-                QApplication::postEvent(_me, new event::Progress(RAW_PROGRESS, progress));
-            }
-            ) < 0)
-                ui_->status->showMessage(QStringLiteral("Raw Download Failed"));
+    // size the file up front and map it so the package is written straight into the page cache, letting
+    // the os flush to disk while the transfer runs instead of holding the whole package in memory
+    rawData_.out_.setFileName(path);
+    if (!rawData_.out_.open(QIODevice::ReadWrite | QIODevice::Truncate) || !rawData_.out_.resize(rawData_.size_))
+    {
+        rawData_.out_.close();
+        ui_->status->showMessage(QStringLiteral("Error Opening Requested File"));
+        endRawDownload();
+        return;
+    }
+    // no fallback to a buffer in memory, holding a whole package is what the mapping avoids on small systems
+    rawData_.ptr_ = reinterpret_cast<char*>(rawData_.out_.map(0, rawData_.size_));
+    if (!rawData_.ptr_)
+    {
+        rawData_.out_.remove();
+        ui_->status->showMessage(QStringLiteral("Error Mapping Requested File"));
+        endRawDownload();
+        return;
+    }
+
+    if (solumReadRawData((void**)(&rawData_.ptr_),
+        [](int res)
+        {
+            // call is complete, post event to manage actual storage
+            QApplication::postEvent(_me, new event::RawDownloaded(res));
+        },
+        [](int progress)
+        {
+            QApplication::postEvent(_me, new event::Progress(RAW_PROGRESS, progress));
+        }
+        ) < 0)
+    {
+        ui_->status->showMessage(QStringLiteral("Raw Download Failed"));
+        rawData_.out_.unmap(reinterpret_cast<uchar*>(rawData_.ptr_));
+        rawData_.out_.remove();
+        rawData_.ptr_ = nullptr;
+        endRawDownload();
+        return;
+    }
+
+    // package the next range on the probe while this one downloads
+    if (!rawData_.serial_ && (rawData_.part_ + 1) < parts && rawData_.requested_ == rawData_.part_ && !requestRawPart(rawData_.part_ + 1))
+    {
+        rawData_.serial_ = true;
+        rawData_.requested_ = rawData_.part_;
     }
-    else
-        ui_->status->showMessage(QStringLiteral("Error Packaging Raw Data"));
 }
 
 /// called when the download has completed or failed
 /// @param[in] res the download result
 void Solum::onRawDownloaded(int res)
 {
+    if (rawData_.ptr_)
+        rawData_.out_.unmap(reinterpret_cast<uchar*>(rawData_.ptr_));
+    rawData_.ptr_ = nullptr;
+
     if (res <= 0)
     {
+        rawData_.out_.remove();
         ui_->status->showMessage(QStringLiteral("Raw Download Failed"));
+        endRawDownload();
+        return;
     }
-    else
+
+    // the sdk doesn't state that packaging a range leaves the package being read intact, so an overlapped download
+    // only accepts a package whose reported size is the one announced for it
+    if (rawData_.overlap_ && res != rawData_.size_)
     {
-        QFile f(rawData_.file_);
-        if (!f.open(QIODevice::WriteOnly))
-        {
-                ui_->status->showMessage(QStringLiteral("Error Opening Requested File"));
-            return;
-        }
-        f.write(rawData_.data_);
-        f.close();
-        ui_->status->showMessage(QStringLiteral("Successfully Downloaded Data"));
+        rawData_.out_.remove();
+        ui_->status->showMessage(QStringLiteral("Raw Package Size Mismatch, Disable Overlap and Retry"));
+        endRawDownload();
+        return;
+    }
+
+    rawData_.out_.close();
+
+    const auto parts = static_cast<int>(rawData_.ranges_.size());
+    if (++rawData_.part_ >= parts)
+    {
+        if (parts > 1)
+            ui_->status->showMessage(QStringLiteral("Successfully Downloaded %1 Parts").arg(parts));
+        else
+            ui_->status->showMessage(QStringLiteral("Successfully Downloaded Data"));
+        endRawDownload();
+        return;
+    }
+
+    ui_->status->showMessage(QStringLiteral("Downloaded Part %1 of %2").arg(rawData_.part_).arg(parts));
+    if (rawData_.pending_)
+    {
+        const auto sz = rawData_.pending_;
+        rawData_.pending_ = 0;
+        readRawData(sz, rawData_.pendingExt_);
+    }
+    else if (rawData_.requested_ < rawData_.part_ && !requestRawPart(rawData_.part_))
+    {
+        ui_->status->showMessage(QStringLiteral("Raw Download Failed"));
+        endRawDownload();
     }
 }
 
+/// resets the state of a partitioned download
+void Solum::endRawDownload()
+{
+    rawData_.ranges_.clear();
+    rawData_.part_ = 0;
+    rawData_.requested_ = 0;
+    rawData_.pending_ = 0;
+    rawData_.stale_ += rawData_.outstanding_;
+    rawData_.outstanding_ = 0;
+    rawData_.overlap_ = false;
+    rawData_.serial_ = false;
+    rawData_.partition_ = false;
+}
+
 /// called when the download progress changes
 /// @param[in] selection the progress bar to move
 /// @param[in] progress the current progress
@@ -705,58 +906,269 @@ void Solum::setProgress(int selection, int progress)
     if (selection == UPDATE_PROGRESS)
         ui_->updateProgress->setValue(progress);
     else if (selection == RAW_PROGRESS)
-        ui_->rawProgress->setValue(progress);
+    {
+        const auto parts = static_cast<int>(rawData_.ranges_.size());
+        if (parts > 1)
+        {
+            ui_->rawProgress->setValue(((rawData_.part_ * 100) + progress) / parts);
+            ui_->status->showMessage(QStringLiteral("Downloading Part %1 of %2: %3%").arg(rawData_.part_ + 1).arg(parts).arg(progress));
+        }
+        else
+            ui_->rawProgress->setValue(progress);
+    }
 }
 
 /// called when the image format changes
 /// @param[in] format the new image format
 void Solum::onFormat(int format)
 {
+    simulator_.setFormat(static_cast<CusImageFormat>(format));
     solumSetFormat(static_cast<CusImageFormat>(format));
 }
 
-/// called when a new image has been sent
-/// @param[in] img the image data
-/// @param[in] w width of the image
-/// @param[in] h height of the image
-/// @param[in] bpp the bits per pixel
-/// @param[in] format the image format
-/// @param[in] sz size of the image in bytes
-/// @param[in] imu the imu data if valid
-void Solum::newProcessedImage(const void* img, int w, int h, int bpp, CusImageFormat format, int sz, bool overlay, const QQuaternion& imu)
+/// called when the persistence selection changes
+/// @param[in] index the persistence selection
+void Solum::onPersistence(int index)
+{
+    switch (index)
+    {
+        case 1: filter_.configure(TemporalFilter::Mode::Recursive, 160); break;
+        case 2: filter_.configure(TemporalFilter::Mode::Recursive, 64); break;
+        case 3: filter_.configure(TemporalFilter::Mode::Average, 4); break;
+        case 4: filter_.configure(TemporalFilter::Mode::Average, 8); break;
+        default: filter_.configure(TemporalFilter::Mode::Off, 0); break;
+    }
+}
+
+/// called when the cine recording is toggled
+/// @param[in] state the check state
+void Solum::onRecord(int state)
+{
+    if (state == Qt::Checked)
+    {
+        if (recorder_.isOpen())
+            return;
+        auto file = QFileDialog::getSaveFileName(this, QStringLiteral("Record Cine"), QDir::homePath() + QStringLiteral("/capture.cine"), QStringLiteral("(*.cine)"));
+        if (file.isEmpty() || !recorder_.open(file))
+        {
+            if (!file.isEmpty())
+                setError(QStringLiteral("Could not create %1").arg(file));
+            QSignalBlocker block(ui_->record);
+            ui_->record->setChecked(false);
+            return;
+        }
+        ui_->status->showMessage(QStringLiteral("Recording to %1").arg(file));
+    }
+    else if (recorder_.isOpen())
+    {
+        const auto ok = recorder_.close();
+        ui_->status->showMessage(QStringLiteral("Recorded %1 records (%2 MB), %3 dropped%4").arg(recorder_.records())
+            .arg(recorder_.bytes() / (1024 * 1024)).arg(recorder_.dropped()).arg(ok ? QString() : QStringLiteral(", index not written")));
+    }
+}
+
+/// called when numpy export is toggled
+/// @param[in] state the checkbox state
+void Solum::onExport(int state)
+{
+    if (state == Qt::Checked)
+    {
+        if (exporter_.isOpen())
+            return;
+        auto file = QFileDialog::getSaveFileName(this, QStringLiteral("Export Raw Frames"), QDir::homePath() + QStringLiteral("/raw.npy"), QStringLiteral("(*.npy)"));
+        if (file.isEmpty() || !exporter_.open(file))
+        {
+            QSignalBlocker block(ui_->exportNpy);
+            ui_->exportNpy->setChecked(false);
+            return;
+        }
+        ui_->status->showMessage(QStringLiteral("Exporting raw frames to %1").arg(file));
+    }
+    else if (exporter_.isOpen())
+    {
+        const auto ok = exporter_.close();
+        ui_->status->showMessage(QStringLiteral("Exported %1 frames, %2 dropped%3").arg(exporter_.frames()).arg(exporter_.dropped())
+            .arg(ok ? QString() : QStringLiteral(", arrays not finalized")));
+    }
+}
+
+/// called when the imu recording format changes
+/// @param[in] index the format selection
+void Solum::onImuFormat(int index)
+{
+    recorder_.setImuFormat(static_cast<ImuFormat>(index));
+}
+
+/// called when imu fusion is toggled
+/// @param[in] state the checkbox state
+void Solum::onFuseImu(int state)
 {
-    acquired_ += static_cast<uint64_t>(sz);
+    fusion_.reset();
+    imu_.clear();
+    fuse_ = (state == Qt::Checked);
+}
+
+/// called when volume reconstruction is toggled
+/// @param[in] state the checkbox state
+void Solum::onVolume(int state)
+{
+    if (state == Qt::Checked)
+    {
+        if (!volume_.start())
+        {
+            QSignalBlocker block(ui_->buildVolume);
+            ui_->buildVolume->setChecked(false);
+            return;
+        }
+        ui_->status->showMessage(QStringLiteral("Building volume, sweep the probe from the starting orientation"));
+    }
+    else if (volume_.isRunning())
+    {
+        volume_.stop();
+        const auto filled = volume_.fill();
+        ui_->status->showMessage(QStringLiteral("Compounded %1 frames (%2 dropped) into %3 MB, %4 voxels filled").arg(volume_.frames())
+            .arg(volume_.dropped()).arg(volume_.memory() / (1024 * 1024)).arg(filled));
+        auto file = QFileDialog::getSaveFileName(this, QStringLiteral("Save Volume"), QDir::homePath() + QStringLiteral("/volume.npy"), QStringLiteral("(*.npy)"));
+        if (!file.isEmpty() && !volume_.save(file))
+            setError(QStringLiteral("Could not save %1").arg(file));
+    }
+}
+
+/// called when the playback selection changes
+/// @param[in] index the playback selection
+void Solum::onPlayback(int index)
+{
+    player_.stop();
+    // switching off releases the file so the next selection prompts for a new one
+    if (index <= 0)
+    {
+        player_.close();
+        ui_->connect->setEnabled(true);
+        ui_->simulate->setEnabled(true);
+        return;
+    }
+
+    // playback replaces the probe, so it can't share the callbacks with a connected probe or the simulator
+    auto cancel = [this]()
+    {
+        player_.close();
+        QSignalBlocker block(ui_->playback);
+        ui_->playback->setCurrentIndex(0);
+        ui_->connect->setEnabled(true);
+        ui_->simulate->setEnabled(true);
+    };
+
+    if (connected_ || simulator_.isConnected())
+    {
+        ui_->status->showMessage(QStringLiteral("Disconnect before playing a cine"));
+        cancel();
+        return;
+    }
+
+    if (!player_.isOpen())
+    {
+        auto file = QFileDialog::getOpenFileName(this, QStringLiteral("Play Cine"), QDir::homePath(), QStringLiteral("(*.cine)"));
+        if (file.isEmpty() || !player_.open(file))
+        {
+            if (!file.isEmpty())
+                setError(QStringLiteral("Could not open %1").arg(file));
+            cancel();
+            return;
+        }
+    }
+
+    ui_->connect->setEnabled(false);
+    ui_->simulate->setEnabled(false);
+
+    const auto pacing = (index <= 2) ? CinePlayer::Pacing::RealTime : CinePlayer::Pacing::Fast;
+    player_.play(pacing, (index % 2) == 0);
+    ui_->status->showMessage(QStringLiteral("Playing %1 records (%2s)").arg(player_.records()).arg(player_.duration(), 0, 'f', 1));
+}
+
+/// (re)allocates the retrospective cine for the current output size and stream options, discarding its contents
+void Solum::configureCine()
+{
+    const auto bpp = (ui_->format->currentIndex() == Uncompressed8Bit) ? 1u : 4u;
+    const auto bytes = static_cast<uint32_t>(image_->outputSize().width() * image_->outputSize().height()) * bpp;
+    const auto fps = (cine_.fps() > 0) ? cine_.fps() : CINE_FPS;
+    cine_.configure(CINE_SECONDS, fps, bytes, ui_->prescan->isChecked() ? CINE_RAW_BYTES : 0, ui_->imu->isChecked() ? CINE_IMU_RATE : 0,
+        ui_->split->isChecked());
+}
+
+/// saves the retrospective cine to a capture file
+void Solum::onSaveCine()
+{
+    if (!cine_.frames())
+    {
+        ui_->status->showMessage(QStringLiteral("Nothing buffered to save"));
+        return;
+    }
+
+    auto file = QFileDialog::getSaveFileName(this, QStringLiteral("Save Cine"), QDir::homePath() + QStringLiteral("/cine.cine"), QStringLiteral("(*.cine)"));
+    if (file.isEmpty())
+        return;
+
+    CineRecorder recorder;
+    if (!recorder.open(file))
+    {
+        setError(QStringLiteral("Could not create %1").arg(file));
+        return;
+    }
+    const auto n = cine_.save(recorder, CINE_SECONDS);
+    recorder.close();
+    ui_->status->showMessage(QStringLiteral("Saved %1 records (%2s of cine)").arg(n).arg(cine_.duration(), 0, 'f', 1));
+}
+
+/// called when a new image has been decoded
+/// @param[in] stream the stream with the new image, processed or overlay
+void Solum::newProcessedImage(ImageStream stream)
+{
+    ImageInfo nfo;
+    uint64_t bytes = 0;
+    const QImage* img = pipeline_.acquire(stream, nfo, &bytes);
+    acquired_ += bytes;
+    if (!img)
+        return;
+
+    const bool overlay = (stream == ImageStream::Overlay);
+    // a larger output than the cine was sized for needs new slots
+    if (!overlay && imaging_ && static_cast<uint32_t>(nfo.size) > cine_.frameCapacity())
+        configureCine();
+
+    // the simulator can't see the output size requests made on resize, so keep it following the view
+    const auto output = image_->outputSize();
+    if (simulator_.isConnected() && !overlay && (nfo.width != output.width() || nfo.height != output.height()))
+        simulator_.setOutputSize(output.width(), output.height());
 
     if (overlay)
-        image2_->loadImage(img, w, h, bpp, format, sz);
+        image2_->setImage(img);
     else
-        image_->loadImage(img, w, h, bpp, format, sz);
+        image_->setImage(img);
 
-    if (!imu.isNull())
-        render_->update(imu);
+    if (!nfo.imu.isNull())
+        render_->update(nfo.imu);
 }
 
 /// called when a new imu data been sent
-/// @param[in] imu the imu data if valid
-void Solum::newImuData(const QQuaternion& imu)
+/// @param[in] imu the latest imu data if valid
+/// @param[in] samples # of samples received since the last update
+void Solum::newImuData(const QQuaternion& imu, int samples)
 {
     if (!imu.isNull())
     {
         render_->update(imu);
-        ui_->imuStats->setText(QStringLiteral("Collected %1 IMU Samples").arg(++imuSamples_));
+        imuSamples_ += static_cast<uint32_t>(samples);
+        ui_->imuStats->setText(QStringLiteral("Collected %1 IMU Samples").arg(imuSamples_));
     }
 }
 
-/// called when a new pre-scan image has been sent
-/// @param[in] img the image data
-/// @param[in] w width of the image
-/// @param[in] h height of the image
-/// @param[in] bpp the bits per pixel
-/// @param[in] sz size of the image in bytes
-/// @param[in] format the format of the prescan image
-void Solum::newPrescanImage(const void* img, int w, int h, int bpp, int sz, CusImageFormat format)
+/// called when a new pre-scan image has been decoded
+void Solum::newPrescanImage()
 {
-    prescan_->loadImage(img, w, h, bpp, format, sz);
+    ImageInfo nfo;
+    const QImage* img = pipeline_.acquire(ImageStream::Prescan, nfo);
+    if (img)
+        prescan_->setImage(img);
 }
 
 /// called when a new spectrum image has been sent
@@ -784,17 +1196,42 @@ void Solum::onConnect()
 {
     if (!connected_)
     {
+        // the sources are exclusive, playback has to be switched off first
+        if (player_.isOpen())
+        {
+            ui_->status->showMessage(QStringLiteral("Stop playback before connecting"));
+            return;
+        }
+
+        // the selection stays disabled until the attempt fails or the connection drops
+        ui_->playback->setEnabled(false);
+        if (ui_->simulate->isChecked())
+        {
+            simulator_.setOutputSize(image_->outputSize().width(), image_->outputSize().height());
+            if (!simulator_.connect())
+            {
+                ui_->status->showMessage(QStringLiteral("Simulator failed to start"));
+                ui_->playback->setEnabled(true);
+            }
+            return;
+        }
+
         auto prms = solumDefaultConnectionParams();
         prms.ipAddress = ui_->ip->text().toStdString().c_str();
         prms.port = ui_->port->text().toInt();
         if (solumConnect(&prms) < 0)
+        {
             ui_->status->showMessage(QStringLiteral("Connection failed"));
+            ui_->playback->setEnabled(true);
+        }
         else
             ui_->status->showMessage(QStringLiteral("Trying connection"));
 
         settings_->setValue("ip", ui_->ip->text());
         settings_->setValue("port", ui_->port->text());
     }
+    else if (simulator_.isConnected())
+        simulator_.disconnect();
     else
     {
         if (solumDisconnect() < 0)
@@ -808,7 +1245,8 @@ void Solum::onFreeze()
     if (!connected_)
         return;
 
-    if (solumRun(imaging_ ? 0 : 1) < 0)
+    const bool ok = simulator_.isConnected() ? simulator_.run(!imaging_) : (solumRun(imaging_ ? 0 : 1) == 0);
+    if (!ok)
         ui_->status->showMessage(QStringLiteral("Error requesting imaging run/stop"));
     else
     {
@@ -870,7 +1308,9 @@ void Solum::onLoad()
     if (!connected_)
         return;
 
-    if (solumLoadApplication(ui_->probes->currentText().toStdString().c_str(), ui_->workflows->currentText().toStdString().c_str()) < 0)
+    if (simulator_.isConnected())
+        simulator_.loadApplication(ui_->probes->currentText().toStdString().c_str(), ui_->workflows->currentText().toStdString().c_str());
+    else if (solumLoadApplication(ui_->probes->currentText().toStdString().c_str(), ui_->workflows->currentText().toStdString().c_str()) < 0)
         ui_->status->showMessage(QStringLiteral("Error requesting application load"));
     // update depth range on a successful load
     else
@@ -905,47 +1345,47 @@ void Solum::onProbeSelected(const QString &probe)
 /// increases the depth
 void Solum::incDepth()
 {
-    auto v = solumGetParam(ImageDepth);
+    auto v = getParam(ImageDepth);
     if (v != -1)
-        solumSetParam(ImageDepth, v + 1.0);
+        setParam(ImageDepth, v + 1.0);
 }
 
 /// decreases the depth
 void Solum::decDepth()
 {
-    auto v = solumGetParam(ImageDepth);
+    auto v = getParam(ImageDepth);
     if (v > 1.0)
-        solumSetParam(ImageDepth, v - 1.0);
+        setParam(ImageDepth, v - 1.0);
 }
 
 /// called when gain adjusted
 /// @param[in] gn the gain level
 void Solum::onGain(int gn)
 {
-    solumSetParam(Gain, gn);
+    setParam(Gain, gn);
 }
 
 /// called when manual focus adjusted
 /// @param[in] fd the focus depth
 void Solum::onFocus(int fd)
 {
-    auto v = solumGetParam(ImageDepth);
+    auto v = getParam(ImageDepth);
     if (fd < v)
-        solumSetParam(FocusDepth, fd);
+        setParam(FocusDepth, fd);
 }
 
 /// called when color gain adjusted
 /// @param[in] gn the gain level
 void Solum::onColorGain(int gn)
 {
-    solumSetParam(ColorGain, gn);
+    setParam(ColorGain, gn);
 }
 
 /// called when strain opacity adjusted
 /// @param[in] gn the opacity level
 void Solum::onOpacity(int gn)
 {
-    solumSetParam(StrainOpacity, gn);
+    setParam(StrainOpacity, gn);
 }
 
 /// called when auto gain enable adjusted
@@ -953,7 +1393,7 @@ void Solum::onOpacity(int gn)
 void Solum::onAutoGain(int state)
 {
     bool en = (state == Qt::Checked);
-    solumSetParam(AutoGain, en ? 1 : 0);
+    setParam(AutoGain, en ? 1 : 0);
     ui_->tgctop->setEnabled(en ? false: true);
     ui_->tgcmid->setEnabled(en ? false: true);
     ui_->tgcbottom->setEnabled(en ? false: true);
@@ -968,7 +1408,7 @@ void Solum::onAutoGain(int state)
 void Solum::onAutoFocus(int state)
 {
     bool en = (state == Qt::Checked);
-    solumSetParam(AutoFocus, en ? 1 : 0);
+    setParam(AutoFocus, en ? 1 : 0);
     ui_->focus->setEnabled(en ? false: true);
 }
 
@@ -977,14 +1417,14 @@ void Solum::onAutoFocus(int state)
 void Solum::onImu(int state)
 {
     ui_->_tabs->setTabEnabled(IMU_TAB, (state == Qt::Checked));
-    solumSetParam(ImuStreaming, (state == Qt::Checked) ? 1 : 0);
+    setParam(ImuStreaming, (state == Qt::Checked) ? 1 : 0);
 }
 
 /// called when rf stream enable adjusted
 /// @param[in] state checkbox state
 void Solum::onRfStream(int state)
 {
-    solumSetParam(RfStreaming, (state == Qt::Checked) ? 1 : 0);
+    setParam(RfStreaming, (state == Qt::Checked) ? 1 : 0);
 }
 
 /// called when raw buffer enable adjusted
@@ -992,25 +1432,77 @@ void Solum::onRfStream(int state)
 void Solum::onRawBuffer(int state)
 {
     ui_->_tabs->setTabEnabled(RAW_TAB, (state == Qt::Checked));
-    solumSetParam(RawBuffer, (state == Qt::Checked) ? 1 : 0);
+    setParam(RawBuffer, (state == Qt::Checked) ? 1 : 0);
 }
 
 /// checks raw data availability
 void Solum::onRawAvailability()
 {
-    solumRawDataAvailability([](int res, int n_b, const long long*, int n_iqrf, const long long*)
+    if (solumRawDataAvailability([](int res, int n_b, const long long* b, int n_iqrf, const long long* iqrf)
     {
-        QApplication::postEvent(_me, new event::RawAvailability(res, n_b, n_iqrf));
-    });
+        QApplication::postEvent(_me, new event::RawAvailability(res, n_b, n_iqrf, b, iqrf));
+    }) < 0)
+    {
+        rawData_.partition_ = false;
+        ui_->status->showMessage(QStringLiteral("Error Requesting Raw Availability"));
+    }
 }
 
 /// tries to download raw data
 void Solum::onRawDownload()
 {
-    solumRequestRawData(0, 0, 1, [](int sz, const char* extension)
+    if (rawData_.ptr_ || rawData_.partition_ || rawData_.outstanding_ || !rawData_.ranges_.empty())
     {
-        QApplication::postEvent(_me, new event::RawReady(sz, QString::fromLatin1(extension)));
-    });
+        ui_->status->showMessage(QStringLiteral("Raw Download Already In Progress"));
+        return;
+    }
+
+    // overlapping relies on the probe packaging a range while the previous package is read, which the sdk doesn't
+    // document, so ranges are packaged one after the other unless asked for
+    rawData_.overlap_ = ui_->rawOverlap->isChecked();
+    rawData_.serial_ = !rawData_.overlap_;
+
+    // partitioned downloads are built from the timestamps of what's buffered
+    rawData_.parts_ = ui_->rawParts->value();
+    if (rawData_.parts_ > 1)
+    {
+        rawData_.partition_ = true;
+        onRawAvailability();
+        return;
+    }
+
+    if (solumRequestRawData(0, 0, 1, [](int sz, const char* extension)
+    {
+        QApplication::postEvent(_me, new event::RawReady(sz, extension));
+    }) < 0)
+        ui_->status->showMessage(QStringLiteral("Error Requesting Raw Data"));
+    else
+        rawData_.outstanding_++;
+}
+
+/// opens a downloaded raw package and indexes its frames
+void Solum::onRawOpen()
+{
+    auto file = QFileDialog::getOpenFileName(this, QStringLiteral("Open Raw Package"), QDir::homePath(), QStringLiteral("(*.tar)"));
+    if (file.isEmpty())
+        return;
+
+    QElapsedTimer tm;
+    tm.start();
+    if (!package_.open(file))
+    {
+        setError(QStringLiteral("Could not decode %1").arg(file));
+        return;
+    }
+
+    int counts[3] = { 0, 0, 0 };
+    for (const auto& f : package_.frames())
+    {
+        if (f.type != RawPackage::Type::Other)
+            counts[static_cast<int>(f.type)]++;
+    }
+    ui_->status->showMessage(QStringLiteral("Indexed %1 B, %2 IQ & %3 RF Frames From %4 Members in %5 ms")
+        .arg(counts[0]).arg(counts[1]).arg(counts[2]).arg(package_.members()).arg(tm.elapsed()));
 }
 
 /// called when separate overlays is changed
@@ -1020,6 +1512,9 @@ void Solum::onSplit(int state)
     bool en = (state == Qt::Checked);
     solumSeparateOverlays(en ? 1 : 0);
     image2_->setVisible(en);
+    // the overlays need a ring of their own in the cine
+    if (imaging_)
+        configureCine();
 }
 
 /// called when separate overlays is changed
@@ -1066,19 +1561,19 @@ void Solum::tgcBottom(int v)
 /// get the initial parameter values
 void Solum::getParams()
 {
-    auto v = solumGetParam(ImageDepth);
+    auto v = getParam(ImageDepth);
     if (v != -1 && image_)
         image_->setDepth(v);
 
-    v = solumGetParam(AutoGain);
+    v = getParam(AutoGain);
     ui_->autogain->setChecked(v > 0);
-    v = solumGetParam(AutoFocus);
+    v = getParam(AutoFocus);
     ui_->autofocus->setChecked(v > 0);
-    v = solumGetParam(ImuStreaming);
+    v = getParam(ImuStreaming);
     ui_->imu->setChecked(v > 0);
-    v = solumGetParam(RfStreaming);
+    v = getParam(RfStreaming);
     ui_->rfStream->setChecked(v > 0);
-    v = solumGetParam(RawBuffer);
+    v = getParam(RawBuffer);
     ui_->rawBuffer->setChecked(v > 0);
 
     CusTgc t;
@@ -1098,7 +1593,7 @@ void Solum::getParams()
 void Solum::onMode(int mode)
 {
     auto m = static_cast<CusMode>(mode);
-    if (solumSetMode(m) < 0)
+    if (simulator_.isConnected() ? !simulator_.setMode(m) : (solumSetMode(m) < 0))
         ui_->status->showMessage(QStringLiteral("Error setting imaging mode"));
     else
     {
@@ -1109,6 +1604,7 @@ void Solum::onMode(int mode)
         ui_->opacity->setVisible(m == Strain);
         ui_->rfzoom->setVisible(m == RfMode);
         ui_->rfStream->setVisible(m == RfMode);
+        ui_->rfLines->setVisible(m == RfMode);
         ui_->split->setVisible(m == ColorMode || m == PowerMode || m == Strain);
 
         updateVelocity(m);
@@ -1125,7 +1621,7 @@ void Solum::updateVelocity(CusMode mode)
     {
         QTimer::singleShot(1000, this, [this] ()
         {
-            auto v = solumGetParam(DopplerVelocity);
+            auto v = getParam(DopplerVelocity);
             if (v)
             {
                 ui_->velocity->setText(QStringLiteral("+/- %1cm/s").arg(v));
@@ -1134,12 +1630,39 @@ void Solum::updateVelocity(CusMode mode)
     }
 }
 
+/// sets an imaging parameter on the simulator or the connected probe
+/// @param[in] prm the parameter
+/// @param[in] val the new value
+/// @return success of the call
+bool Solum::setParam(CusParam prm, double val)
+{
+    if (simulator_.isConnected())
+        return simulator_.setParam(prm, val);
+
+    return (solumSetParam(prm, val) == 0);
+}
+
+/// retrieves an imaging parameter from the simulator or the connected probe
+/// @param[in] prm the parameter
+/// @return the parameter value, -1 on error
+double Solum::getParam(CusParam prm)
+{
+    return simulator_.isConnected() ? simulator_.getParam(prm) : solumGetParam(prm);
+}
+
 /// called when rf zoom adjusted
 void Solum::onZoom(int zoom)
 {
     signal_->setZoom(zoom);
 }
 
+/// called when the # of overlaid rf lines is adjusted
+/// @param[in] lines the # of lines to overlay around the center line
+void Solum::onRfLines(int lines)
+{
+    signal_->setLines(-1, lines);
+}
+
 /// called when user asks to fetch a low level parameter value
 void Solum::onLowLevelFetch()
 {
@@ -1,6 +1,18 @@
 #pragma once
 
 #include "ble.h"
+#include "cinebuffer.h"
+#include "eventpool.h"
+#include "filter.h"
+#include "fusion.h"
+#include "imu.h"
+#include "npy.h"
+#include "pipeline.h"
+#include "player.h"
+#include "rawpackage.h"
+#include "recorder.h"
+#include "simulator.h"
+#include "volume.h"
 #include <sdk/solum_def.h>
 
 namespace Ui
@@ -33,26 +45,27 @@ class ProbeRender;
 #define RAWREADY_EVENT      static_cast<QEvent::Type>(QEvent::User + 17)
 #define RAWDOWNLOADED_EVENT static_cast<QEvent::Type>(QEvent::User + 18)
 #define IMU_PORT_EVENT      static_cast<QEvent::Type>(QEvent::User + 19)
+#define EVENT_COUNT         19  // # of custom events, numbered from QEvent::User + 1
 
 namespace event
 {
     /// wrapper for connection events that can be posted from the api callbacks
-    class Connection : public QEvent
+    class Connection : public QEvent, public Pooled<Connection>
     {
     public:
         /// default constructor
         /// @param[in] res the connection result
         /// @param[in] port the connection port
         /// @param[in] msg connection message
-        Connection(CusConnection res, int port, const QString& msg) : QEvent(CONNECT_EVENT), result_(res), port_(port), message_(msg) { }
+        Connection(CusConnection res, int port, const char* msg) : QEvent(CONNECT_EVENT), result_(res), port_(port) { copyText(message_, msg); }
 
-        CusConnection result_;  ///< connection result
-        int port_;              ///< connection port
-        QString message_;       ///< message
+        CusConnection result_;      ///< connection result
+        int port_;                  ///< connection port
+        char message_[EVENT_TEXT];  ///< message
     };
 
     /// wrapper for certificate validation events that can be posted from the api callbacks
-    class Cert : public QEvent
+    class Cert : public QEvent, public Pooled<Cert>
     {
     public:
         /// default constructor
@@ -63,7 +76,7 @@ namespace event
     };
 
     /// wrapper for power down events that can be posted from the api callbacks
-    class PowerDown : public QEvent
+    class PowerDown : public QEvent, public Pooled<PowerDown>
     {
     public:
         /// default constructor
@@ -76,7 +89,7 @@ namespace event
     };
 
     /// wrapper for software update that can be posted from the api callbacks
-    class SwUpdate : public QEvent
+    class SwUpdate : public QEvent, public Pooled<SwUpdate>
     {
     public:
         /// default constructor
@@ -101,35 +114,20 @@ namespace event
         bool probes_;       ///< flag for probes vs applications
     };
 
-    /// wrapper for new image events that can be posted from the api callbacks
-    class Image : public QEvent
+    /// wrapper for decoded image notifications that are posted from the image pipeline
+    class Decoded : public QEvent, public Pooled<Decoded>
     {
     public:
         /// default constructor
         /// @param[in] evt the event type
-        /// @param[in] data the image data
-        /// @param[in] w the image width
-        /// @param[in] h the image height
-        /// @param[in] bpp the image bits per pixel
-        /// @param[in] format the image format
-        /// @param[in] sz total size of the image
-        /// @param[in] overlay flag if the image came from a separated overlay
-        /// @param[in] imu latest imu data if sent
-        Image(QEvent::Type evt, const void* data, int w, int h, int bpp, CusImageFormat format, int sz, bool overlay, const QQuaternion& imu) : QEvent(evt),
-            data_(data), width_(w), height_(h), bpp_(bpp), format_(format), size_(sz), overlay_(overlay), imu_(imu) { }
-
-        const void* data_;      ///< pointer to the image data
-        int width_;             ///< width of the image
-        int height_;            ///< height of the image
-        int bpp_ ;              ///< bits per pixel
-        CusImageFormat format_; ///< image format
-        int size_;              ///< total size of image
-        bool overlay_;          ///< flag if the image came from a separated overlay
-        QQuaternion imu_;       ///< latest imu position
+        /// @param[in] stream the stream with a new image ready
+        Decoded(QEvent::Type evt, ImageStream stream) : QEvent(evt), stream_(stream) { }
+
+        ImageStream stream_;    ///< stream with a new image ready
     };
 
     /// wrapper for new spectrum events that can be posted from the api callbacks
-    class SpectrumImage : public QEvent
+    class SpectrumImage : public QEvent, public Pooled<SpectrumImage>
     {
     public:
         /// default constructor
@@ -147,7 +145,7 @@ namespace event
     };
 
     /// wrapper for new rf events that can be posted from the api callbacks
-    class RfImage : public Image
+    class RfImage : public QEvent, public Pooled<RfImage>
     {
     public:
         /// default constructor
@@ -158,14 +156,20 @@ namespace event
         /// @param[in] sz total size of the image
         /// @param[in] lateral lateral spacing between lines
         /// @param[in] axial sample size
-        RfImage(const void* data, int l, int s, int bps, int sz, double lateral, double axial) : Image(RF_EVENT, data, l, s, bps, Uncompressed, sz, false, QQuaternion()), lateral_(lateral), axial_(axial) { }
-
+        RfImage(const void* data, int l, int s, int bps, int sz, double lateral, double axial) : QEvent(RF_EVENT),
+            data_(data), lines_(l), samples_(s), bps_(bps), size_(sz), lateral_(lateral), axial_(axial) { }
+
+        const void* data_;  ///< pointer to the rf data
+        int lines_;         ///< # of rf lines
+        int samples_;       ///< # of samples per line
+        int bps_;           ///< bits per sample
+        int size_;          ///< total size of the data
         double lateral_;    ///< spacing between each line
         double axial_;      ///< sample size
     };
 
     /// wrapper for imaging state events that can be posted from the api callbacks
-    class Imaging : public QEvent
+    class Imaging : public QEvent, public Pooled<Imaging>
     {
     public:
         /// default constructor
@@ -178,7 +182,7 @@ namespace event
     };
 
     /// wrapper for button press events that can be posted from the api callbacks
-    class Button : public QEvent
+    class Button : public QEvent, public Pooled<Button>
     {
     public:
         /// default constructor
@@ -191,7 +195,7 @@ namespace event
     };
 
     /// wrapper for button press events that can be posted from the api callbacks
-    class Tee : public QEvent
+    class Tee : public QEvent, public Pooled<Tee>
     {
     public:
         /// default constructor
@@ -201,19 +205,25 @@ namespace event
         /// @param[in] id the patient id
         /// @param[in] name the patient name
         /// @param[in] exam the exam id
-        Tee(bool connected, const QString& serial, double timeRemaining, const QString& id, const QString& name, const QString& exam) :
-            QEvent(TEE_EVENT), connected_(connected), serial_(serial), timeRemaining_(timeRemaining), id_(id), name_(name), exam_(exam) { }
-
-        bool connected_;        ///< connected flag
-        QString serial_;        ///< serial number
-        double timeRemaining_;  ///< time remaining in percent
-        QString id_;            ///< patient id
-        QString name_;          ///< patient name
-        QString exam_;          ///< exam id
+        Tee(bool connected, const char* serial, double timeRemaining, const char* id, const char* name, const char* exam) :
+            QEvent(TEE_EVENT), connected_(connected), timeRemaining_(timeRemaining)
+        {
+            copyText(serial_, serial);
+            copyText(id_, id);
+            copyText(name_, name);
+            copyText(exam_, exam);
+        }
+
+        bool connected_;                ///< connected flag
+        char serial_[EVENT_SHORT_TEXT]; ///< serial number
+        double timeRemaining_;          ///< time remaining in percent
+        char id_[EVENT_SHORT_TEXT];     ///< patient id
+        char name_[EVENT_TEXT];         ///< patient name
+        char exam_[EVENT_SHORT_TEXT];   ///< exam id
     };
 
     /// wrapper for new imu data events that can be posted from the api callbacks
-    class ImuPort : public QEvent
+    class ImuPort : public QEvent, public Pooled<ImuPort>
     {
     public:
         /// default constructor
@@ -224,31 +234,34 @@ namespace event
     };
 
     /// wrapper for new imu data events that can be posted from the api callbacks
-    class Imu : public QEvent
+    class Imu : public QEvent, public Pooled<Imu>
     {
     public:
         /// default constructor
         /// @param[in] imu latest imu data
-        explicit Imu(const QQuaternion& imu) : QEvent(IMU_EVENT), imu_(imu) { }
+        /// @param[in] samples # of samples delivered since the last event
+        Imu(const QQuaternion& imu, int samples) : QEvent(IMU_EVENT), imu_(imu), samples_(samples) { }
 
         QQuaternion imu_;   ///< latest imu position
+        int samples_;       ///< # of samples in the batch
     };
 
 
     /// wrapper for error events that can be posted from the api callbacks
-    class Error : public QEvent
+    class Error : public QEvent, public Pooled<Error>
     {
     public:
         /// default constructor
+        /// @param[in] code the error code
         /// @param[in] err the error message
-        explicit Error(CusErrorCode code, const QString& err) : QEvent(ERROR_EVENT), code_(code), error_(err) { }
+        explicit Error(CusErrorCode code, const char* err) : QEvent(ERROR_EVENT), code_(code) { copyText(error_, err); }
 
-        CusErrorCode code_;     ///< error code
-        QString error_;         ///< error message
+        CusErrorCode code_;         ///< error code
+        char error_[EVENT_TEXT];    ///< error message
     };
 
     /// wrapper for progress events that can be posted from the api callbacks
-    class Progress : public QEvent
+    class Progress : public QEvent, public Pooled<Progress>
     {
     public:
         /// default constructor
@@ -268,28 +281,37 @@ namespace event
         /// @param[in] res the result of the api call
         /// @param[in] b number of b raw frames available
         /// @param[in] iqrf number of iq/rf raw frames available
-        RawAvailability(int res, int b, int iqrf) : QEvent(RAWAVAIL_EVENT), res_(res), b_(b), iqrf_(iqrf) { }
+        /// @param[in] bTimes timestamps of the b frames
+        /// @param[in] iqrfTimes timestamps of the iq/rf frames
+        RawAvailability(int res, int b, int iqrf, const long long* bTimes, const long long* iqrfTimes) : QEvent(RAWAVAIL_EVENT), res_(res), b_(b), iqrf_(iqrf)
+        {
+            if (bTimes && b > 0)
+                times_.assign(bTimes, bTimes + b);
+            if (iqrfTimes && iqrf > 0)
+                times_.insert(times_.end(), iqrfTimes, iqrfTimes + iqrf);
+        }
 
-        int res_;   ///< result
-        int b_;     ///< b frames
-        int iqrf_;  ///< iqrf frames
+        int res_;                       ///< result
+        int b_;                         ///< b frames
+        int iqrf_;                      ///< iqrf frames
+        std::vector<long long> times_;  ///< timestamps of all frames
     };
 
     /// wrapper for raw ready events that can be posted from the api callbacks
-    class RawReady : public QEvent
+    class RawReady : public QEvent, public Pooled<RawReady>
     {
     public:
         /// default constructor
         /// @param[in] sz size of the buffer created
         /// @param[in] ext extension of the file package
-        RawReady(int sz, const QString& ext) : QEvent(RAWREADY_EVENT), sz_(sz), ext_(ext) { }
+        RawReady(int sz, const char* ext) : QEvent(RAWREADY_EVENT), sz_(sz) { copyText(ext_, ext); }
 
-        int sz_;        ///< size of the package
-        QString ext_;   ///< package extension
+        int sz_;                        ///< size of the package
+        char ext_[EVENT_SHORT_TEXT];    ///< package extension
     };
 
     /// wrapper for raw downloaded events that can be posted from the api callbacks
-    class RawDownloaded: public QEvent
+    class RawDownloaded : public QEvent, public Pooled<RawDownloaded>
     {
     public:
         /// default constructor
@@ -304,12 +326,25 @@ namespace event
 class RawData
 {
 public:
-    RawData() : size_(0), ptr_(nullptr) { }
-
-    QString file_;
-    int size_;
-    QByteArray data_;
-    char* ptr_;
+    RawData() : size_(0), ptr_(nullptr), parts_(1), part_(0), requested_(0), pending_(0), outstanding_(0), stale_(0), overlap_(false), serial_(false),
+        partition_(false) { }
+
+    QString file_;      ///< destination path
+    int size_;          ///< package size
+    QFile out_;         ///< destination file, mapped while the download is in progress
+    char* ptr_;         ///< buffer handed to the sdk
+    // partitioned downloads
+    int parts_;         ///< # of ranges requested
+    std::vector<std::pair<long long, long long>> ranges_;   ///< timestamp ranges, empty when downloading the whole buffer
+    int part_;          ///< range being downloaded
+    int requested_;     ///< latest range requested from the probe
+    int pending_;       ///< size of a range packaged while the previous one was downloading, 0 if none
+    QString pendingExt_;///< extension of the pending range
+    int outstanding_;   ///< # of package requests waiting for their reply
+    int stale_;         ///< # of replies still due from a download that ended, dropped when they arrive
+    bool overlap_;      ///< set when the next range is packaged while the previous one downloads
+    bool serial_;       ///< set when ranges are packaged one after the other
+    bool partition_;    ///< set while waiting for the availability that the ranges are built from
 };
 
 using Probes = std::map<QString,QString>;
@@ -323,6 +358,19 @@ public:
     explicit Solum(QWidget *parent = nullptr);
     ~Solum() override;
 
+    TemporalFilter& filter() { return filter_; }
+    CineRecorder& recorder() { return recorder_; }
+    NpyExporter& exporter() { return exporter_; }
+    VolumeBuilder& volume() { return volume_; }
+    ImuBuffer& imu() { return imu_; }
+    ImuBatcher& imuBatcher() { return imuBatcher_; }
+    ImuFusion& fusion() { return fusion_; }
+    ImagePipeline& pipeline() { return pipeline_; }
+    bool fuseImu() const { return fuse_; }
+    CinePlayer& player() { return player_; }
+    Simulator& simulator() { return simulator_; }
+    CineBuffer& cine() { return cine_; }
+
 protected:
     virtual bool event(QEvent *event) override;
     virtual void closeEvent(QCloseEvent *event) override;
@@ -330,11 +378,11 @@ protected:
 private:
     void loadProbes(const QStringList& probes);
     void loadApplications(const QStringList& probes);
-    void newProcessedImage(const void* img, int w, int h, int bpp, CusImageFormat format, int sz, bool overlay, const QQuaternion& imu);
-    void newPrescanImage(const void* img, int w, int h, int bpp, int sz, CusImageFormat format);
+    void newProcessedImage(ImageStream stream);
+    void newPrescanImage();
     void newSpectrumImage(const void* img, int l, int s, int bps);
     void newRfImage(const void* rf, int l, int s, int ss);
-    void newImuData(const QQuaternion& imu);
+    void newImuData(const QQuaternion& imu, int samples);
     void setConnected(CusConnection res, int port, const QString& msg);
     void certification(int daysValid);
     void poweringDown(CusPowerDown res, int tm);
@@ -342,13 +390,19 @@ private:
     void imagingState(CusImagingState state, bool imaging);
     void onButton(CusButton btn, int clicks);
     void onTee(bool connected, const QString& serial, double timeRemaining);
-    void onRawAvailabilityResult(int res, int b, int iqrf);
+    void onRawAvailabilityResult(int res, int b, int iqrf, const std::vector<long long>& times);
     void onRawReadyToDownload(int sz, const QString& ext);
     void onRawDownloaded(int res);
+    bool requestRawPart(int part);
+    void readRawData(int sz, const QString& ext);
+    void endRawDownload();
     void setProgress(int selection, int progress);
     void setError(const QString& err);
     void getParams();
     void updateVelocity(CusMode mode);
+    bool setParam(CusParam prm, double val);
+    double getParam(CusParam prm);
+    void configureCine();
 
 public slots:
     void onRetrieve();
@@ -368,6 +422,7 @@ public slots:
     void onProbeSelected(const QString& probe);
     void onMode(int);
     void onZoom(int);
+    void onRfLines(int);
     void incDepth();
     void decDepth();
     void onGain(int);
@@ -383,10 +438,19 @@ public slots:
     void tgcMid(int);
     void tgcBottom(int);
     void onFormat(int);
+    void onPersistence(int);
+    void onRecord(int);
+    void onExport(int);
+    void onImuFormat(int);
+    void onVolume(int);
+    void onFuseImu(int);
+    void onPlayback(int);
+    void onSaveCine();
     void onRfStream(int);
     void onRawBuffer(int);
     void onRawAvailability();
     void onRawDownload();
+    void onRawOpen();
     void onLowLevelFetch();
     void onLowLevelSet();
     void onLowLevelToggle();
@@ -412,5 +476,18 @@ private:
     Probes certified_;              ///< list of certified probes
     RawData rawData_;               ///< holds raw data info
     CusAcoustic acoustic_;          ///< holds latest acoustic data
+    TemporalFilter filter_;         ///< persistence filter run on the sdk thread
+    CineRecorder recorder_;         ///< cine capture fed from the sdk thread
+    NpyExporter exporter_;          ///< numpy export of raw frames fed from the sdk thread
+    VolumeBuilder volume_;          ///< freehand volume fed from the sdk thread
+    ImuBuffer imu_;                 ///< imu samples for aligning poses to frames
+    ImuBatcher imuBatcher_;         ///< groups streamed imu samples into gui updates
+    ImuFusion fusion_;              ///< host side orientation filter fed from the sdk thread
+    std::atomic_bool fuse_;         ///< replaces the probe orientation with the fused one
+    CinePlayer player_;             ///< cine playback, stands in for a connected probe
+    Simulator simulator_;           ///< simulated probe, used instead of a connection when selected
+    CineBuffer cine_;               ///< retrospective cine of the latest frames
+    ImagePipeline pipeline_;        ///< decodes the images off the gui thread
+    RawPackage package_;            ///< latest raw package opened for analysis
     std::unique_ptr<QSettings> settings_;   ///< persistent settings
 };
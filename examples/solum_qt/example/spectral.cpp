@@ -0,0 +1,234 @@
+#include "spectral.h"
+#include <solum/solum.h>
+#include <algorithm>
+#include <cmath>
+
+#define PI          3.14159265358979323846
+#define MAX_FFT     4096
+#define POWER_FLOOR 1e-20f
+
+/// default constructor
+/// @param[in] fftSize the fft size, must be a power of 2
+SpectralEngine::SpectralEngine(int fftSize) : fn_(nullptr), size_(0), bits_(0), write_(0), pending_(0), filled_(0), line_(0)
+{
+    params_.hop = 32;
+    params_.linesPerBlock = 8;
+    params_.prf = 4000.0;
+    params_.frequency = 5e6;
+    params_.soundSpeed = 1540.0;
+    params_.gain = 0.0;
+    params_.dynamicRange = 60.0;
+    params_.envelopeThreshold = 20.0;
+    setFftSize(fftSize);
+}
+
+/// sets a new fft size and rebuilds the plan
+/// @param[in] n the fft size, must be a power of 2 between 16 and 4096
+/// @return success of the call
+bool SpectralEngine::setFftSize(int n)
+{
+    if (n < 16 || n > MAX_FFT || (n & (n - 1)))
+        return false;
+
+    size_ = n;
+    bits_ = 0;
+    while ((1 << bits_) < n)
+        bits_++;
+    plan();
+    return true;
+}
+
+/// sets the estimation parameters
+/// @param[in] params the new parameters
+void SpectralEngine::setParams(const SpectralParams& params)
+{
+    params_ = params;
+    params_.hop = std::clamp(params_.hop, 1, size_);
+    params_.linesPerBlock = std::max(1, params_.linesPerBlock);
+    block_.resize(static_cast<size_t>(params_.linesPerBlock) * static_cast<size_t>(size_));
+    peak_.resize(params_.linesPerBlock);
+    mean_.resize(params_.linesPerBlock);
+    line_ = 0;
+}
+
+/// updates the prf from the current pw doppler setting on the probe
+/// @return success of the call
+bool SpectralEngine::fetchPrf()
+{
+    auto prf = solumGetParam(PwPrf);
+    if (prf <= 0)
+        return false;
+
+    params_.prf = prf * 1000.0;
+    return true;
+}
+
+/// clears the sample history, typically called when the gate moves
+void SpectralEngine::reset()
+{
+    std::fill(history_.begin(), history_.end(), std::complex<float>());
+    write_ = 0;
+    pending_ = 0;
+    filled_ = 0;
+    line_ = 0;
+}
+
+/// builds the fft plan and sizes all working buffers, the only place the engine allocates
+void SpectralEngine::plan()
+{
+    const auto n = static_cast<size_t>(size_);
+    history_.assign(n, std::complex<float>());
+    work_.resize(n);
+    spectrum_.resize(n);
+    window_.resize(n);
+    reverse_.resize(n);
+    twiddle_.resize(n / 2);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t r = 0;
+        for (auto b = 0; b < bits_; b++)
+            r |= ((static_cast<uint32_t>(i) >> b) & 1u) << (bits_ - 1 - b);
+        reverse_[i] = r;
+        window_[i] = static_cast<float>(0.5 - 0.5 * std::cos((2.0 * PI * static_cast<double>(i)) / static_cast<double>(n - 1)));
+    }
+    for (size_t i = 0; i < n / 2; i++)
+    {
+        const double a = (-2.0 * PI * static_cast<double>(i)) / static_cast<double>(n);
+        twiddle_[i] = std::complex<float>(static_cast<float>(std::cos(a)), static_cast<float>(std::sin(a)));
+    }
+
+    setParams(params_);
+    reset();
+}
+
+/// retrieves the velocity resolution of the spectrum
+/// @return the velocity in m/s represented by each spectral sample
+double SpectralEngine::velocityPerSample() const
+{
+    return (params_.frequency > 0) ? (params_.soundSpeed * params_.prf) / (2.0 * params_.frequency * size_) : 0.0;
+}
+
+/// pushes new slow time samples from the gate
+/// @param[in] iq interleaved 16 bit i/q samples
+/// @param[in] n # of complex samples
+/// @return the # of spectral lines generated
+int SpectralEngine::push(const int16_t* iq, int n)
+{
+    if (!iq || n <= 0)
+        return 0;
+
+    int lines = 0;
+    for (auto i = 0; i < n; i++)
+    {
+        history_[write_] = std::complex<float>(iq[i * 2], iq[(i * 2) + 1]);
+        write_ = (write_ + 1) & (size_ - 1);
+        filled_ = std::min(filled_ + 1, size_);
+        if (++pending_ >= params_.hop && filled_ == size_)
+        {
+            pending_ = 0;
+            line();
+            lines++;
+        }
+    }
+
+    return lines;
+}
+
+/// windowed in place radix-2 fft of the history ring into the work buffer
+void SpectralEngine::fft()
+{
+    // the oldest sample sits at the write position
+    for (auto i = 0; i < size_; i++)
+        work_[reverse_[i]] = history_[(write_ + i) & (size_ - 1)] * window_[i];
+
+    for (int len = 2, step = size_ / 2; len <= size_; len <<= 1, step >>= 1)
+    {
+        const int half = len / 2;
+        for (auto i = 0; i < size_; i += len)
+        {
+            for (auto j = 0; j < half; j++)
+            {
+                const auto u = work_[i + j];
+                const auto v = work_[i + j + half] * twiddle_[j * step];
+                work_[i + j] = u + v;
+                work_[i + j + half] = u - v;
+            }
+        }
+    }
+}
+
+/// computes a spectral line and its envelopes, delivering the block when full
+void SpectralEngine::line()
+{
+    fft();
+
+    // power relative to a full scale tone through the window (coherent gain of 0.5)
+    const float fs = 32768.0f * static_cast<float>(size_) * 0.5f;
+    const float ref = 1.0f / (fs * fs);
+    const int half = size_ / 2;
+    float peakDb = -1e9f;
+    for (auto j = 0; j < size_; j++)
+    {
+        // shift so that bin half is zero velocity
+        const auto& c = work_[(j + half) & (size_ - 1)];
+        const float db = 10.0f * std::log10(std::max(std::norm(c) * ref, POWER_FLOOR));
+        spectrum_[j] = db;
+        peakDb = std::max(peakDb, db);
+    }
+
+    // positive velocities are drawn at the top of the line
+    uint8_t* row = block_.data() + (static_cast<size_t>(line_) * static_cast<size_t>(size_));
+    const float dr = static_cast<float>(std::max(1.0, params_.dynamicRange));
+    const float offset = static_cast<float>(params_.gain) + dr;
+    for (auto j = 0; j < size_; j++)
+        row[size_ - 1 - j] = static_cast<uint8_t>(std::clamp((spectrum_[j] + offset) / dr * 255.0f, 0.0f, 255.0f));
+
+    // envelopes from the bins within the threshold of the line peak
+    const auto vps = static_cast<float>(velocityPerSample());
+    const float threshold = peakDb - static_cast<float>(params_.envelopeThreshold);
+    int top = -1, bottom = -1;
+    for (auto j = size_ - 1; j >= half && top < 0; j--)
+        if (spectrum_[j] >= threshold)
+            top = j;
+    for (auto j = 0; j < half && bottom < 0; j++)
+        if (spectrum_[j] >= threshold)
+            bottom = j;
+
+    float peak = 0;
+    if (top >= 0 && (bottom < 0 || (top - half) >= (half - bottom)))
+        peak = (top - half) * vps;
+    else if (bottom >= 0)
+        peak = (bottom - half) * vps;
+
+    float sum = 0, weighted = 0;
+    for (auto j = 0; j < size_; j++)
+    {
+        if (spectrum_[j] >= threshold)
+        {
+            const float p = std::pow(10.0f, (spectrum_[j] - peakDb) / 10.0f);
+            sum += p;
+            weighted += p * (j - half) * vps;
+        }
+    }
+
+    peak_[line_] = peak;
+    mean_[line_] = (sum > 0) ? (weighted / sum) : 0.0f;
+
+    if (++line_ >= params_.linesPerBlock)
+    {
+        line_ = 0;
+        if (fn_)
+        {
+            CusSpectralImageInfo nfo;
+            nfo.lines = params_.linesPerBlock;
+            nfo.samples = size_;
+            nfo.bitsPerSample = 8;
+            nfo.period = (params_.prf > 0) ? (params_.hop / params_.prf) : 0.0;
+            nfo.micronsPerSample = 0;
+            nfo.velocityPerSample = velocityPerSample();
+            nfo.pw = 1;
+            fn_(block_.data(), &nfo);
+        }
+    }
+}
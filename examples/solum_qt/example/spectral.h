@@ -0,0 +1,67 @@
+#pragma once
+
+#include <solum/solum_cb.h>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+/// pw doppler spectral estimation parameters
+struct SpectralParams
+{
+    int hop;                    ///< # of slow time samples between spectral lines (window overlap is fft size - hop)
+    int linesPerBlock;          ///< # of spectral lines delivered per callback
+    double prf;                 ///< pulse repetition frequency in hz
+    double frequency;           ///< transmit center frequency in hz
+    double soundSpeed;          ///< speed of sound in m/s
+    double gain;                ///< display gain in db
+    double dynamicRange;        ///< display dynamic range in db
+    double envelopeThreshold;   ///< level in db below the line peak used to trace the envelope
+};
+
+/// host side spectral engine that turns slow time iq from the pw gate into spectral lines
+///
+/// the fft plan (bit reversal table, twiddles and window) is built once per fft size and reused for every line,
+/// output blocks are delivered through the same callback format the sdk uses for probe rendered spectra
+class SpectralEngine
+{
+public:
+    explicit SpectralEngine(int fftSize = 128);
+
+    bool setFftSize(int n);
+    void setParams(const SpectralParams& params);
+    const SpectralParams& params() const { return params_; }
+    bool fetchPrf();
+    void setCallback(CusNewSpectralImageFn fn) { fn_ = fn; }
+    void reset();
+
+    int push(const int16_t* iq, int n);
+
+    int fftSize() const { return size_; }
+    double velocityPerSample() const;
+    const std::vector<float>& peakEnvelope() const { return peak_; }
+    const std::vector<float>& meanEnvelope() const { return mean_; }
+
+private:
+    void plan();
+    void fft();
+    void line();
+
+private:
+    SpectralParams params_;                 ///< estimation parameters
+    CusNewSpectralImageFn fn_;              ///< block output callback
+    int size_;                              ///< fft size
+    int bits_;                              ///< log2 of the fft size
+    int write_;                             ///< write position in the history ring
+    int pending_;                           ///< samples received since the last line
+    int filled_;                            ///< samples in the history ring, saturates at the fft size
+    int line_;                              ///< current line within the output block
+    std::vector<std::complex<float>> history_;  ///< ring of the latest slow time samples
+    std::vector<std::complex<float>> work_;     ///< fft work buffer
+    std::vector<std::complex<float>> twiddle_;  ///< precomputed twiddle factors
+    std::vector<uint32_t> reverse_;         ///< bit reversal permutation
+    std::vector<float> window_;             ///< hann window
+    std::vector<float> spectrum_;           ///< power spectrum of the current line in db
+    std::vector<uint8_t> block_;            ///< output block, one row of fft size samples per line
+    std::vector<float> peak_;               ///< peak velocity envelope per line of the latest block in m/s
+    std::vector<float> mean_;               ///< mean velocity per line of the latest block in m/s
+};
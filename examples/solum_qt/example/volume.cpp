@@ -0,0 +1,474 @@
+#include "volume.h"
+#include "npy.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define BRICK_SHIFT     3                       // log2 of the brick size
+#define WEIGHT_BITS     24                      // accumulator bits holding the weight
+#define WEIGHT_MASK     ((1ull << WEIGHT_BITS) - 1)
+#define WEIGHT_FULL     255                     // weight of a pixel landing exactly on a voxel
+#define WEIGHT_LIMIT    (1ull << 23)            // weight past which a voxel takes no more samples, keeps the packed sum from overflowing
+
+static_assert(VOLUME_BRICK == (1 << BRICK_SHIFT), "brick size has to match the shift");
+
+/// default constructor
+/// @param[in] threads total # of threads to compound with, 0 to use the hardware concurrency
+VolumeBuilder::VolumeBuilder(int threads) : workers_(threads), dim_(0), bdim_(0), voxelSize_(VOLUME_VOXEL), maxBricks_(0), mode_(VolumeMode::Nearest),
+    bricks_(0), running_(false), quit_(false), head_(0), queued_(0), oriented_(false), frames_(0), dropped_(0)
+{
+    q0_[0] = 1;
+    q0_[1] = q0_[2] = q0_[3] = 0;
+}
+
+/// destructor
+VolumeBuilder::~VolumeBuilder()
+{
+    stop();
+    release();
+}
+
+/// frees all the bricks
+void VolumeBuilder::release()
+{
+    if (directory_)
+    {
+        const auto n = static_cast<size_t>(bdim_) * bdim_ * bdim_;
+        for (size_t i = 0; i < n; i++)
+            delete directory_[i].exchange(nullptr);
+    }
+    directory_.reset();
+    bricks_ = 0;
+}
+
+/// starts a new volume centered on the rotation of the first frame, any previous volume is discarded
+/// @param[in] dim voxels along each edge, rounded up to a whole # of bricks
+/// @param[in] voxelSize voxel size in microns
+/// @param[in] maxBricks limit on allocated bricks, samples falling into further bricks are discarded
+/// @param[in] mode compounding mode
+/// @return success of the call
+bool VolumeBuilder::start(int dim, double voxelSize, int maxBricks, VolumeMode mode)
+{
+    if (running_ || dim <= 0 || voxelSize <= 0 || maxBricks <= 0)
+        return false;
+
+    release();
+    bdim_ = (dim + VOLUME_BRICK - 1) / VOLUME_BRICK;
+    dim_ = bdim_ * VOLUME_BRICK;
+    const auto n = static_cast<size_t>(bdim_) * bdim_ * bdim_;
+    directory_ = std::make_unique<std::atomic<Brick*>[]>(n);
+    for (size_t i = 0; i < n; i++)
+        directory_[i].store(nullptr, std::memory_order_relaxed);
+
+    voxelSize_ = voxelSize;
+    maxBricks_ = maxBricks;
+    mode_ = mode;
+    head_ = 0;
+    queued_ = 0;
+    oriented_ = false;
+    frames_ = 0;
+    dropped_ = 0;
+    quit_ = false;
+    thread_ = std::thread(&VolumeBuilder::loop, this);
+    running_ = true;
+    return true;
+}
+
+/// stops inserting frames, returns once the queued frames are compounded
+void VolumeBuilder::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        running_ = false;
+        quit_ = true;
+    }
+    wake_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+/// queues a frame for compounding, called from the sdk thread
+/// @param[in] img the processed image
+/// @param[in] nfo the image information
+/// @param[in] pose the imu sample aligned to the frame
+/// @note compressed images and overlays can't be compounded and are counted as dropped, as are frames arriving while the queue is full
+void VolumeBuilder::insert(const void* img, const CusProcessedImageInfo* nfo, const CusPosInfo& pose)
+{
+    if (!running_ || !img || !nfo)
+        return;
+
+    const auto norm = std::sqrt((pose.qw * pose.qw) + (pose.qx * pose.qx) + (pose.qy * pose.qy) + (pose.qz * pose.qz));
+    if (nfo->overlay || nfo->width <= 0 || nfo->height <= 0 || nfo->micronsPerPixel <= 0 || norm < 1e-6 ||
+        (nfo->format != Uncompressed && nfo->format != Uncompressed8Bit))
+    {
+        dropped_++;
+        return;
+    }
+
+    const auto bpp = (nfo->format == Uncompressed8Bit) ? 1 : 4;
+    const auto pixels = static_cast<size_t>(nfo->width) * static_cast<size_t>(nfo->height);
+    if (nfo->imageSize < 0 || static_cast<size_t>(nfo->imageSize) < pixels * bpp)
+    {
+        dropped_++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!running_ || queued_ == VOLUME_QUEUE)
+    {
+        dropped_++;
+        return;
+    }
+
+    const double q[4] = { pose.qw / norm, pose.qx / norm, pose.qy / norm, pose.qz / norm };
+    if (!oriented_)
+    {
+        q0_[0] = q[0];
+        q0_[1] = -q[1];
+        q0_[2] = -q[2];
+        q0_[3] = -q[3];
+        oriented_ = true;
+    }
+
+    auto& f = queue_[(head_ + queued_) % VOLUME_QUEUE];
+    f.width = nfo->width;
+    f.height = nfo->height;
+    f.mpp = nfo->micronsPerPixel;
+    f.originX = nfo->originX;
+    f.originY = nfo->originY;
+    // orientation relative to the first frame, so the sweep starts in the xy plane of the volume
+    f.q[0] = (q0_[0] * q[0]) - (q0_[1] * q[1]) - (q0_[2] * q[2]) - (q0_[3] * q[3]);
+    f.q[1] = (q0_[0] * q[1]) + (q0_[1] * q[0]) + (q0_[2] * q[3]) - (q0_[3] * q[2]);
+    f.q[2] = (q0_[0] * q[2]) - (q0_[1] * q[3]) + (q0_[2] * q[0]) + (q0_[3] * q[1]);
+    f.q[3] = (q0_[0] * q[3]) + (q0_[1] * q[2]) - (q0_[2] * q[1]) + (q0_[3] * q[0]);
+
+    f.pixels.resize(pixels);
+    if (bpp == 1)
+        std::memcpy(f.pixels.data(), img, pixels);
+    else
+    {
+        // argb is stored as bgra, colored pixels are reduced to their luminance
+        const uint8_t* src = static_cast<const uint8_t*>(img);
+        for (size_t i = 0; i < pixels; i++, src += 4)
+            f.pixels[i] = static_cast<uint8_t>(((src[2] * 77) + (src[1] * 150) + (src[0] * 29)) >> 8);
+    }
+
+    queued_++;
+    wake_.notify_one();
+}
+
+/// compounding thread loop
+void VolumeBuilder::loop()
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            wake_.wait(lock, [this] { return quit_ || queued_ > 0; });
+            if (queued_ == 0)
+                return;
+        }
+
+        // the head slot isn't touched by the producer until it's released below
+        compound(queue_[head_]);
+        frames_++;
+
+        std::lock_guard<std::mutex> lock(lock_);
+        head_ = (head_ + 1) % VOLUME_QUEUE;
+        queued_--;
+    }
+}
+
+/// retrieves the accumulator of a voxel
+/// @param[in] x the voxel column
+/// @param[in] y the voxel row
+/// @param[in] z the voxel slice
+/// @return the accumulator, null if the voxel is outside the volume or its brick isn't allocated
+std::atomic<uint64_t>* VolumeBuilder::accumulator(int x, int y, int z) const
+{
+    if (x < 0 || y < 0 || z < 0 || x >= dim_ || y >= dim_ || z >= dim_)
+        return nullptr;
+
+    const auto b = (((static_cast<size_t>(z >> BRICK_SHIFT) * bdim_) + (y >> BRICK_SHIFT)) * bdim_) + (x >> BRICK_SHIFT);
+    Brick* brick = directory_[b].load(std::memory_order_acquire);
+    const auto mask = VOLUME_BRICK - 1;
+    return brick ? &brick->acc[(((z & mask) << (2 * BRICK_SHIFT)) | ((y & mask) << BRICK_SHIFT)) | (x & mask)] : nullptr;
+}
+
+/// retrieves the accumulator of a voxel, allocating its brick on the first sample
+/// @param[in] x the voxel column
+/// @param[in] y the voxel row
+/// @param[in] z the voxel slice
+/// @return the accumulator, null if the voxel is outside the volume or the brick limit is reached
+std::atomic<uint64_t>* VolumeBuilder::allocate(int x, int y, int z)
+{
+    if (x < 0 || y < 0 || z < 0 || x >= dim_ || y >= dim_ || z >= dim_)
+        return nullptr;
+
+    const auto b = (((static_cast<size_t>(z >> BRICK_SHIFT) * bdim_) + (y >> BRICK_SHIFT)) * bdim_) + (x >> BRICK_SHIFT);
+    Brick* brick = directory_[b].load(std::memory_order_acquire);
+    if (!brick)
+    {
+        if (bricks_.load(std::memory_order_relaxed) >= maxBricks_)
+            return nullptr;
+        if (bricks_.fetch_add(1) >= maxBricks_)
+        {
+            bricks_--;
+            return nullptr;
+        }
+
+        // threads racing for the same brick keep whichever was published first
+        Brick* fresh = new Brick();
+        if (directory_[b].compare_exchange_strong(brick, fresh, std::memory_order_acq_rel))
+            brick = fresh;
+        else
+        {
+            delete fresh;
+            bricks_--;
+        }
+    }
+
+    const auto mask = VOLUME_BRICK - 1;
+    return &brick->acc[(((z & mask) << (2 * BRICK_SHIFT)) | ((y & mask) << BRICK_SHIFT)) | (x & mask)];
+}
+
+/// adds a sample to the 8 voxels surrounding its position, weighted by the distance to each
+/// @param[in] p the position in voxels
+/// @param[in] v the intensity
+void VolumeBuilder::splat(const double* p, uint64_t v)
+{
+    const auto fx = std::floor(p[0]), fy = std::floor(p[1]), fz = std::floor(p[2]);
+    const int x = static_cast<int>(fx), y = static_cast<int>(fy), z = static_cast<int>(fz);
+    const double wx[2] = { 1 - (p[0] - fx), p[0] - fx }, wy[2] = { 1 - (p[1] - fy), p[1] - fy }, wz[2] = { 1 - (p[2] - fz), p[2] - fz };
+    const auto mask = VOLUME_BRICK - 1;
+
+    // the corners nearly always share a brick, which takes a single lookup
+    std::atomic<uint64_t>* base = nullptr;
+    if ((x & mask) != mask && (y & mask) != mask && (z & mask) != mask)
+    {
+        base = allocate(x, y, z);
+        if (!base)
+            return;
+    }
+
+    for (auto k = 0; k < 8; k++)
+    {
+        const int cx = k & 1, cy = (k >> 1) & 1, cz = (k >> 2) & 1;
+        const auto wt = static_cast<uint64_t>((wx[cx] * wy[cy] * wz[cz] * WEIGHT_FULL) + 0.5);
+        if (!wt)
+            continue;
+        auto acc = base ? (base + ((cz << (2 * BRICK_SHIFT)) | (cy << BRICK_SHIFT) | cx)) : allocate(x + cx, y + cy, z + cz);
+        if (acc && (acc->load(std::memory_order_relaxed) & WEIGHT_MASK) < WEIGHT_LIMIT)
+            acc->fetch_add(((v * wt) << WEIGHT_BITS) | wt, std::memory_order_relaxed);
+    }
+}
+
+/// compounds a frame into the volume
+/// @param[in] f the frame
+void VolumeBuilder::compound(const Frame& f)
+{
+    const double w = f.q[0], x = f.q[1], y = f.q[2], z = f.q[3];
+    const double r[3][2] =
+    {
+        { 1 - (2 * ((y * y) + (z * z))), 2 * ((x * y) - (w * z)) },
+        { 2 * ((x * y) + (w * z)), 1 - (2 * ((x * x) + (z * z))) },
+        { 2 * ((x * z) - (w * y)), 2 * ((y * z) + (w * x)) },
+    };
+
+    // distance weighting already interpolates between voxels, so rather than splatting every pixel the image is box
+    // averaged down to about half a voxel first
+    const int step = (mode_ == VolumeMode::Weighted) ? std::max(1, static_cast<int>(voxelSize_ / (2 * f.mpp))) : 1;
+    const int cols = f.width / step, rows = f.height / step;
+    const double center = (step - 1) / 2.0;
+
+    // image columns run laterally and rows axially, both rotated into voxel units around the transducer position
+    const double scale = (f.mpp * step) / voxelSize_;
+    double col[3], row[3], origin[3];
+    for (auto i = 0; i < 3; i++)
+    {
+        col[i] = r[i][0] * scale;
+        row[i] = r[i][1] * scale;
+        origin[i] = (dim_ / 2.0) + (((r[i][0] * ((center * f.mpp) - f.originX)) + (r[i][1] * ((center * f.mpp) - f.originY))) / voxelSize_);
+    }
+
+    workers_.run(rows, [this, &f, &col, &row, &origin, step, cols](int begin, int end)
+    {
+        for (auto j = begin; j < end; j++)
+        {
+            const uint8_t* src = f.pixels.data() + (static_cast<size_t>(j) * step * f.width);
+            double p[3] = { origin[0] + (j * row[0]), origin[1] + (j * row[1]), origin[2] + (j * row[2]) };
+            for (auto i = 0; i < cols; i++, p[0] += col[0], p[1] += col[1], p[2] += col[2])
+            {
+                // black is treated as no echo data so the sector edges don't blank voxels covered by other frames
+                uint64_t v = src[i];
+                if (step > 1)
+                {
+                    uint32_t sum = 0, count = 0;
+                    for (auto k = 0; k < step; k++)
+                    {
+                        const uint8_t* px = src + (static_cast<size_t>(k) * f.width) + (i * step);
+                        for (auto m = 0; m < step; m++)
+                        {
+                            sum += px[m];
+                            count += px[m] ? 1 : 0;
+                        }
+                    }
+                    v = count ? ((sum + (count / 2)) / count) : 0;
+                }
+                if (!v)
+                    continue;
+
+                if (mode_ == VolumeMode::Weighted)
+                {
+                    if (p[0] >= -1 && p[1] >= -1 && p[2] >= -1)
+                        splat(p, v);
+                    continue;
+                }
+
+                if (p[0] < -0.5 || p[1] < -0.5 || p[2] < -0.5)
+                    continue;
+                auto acc = allocate(static_cast<int>(p[0] + 0.5), static_cast<int>(p[1] + 0.5), static_cast<int>(p[2] + 0.5));
+                if (acc && (acc->load(std::memory_order_relaxed) & WEIGHT_MASK) < WEIGHT_LIMIT)
+                    acc->fetch_add((v << WEIGHT_BITS) | 1, std::memory_order_relaxed);
+            }
+        }
+    });
+}
+
+/// retrieves the compounded intensity of a voxel
+/// @param[in] x the voxel column
+/// @param[in] y the voxel row
+/// @param[in] z the voxel slice
+/// @param[out] value the intensity
+/// @return true if the voxel holds data
+bool VolumeBuilder::voxel(int x, int y, int z, uint8_t& value) const
+{
+    if (!directory_)
+        return false;
+
+    const auto acc = accumulator(x, y, z);
+    const auto a = acc ? acc->load(std::memory_order_relaxed) : 0;
+    const auto wt = a & WEIGHT_MASK;
+    if (!wt)
+        return false;
+
+    value = static_cast<uint8_t>(std::min<uint64_t>(255, ((a >> WEIGHT_BITS) + (wt / 2)) / wt));
+    return true;
+}
+
+/// fills empty voxels between swept frames by interpolating the nearest samples on either side along each axis
+/// @param[in] radius the # of voxels searched on either side
+/// @return the # of voxels filled
+/// @note only runs once stopped, filled voxels take the lowest weight so a later sweep overrides them
+uint64_t VolumeBuilder::fill(int radius)
+{
+    if (running_ || !directory_ || radius <= 0)
+        return 0;
+
+    std::vector<int> allocated;
+    const auto n = bdim_ * bdim_ * bdim_;
+    for (auto b = 0; b < n; b++)
+    {
+        if (directory_[b].load(std::memory_order_relaxed))
+            allocated.push_back(b);
+    }
+
+    // holes are found against the compounded data only, fills are applied once every brick is scanned
+    std::mutex merge;
+    std::vector<std::pair<std::atomic<uint64_t>*, uint64_t>> fills;
+    workers_.run(static_cast<int>(allocated.size()), [this, &allocated, &merge, &fills, radius](int begin, int end)
+    {
+        std::vector<std::pair<std::atomic<uint64_t>*, uint64_t>> local;
+        for (auto i = begin; i < end; i++)
+        {
+            const auto b = allocated[i];
+            const int bx = (b % bdim_) * VOLUME_BRICK, by = ((b / bdim_) % bdim_) * VOLUME_BRICK, bz = (b / (bdim_ * bdim_)) * VOLUME_BRICK;
+            for (auto v = 0; v < Voxels; v++)
+            {
+                const int x = bx + (v & (VOLUME_BRICK - 1)), y = by + ((v >> BRICK_SHIFT) & (VOLUME_BRICK - 1)), z = bz + (v >> (2 * BRICK_SHIFT));
+                auto acc = accumulator(x, y, z);
+                if (acc->load(std::memory_order_relaxed) & WEIGHT_MASK)
+                    continue;
+
+                double sum = 0, weight = 0;
+                const int axes[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+                for (const auto& a : axes)
+                {
+                    uint8_t lo = 0, hi = 0;
+                    int dlo = 0, dhi = 0;
+                    for (auto d = 1; d <= radius && !dlo; d++)
+                    {
+                        if (voxel(x - (a[0] * d), y - (a[1] * d), z - (a[2] * d), lo))
+                            dlo = d;
+                    }
+                    for (auto d = 1; d <= radius && dlo && !dhi; d++)
+                    {
+                        if (voxel(x + (a[0] * d), y + (a[1] * d), z + (a[2] * d), hi))
+                            dhi = d;
+                    }
+                    if (!dlo || !dhi)
+                        continue;
+                    sum += (lo / static_cast<double>(dlo)) + (hi / static_cast<double>(dhi));
+                    weight += (1.0 / dlo) + (1.0 / dhi);
+                }
+                if (weight > 0)
+                    local.emplace_back(acc, (static_cast<uint64_t>((sum / weight) + 0.5) << WEIGHT_BITS) | 1);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(merge);
+        fills.insert(fills.end(), local.begin(), local.end());
+    });
+
+    for (const auto& f : fills)
+        f.first->store(f.second, std::memory_order_relaxed);
+    return fills.size();
+}
+
+/// saves the swept region as a (z, y, x) uint8 numpy array, empty voxels are 0
+/// @param[in] path the file path
+/// @return success of the call
+/// @note the array spans the bounding box of the allocated bricks, voxels are VOLUME_VOXEL microns unless started otherwise
+bool VolumeBuilder::save(const QString& path) const
+{
+    if (running_ || !directory_ || !bricks_)
+        return false;
+
+    int lo[3] = { bdim_, bdim_, bdim_ }, hi[3] = { -1, -1, -1 };
+    const auto n = bdim_ * bdim_ * bdim_;
+    for (auto b = 0; b < n; b++)
+    {
+        if (!directory_[b].load(std::memory_order_relaxed))
+            continue;
+        const int c[3] = { b % bdim_, (b / bdim_) % bdim_, b / (bdim_ * bdim_) };
+        for (auto i = 0; i < 3; i++)
+        {
+            lo[i] = std::min(lo[i], c[i]);
+            hi[i] = std::max(hi[i], c[i]);
+        }
+    }
+
+    const int w = (hi[0] - lo[0] + 1) * VOLUME_BRICK, h = (hi[1] - lo[1] + 1) * VOLUME_BRICK, d = (hi[2] - lo[2] + 1) * VOLUME_BRICK;
+    NpyWriter out;
+    if (!out.open(path, "|u1", { h, w }, static_cast<uint64_t>(w) * h))
+        return false;
+
+    std::vector<uint8_t> slice(static_cast<size_t>(w) * h);
+    auto ok = true;
+    for (auto k = 0; k < d && ok; k++)
+    {
+        const auto z = (lo[2] * VOLUME_BRICK) + k;
+        for (auto j = 0; j < h; j++)
+        {
+            const auto y = (lo[1] * VOLUME_BRICK) + j;
+            for (auto i = 0; i < w; i++)
+            {
+                uint8_t v = 0;
+                voxel((lo[0] * VOLUME_BRICK) + i, y, z, v);
+                slice[(static_cast<size_t>(j) * w) + i] = v;
+            }
+        }
+        ok = out.append(slice.data());
+    }
+    return out.close() && ok;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "workers.h"
+#include <solum/solum_def.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define VOLUME_BRICK        8           // voxels along each edge of a brick
+#define VOLUME_DIM          256         // default voxels along each edge of the volume
+#define VOLUME_VOXEL        500.0       // default voxel size in microns
+#define VOLUME_BRICKS       16384       // default limit on allocated bricks, 4 kB each
+#define VOLUME_QUEUE        2           // frames waiting to be compounded before new ones are dropped
+#define VOLUME_FILL_RADIUS  3           // voxels searched on either side of an empty voxel for samples to interpolate
+
+/// how pixels are compounded into voxels
+enum class VolumeMode
+{
+    Nearest,    ///< pixel nearest neighbor, each pixel adds to the voxel it falls into
+    Weighted,   ///< distance weighted, each pixel is spread over the 8 surrounding voxels
+};
+
+/// freehand volume reconstruction from processed frames and the imu orientation
+///
+/// frames are swept through a sparse grid of bricks that are only allocated once a pixel lands in them, so memory
+/// follows the swept region and is capped by the brick limit; the sdk thread only converts the frame into a queue
+/// slot, compounding runs on a background thread that splits the rows across the worker pool and adds into packed
+/// atomic accumulators, so no locks are taken per voxel
+class VolumeBuilder
+{
+public:
+    explicit VolumeBuilder(int threads = 0);
+    ~VolumeBuilder();
+
+    VolumeBuilder(const VolumeBuilder&) = delete;
+    VolumeBuilder& operator=(const VolumeBuilder&) = delete;
+
+    bool start(int dim = VOLUME_DIM, double voxelSize = VOLUME_VOXEL, int maxBricks = VOLUME_BRICKS, VolumeMode mode = VolumeMode::Nearest);
+    void stop();
+    bool isRunning() const { return running_; }
+    void insert(const void* img, const CusProcessedImageInfo* nfo, const CusPosInfo& pose);
+
+    uint64_t fill(int radius = VOLUME_FILL_RADIUS);
+    bool voxel(int x, int y, int z, uint8_t& value) const;
+    bool save(const QString& path) const;
+
+    int dim() const { return dim_; }
+    double voxelSize() const { return voxelSize_; }
+    uint64_t frames() const { return frames_; }
+    uint64_t dropped() const { return dropped_; }
+    int bricks() const { return bricks_; }
+    uint64_t memory() const { return static_cast<uint64_t>(bricks_) * sizeof(Brick); }
+
+private:
+    static constexpr int Voxels = VOLUME_BRICK * VOLUME_BRICK * VOLUME_BRICK;
+
+    /// block of voxels, each voxel packs the weighted intensity sum in the upper 40 bits and the weight in the lower 24
+    struct Brick
+    {
+        std::atomic<uint64_t> acc[Voxels];  ///< accumulators
+    };
+
+    /// frame waiting to be compounded
+    struct Frame
+    {
+        std::vector<uint8_t> pixels;    ///< 8 bit intensities
+        int width = 0;                  ///< width in pixels
+        int height = 0;                 ///< height in pixels
+        double mpp = 0;                 ///< microns per pixel
+        double originX = 0;             ///< transducer position in microns from the left edge
+        double originY = 0;             ///< transducer position in microns from the top edge
+        double q[4] = { 1, 0, 0, 0 };   ///< orientation relative to the first frame
+    };
+
+    void loop();
+    void compound(const Frame& f);
+    void splat(const double* p, uint64_t v);
+    void release();
+    std::atomic<uint64_t>* accumulator(int x, int y, int z) const;
+    std::atomic<uint64_t>* allocate(int x, int y, int z);
+
+private:
+    Workers workers_;                                   ///< threads the rows of a frame are split across
+    std::unique_ptr<std::atomic<Brick*>[]> directory_;  ///< brick per grid cell, null where nothing was swept
+    int dim_;                                           ///< voxels along each edge, a multiple of the brick size
+    int bdim_;                                          ///< bricks along each edge
+    double voxelSize_;                                  ///< voxel size in microns
+    int maxBricks_;                                     ///< limit on allocated bricks
+    VolumeMode mode_;                                  ///< compounding mode
+    std::atomic<int> bricks_;                           ///< # of allocated bricks
+    std::atomic_bool running_;                          ///< insertion state
+    std::mutex lock_;                                   ///< protects the queue
+    std::condition_variable wake_;                      ///< signals a queued frame or shutdown
+    std::thread thread_;                                ///< compounding thread
+    bool quit_;                                         ///< compounding thread shutdown flag
+    Frame queue_[VOLUME_QUEUE];                         ///< queued frames, the head is compounded in place
+    int head_;                                          ///< index of the oldest queued frame
+    int queued_;                                        ///< # of queued frames
+    bool oriented_;                                     ///< set once the reference orientation is taken from the first frame
+    double q0_[4];                                      ///< inverse of the first frame orientation
+    std::atomic<uint64_t> frames_;                      ///< # of frames compounded
+    std::atomic<uint64_t> dropped_;                     ///< # of frames dropped while the queue was full or not convertible
+};
@@ -0,0 +1,93 @@
+#include "workers.h"
+#include <algorithm>
+
+/// default constructor, no threads are started until the first job so unused pools cost nothing
+/// @param[in] threads total # of threads to split work across including the caller, 0 to use the hardware concurrency
+Workers::Workers(int threads) : size_(threads), job_(nullptr), count_(0), pending_(0), generation_(0), quit_(false)
+{
+    if (size_ <= 0)
+        size_ = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+/// destructor
+Workers::~Workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        quit_ = true;
+    }
+    start_.notify_all();
+    for (auto& t : threads_)
+        t.join();
+}
+
+/// splits a range of items into contiguous blocks and runs them across the pool
+/// @param[in] count the # of items to process
+/// @param[in] fn the function to run on each block
+/// @note blocks until all items are processed, must not be called concurrently
+void Workers::run(int count, const RangeFn& fn)
+{
+    if (count <= 0)
+        return;
+
+    if (size_ == 1 || count == 1)
+    {
+        fn(0, count);
+        return;
+    }
+
+    if (threads_.empty())
+    {
+        for (auto i = 0; i < size_ - 1; i++)
+            threads_.emplace_back(&Workers::loop, this, i);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        job_ = &fn;
+        count_ = count;
+        pending_ = static_cast<int>(threads_.size());
+        generation_++;
+    }
+    start_.notify_all();
+
+    // the caller takes the last block
+    const int n = size();
+    fn((count * (n - 1)) / n, count);
+
+    std::unique_lock<std::mutex> lock(lock_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    job_ = nullptr;
+}
+
+/// pool thread loop
+/// @param[in] index the thread index which selects the block to process
+void Workers::loop(int index)
+{
+    unsigned int seen = 0;
+    for (;;)
+    {
+        const RangeFn* job;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            start_.wait(lock, [this, seen] { return quit_ || generation_ != seen; });
+            if (quit_)
+                return;
+            seen = generation_;
+            job = job_;
+            count = count_;
+        }
+
+        const int n = size();
+        const int begin = (count * index) / n, end = (count * (index + 1)) / n;
+        if (begin < end)
+            (*job)(begin, end);
+
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (--pending_ == 0)
+                done_.notify_one();
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// fixed pool of threads used to split per-frame work into ranges, the threads are started by the first job
+class Workers
+{
+public:
+    /// range function
+    /// @param[in] begin first index of the range
+    /// @param[in] end one past the last index of the range
+    using RangeFn = std::function<void(int begin, int end)>;
+
+    explicit Workers(int threads = 0);
+    ~Workers();
+
+    Workers(const Workers&) = delete;
+    Workers& operator=(const Workers&) = delete;
+
+    int size() const { return size_; }
+    void run(int count, const RangeFn& fn);
+
+private:
+    void loop(int index);
+
+private:
+    std::vector<std::thread> threads_;  ///< pool threads, the calling thread acts as the last worker
+    int size_;                          ///< total # of threads including the caller
+    std::mutex lock_;                   ///< protects the job state
+    std::condition_variable start_;     ///< signals a new job
+    std::condition_variable done_;      ///< signals job completion
+    const RangeFn* job_;                ///< current job
+    int count_;                         ///< # of items in the current job
+    int pending_;                       ///< # of pool threads still working on the current job
+    unsigned int generation_;           ///< job counter so threads run each job once
+    bool quit_;                         ///< shutdown flag
+};